@@ -0,0 +1,141 @@
+#include "bu/utilities.hpp"
+#include "bytestack.hpp"
+
+
+#ifdef _WIN32
+
+// Copied the necessary declarations from Windows.h, for the same reason as in bu/color.cpp
+
+extern "C" {
+    typedef unsigned long      DWORD;
+    typedef int                BOOL;
+    typedef unsigned long long SIZE_T;
+
+    void* __declspec(dllimport) VirtualAlloc(void*, SIZE_T, DWORD, DWORD);
+    BOOL  __declspec(dllimport) VirtualFree(void*, SIZE_T, DWORD);
+}
+
+#define MEM_COMMIT     0x00001000
+#define MEM_RESERVE    0x00002000
+#define MEM_RELEASE    0x00008000
+#define PAGE_NOACCESS  0x01
+#define PAGE_READWRITE 0x04
+
+#else
+
+#include <unistd.h>
+#include <sys/mman.h>
+
+#endif
+
+
+namespace {
+
+    auto page_size() noexcept -> bu::Usize {
+#ifdef _WIN32
+        return 4096;
+#else
+        return static_cast<bu::Usize>(sysconf(_SC_PAGESIZE));
+#endif
+    }
+
+    auto round_up_to_pages(bu::Usize const size) noexcept -> bu::Usize {
+        auto const pages = page_size();
+        return std::max((size + pages - 1) / pages * pages, pages);
+    }
+
+    auto make_accessible(std::byte* const memory, bu::Usize const size) noexcept -> bool {
+#ifdef _WIN32
+        return VirtualAlloc(memory, size, MEM_COMMIT, PAGE_READWRITE) != nullptr;
+#else
+        return mprotect(memory, size, PROT_READ | PROT_WRITE) == 0;
+#endif
+    }
+
+    // Reserves the guards and the stack between them, of which only the first committed bytes are accessible
+    auto map_guarded(bu::Usize const capacity, bu::Usize const committed) -> std::byte* {
+        auto const total = capacity + 2 * bu::Bytestack::guard_size;
+#ifdef _WIN32
+        auto const mapping = static_cast<std::byte*>(VirtualAlloc(nullptr, total, MEM_RESERVE, PAGE_NOACCESS));
+        if (!mapping) {
+            return nullptr;
+        }
+        if (!make_accessible(mapping + bu::Bytestack::guard_size, committed)) {
+            VirtualFree(mapping, 0, MEM_RELEASE);
+            return nullptr;
+        }
+#else
+        void* const address = mmap(nullptr, total, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (address == MAP_FAILED) {
+            return nullptr;
+        }
+        auto const mapping = static_cast<std::byte*>(address);
+        if (!make_accessible(mapping + bu::Bytestack::guard_size, committed)) {
+            munmap(mapping, total);
+            return nullptr;
+        }
+#endif
+        return mapping + bu::Bytestack::guard_size;
+    }
+
+}
+
+
+auto bu::Bytestack_deleter::operator()(std::byte* const memory) const noexcept -> void {
+    if (!is_guarded) {
+        delete[] memory;
+    }
+    else if (memory) {
+#ifdef _WIN32
+        VirtualFree(memory - Bytestack::guard_size, 0, MEM_RELEASE);
+#else
+        munmap(memory - Bytestack::guard_size, capacity + 2 * Bytestack::guard_size);
+#endif
+    }
+}
+
+
+auto bu::Bytestack::map(Usize const capacity, Usize const committed) -> Bytestack {
+    std::byte* const memory = map_guarded(capacity, committed);
+    if (!memory) {
+        throw bu::exception("Could not map a guarded stack of {} bytes", capacity);
+    }
+    return Bytestack {
+        std::unique_ptr<std::byte[], Bytestack_deleter> { memory, Bytestack_deleter { .capacity = capacity, .is_guarded = true } },
+        capacity,
+        committed
+    };
+}
+
+
+auto bu::Bytestack::guarded(Usize const capacity) -> Bytestack {
+    auto const rounded = round_up_to_pages(capacity);
+    return map(rounded, rounded);
+}
+
+
+auto bu::Bytestack::growable(Usize const capacity) -> Bytestack {
+    auto const rounded = round_up_to_pages(capacity);
+#ifdef _WIN32
+    return map(rounded, rounded);
+#else
+    return map(rounded, std::min(round_up_to_pages(initial_growable_size), rounded));
+#endif
+}
+
+
+auto bu::Bytestack::commit(std::byte const* const address) noexcept -> bool {
+    if (address < base() || address >= base() + length) {
+        return false;
+    }
+    auto const needed    = static_cast<Usize>(address - base()) + 1;
+    auto const new_size  = std::min(round_up_to_pages(std::max(needed, 2 * committed)), length);
+
+    if (new_size > committed) {
+        if (!make_accessible(base() + committed, new_size - committed)) {
+            return false;
+        }
+        committed = new_size;
+    }
+    return true;
+}
\ No newline at end of file
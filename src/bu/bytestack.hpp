@@ -5,27 +5,50 @@
 
 namespace bu {
 
-    class [[nodiscard]] Bytestack {
+    enum class Bounds_checking {
+        checked,   // Every access is checked
+        unchecked, // The accesses have been proven to stay within bounds, which is only asserted
+        guarded,   // The stack is guarded, and accesses out of bounds are caught when they fault
+    };
 
-        std::unique_ptr<std::byte[]> buffer;
-        Usize                        length;
 
-    public:
-        std::byte* pointer;
-    private:
+    // The stack pointer of a Bytestack along with the bounds it must stay within.
+    // It is copyable so that an interpreter can keep it in a local variable for
+    // the duration of a hot loop, and write the stack pointer back afterwards.
+    // The unchecked and guarded forms skip the bounds checks, and may only be used
+    // when the stack accesses stay within bounds or are caught by other means.
+    template <Bounds_checking checking>
+    class [[nodiscard]] Basic_bytestack_cursor {
+        template <Bounds_checking>
+        friend class Basic_bytestack_cursor;
+
+        static constexpr bool is_checked = checking == Bounds_checking::checked;
+    protected:
+        std::byte* bottom_pointer;
         std::byte* top_pointer;
     public:
+        std::byte* pointer;
 
-        explicit Bytestack(Usize const capacity) noexcept
-            : buffer { std::make_unique_for_overwrite<std::byte[]>(capacity) }
-            , length { capacity }
-            , pointer { buffer.get() }
-            , top_pointer { pointer + capacity } {}
+        Basic_bytestack_cursor(std::byte* const bottom, std::byte* const top) noexcept
+            : bottom_pointer { bottom }
+            , top_pointer    { top }
+            , pointer        { bottom } {}
+
+        template <Bounds_checking other_checking> requires (other_checking != checking)
+        explicit Basic_bytestack_cursor(Basic_bytestack_cursor<other_checking> const& other) noexcept
+            : bottom_pointer { other.bottom_pointer }
+            , top_pointer    { other.top_pointer }
+            , pointer        { other.pointer } {}
 
         template <trivial T>
-        auto push(T const x) noexcept -> void {
-            if (pointer + sizeof x > top_pointer) [[unlikely]] {
-                bu::abort("stack overflow");
+        ALWAYS_INLINE auto push(T const x) noexcept -> void {
+            if constexpr (is_checked) {
+                if (pointer + sizeof x > top_pointer) [[unlikely]] {
+                    bu::abort("stack overflow");
+                }
+            }
+            else if constexpr (checking == Bounds_checking::unchecked) {
+                assert(pointer + sizeof x <= top_pointer);
             }
 
             std::memcpy(pointer, &x, sizeof x);
@@ -33,10 +56,8 @@ namespace bu {
         }
 
         template <trivial T>
-        auto pop() noexcept -> T {
-            if (buffer.get() + sizeof(T) > pointer) [[unlikely]] {
-                bu::abort("stack underflow");
-            }
+        ALWAYS_INLINE auto pop() noexcept -> T {
+            check_underflow(sizeof(T));
 
             T x;
             pointer -= sizeof x;
@@ -45,21 +66,94 @@ namespace bu {
         }
 
         template <trivial T>
-        auto top() const noexcept -> T {
-            if (buffer.get() + sizeof(T) > pointer) [[unlikely]] {
-                bu::abort("stack underflow");
-            }
+        ALWAYS_INLINE auto top() const noexcept -> T {
+            check_underflow(sizeof(T));
 
             T x;
             std::memcpy(&x, pointer - sizeof x, sizeof x);
             return x;
         }
 
+    private:
+
+        ALWAYS_INLINE auto check_underflow(Usize const size) const noexcept -> void {
+            if constexpr (is_checked) {
+                if (bottom_pointer + size > pointer) [[unlikely]] {
+                    bu::abort("stack underflow");
+                }
+            }
+            else if constexpr (checking == Bounds_checking::unchecked) {
+                assert(bottom_pointer + size <= pointer);
+            }
+        }
+    };
+
+    using Bytestack_cursor           = Basic_bytestack_cursor<Bounds_checking::checked>;
+    using Unchecked_bytestack_cursor = Basic_bytestack_cursor<Bounds_checking::unchecked>;
+    using Guarded_bytestack_cursor   = Basic_bytestack_cursor<Bounds_checking::guarded>;
+
+
+    // Frees the memory of either kind of Bytestack
+    struct Bytestack_deleter {
+        Usize capacity   = 0;
+        bool  is_guarded = false;
+
+        auto operator()(std::byte*) const noexcept -> void;
+    };
+
+
+    class [[nodiscard]] Bytestack : public Bytestack_cursor {
+
+        std::unique_ptr<std::byte[], Bytestack_deleter> buffer;
+        Usize                                           length;
+        Usize                                           committed; // The accessible part, which only a growable stack can extend
+
+        Bytestack(std::unique_ptr<std::byte[], Bytestack_deleter>&& buffer, Usize const capacity, Usize const committed) noexcept
+            : Bytestack_cursor { buffer.get(), buffer.get() + capacity }
+            , buffer           { std::move(buffer) }
+            , length           { capacity }
+            , committed        { committed } {}
+
+        static auto map(Usize capacity, Usize committed) -> Bytestack;
+
+    public:
+
+        // The number of bytes that can not be accessed on either side of a guarded stack.
+        // No single access made through a cursor, or relative to a pointer into the
+        // stack, reaches further than this, so no access can skip over a guard.
+        static constexpr Usize guard_size = 1 << 17;
+
+        // The size of the accessible part of a new growable stack, before rounding up to a page
+        static constexpr Usize initial_growable_size = 1 << 12;
+
+        explicit Bytestack(Usize const capacity) noexcept
+            : Bytestack { std::unique_ptr<std::byte[], Bytestack_deleter> { std::make_unique_for_overwrite<std::byte[]>(capacity).release() }, capacity, capacity } {}
+
+        // A stack whose capacity is rounded up to whole pages, with guard_size bytes on either
+        // side that fault when accessed, so that a cursor can leave out its bounds checks as long
+        // as the fault is handled. Throws bu::Exception if the memory can not be mapped.
+        static auto guarded(Usize capacity) -> Bytestack;
+
+        // A guarded stack of which only the first page or so is accessible at first. The rest
+        // of the capacity is reserved, but costs no memory until commit makes it accessible,
+        // and since the stack never moves, pointers into it stay valid as it grows. Where
+        // faults can not be handled, the whole capacity is made accessible at once.
+        static auto growable(Usize capacity) -> Bytestack;
+
+        // Makes a growable stack accessible up to and including the given address, at least
+        // doubling the accessible part. Returns false if the address is beyond the capacity.
+        // Only makes system calls, so it may be called from a signal handler.
+        auto commit(std::byte const* address) noexcept -> bool;
+
         auto base()       noexcept -> std::byte      * { return buffer.get(); }
         auto base() const noexcept -> std::byte const* { return buffer.get(); }
 
         auto capacity() const noexcept -> Usize { return length; }
 
+        auto committed_capacity() const noexcept -> Usize { return committed; }
+
+        auto is_guarded() const noexcept -> bool { return buffer.get_deleter().is_guarded; }
+
     };
 
 }
\ No newline at end of file
@@ -87,6 +87,75 @@ namespace bu {
     }
 
 
+    // Compute the wrapped result and return whether the operation overflowed or underflowed.
+    // GCC and Clang lower these to the operation followed by a single test of the overflow
+    // flag, while other compilers fall back to the predicates above.
+
+#if defined(__GNUC__) || defined(__clang__)
+
+    template <std::integral T>
+    constexpr auto add_overflow(T const a, T const b, T& result) noexcept -> bool {
+        return __builtin_add_overflow(a, b, &result);
+    }
+
+    template <std::integral T>
+    constexpr auto subtract_overflow(T const a, T const b, T& result) noexcept -> bool {
+        return __builtin_sub_overflow(a, b, &result);
+    }
+
+    template <std::integral T>
+    constexpr auto multiply_overflow(T const a, T const b, T& result) noexcept -> bool {
+        return __builtin_mul_overflow(a, b, &result);
+    }
+
+#else
+
+    template <std::integral T>
+    constexpr auto add_overflow(T const a, T const b, T& result) noexcept -> bool {
+        using U = std::make_unsigned_t<T>;
+        result = static_cast<T>(static_cast<U>(a) + static_cast<U>(b));
+        return would_addition_overflow(a, b) || would_addition_underflow(a, b);
+    }
+
+    template <std::integral T>
+    constexpr auto subtract_overflow(T const a, T const b, T& result) noexcept -> bool {
+        using U = std::make_unsigned_t<T>;
+        result = static_cast<T>(static_cast<U>(a) - static_cast<U>(b));
+        return would_subtraction_overflow(a, b) || would_subtraction_underflow(a, b);
+    }
+
+    template <std::integral T>
+    constexpr auto multiply_overflow(T const a, T const b, T& result) noexcept -> bool {
+        using U = std::make_unsigned_t<T>;
+        result = static_cast<T>(static_cast<U>(a) * static_cast<U>(b));
+        return would_multiplication_overflow(a, b) || would_multiplication_underflow(a, b);
+    }
+
+#endif
+
+
+    // Signed overflow is undefined, so signed integers wrap around through their unsigned counterparts
+    template <template <class> class F>
+    struct Wrapping {
+        template <class T>
+        struct Operation {
+            constexpr auto operator()(T const left, T const right) const noexcept -> T {
+                if constexpr (std::signed_integral<T>) {
+                    using U = std::make_unsigned_t<T>;
+                    return static_cast<T>(F<U>{}(static_cast<U>(left), static_cast<U>(right)));
+                }
+                else {
+                    return F<T>{}(left, right);
+                }
+            }
+        };
+    };
+
+    template <class T> using wrapping_plus       = Wrapping<std::plus>::Operation<T>;
+    template <class T> using wrapping_minus      = Wrapping<std::minus>::Operation<T>;
+    template <class T> using wrapping_multiplies = Wrapping<std::multiplies>::Operation<T>;
+
+
     template <std::integral T>
     class Safe_integer {
         T value = 0;
@@ -727,6 +727,18 @@ struct std::hash<bu::Pair<Fst, Snd>> {
 [[nodiscard]] auto operator==(name const&) const noexcept -> bool = default
 
 
+// For small functions on interpreter hot paths that must be inlined even when
+// the optimizer would decide against it
+
+#if defined(_MSC_VER)
+#define ALWAYS_INLINE __forceinline
+#elif defined(__GNUC__) || defined(__clang__)
+#define ALWAYS_INLINE [[gnu::always_inline]] inline
+#else
+#define ALWAYS_INLINE inline
+#endif
+
+
 #define DECLARE_FORMATTER_FOR_TEMPLATE(...)                             \
 struct std::formatter<__VA_ARGS__> : bu::fmt::Formatter_base {          \
     [[nodiscard]] auto format(__VA_ARGS__ const&, std::format_context&) \
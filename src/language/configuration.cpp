@@ -37,6 +37,11 @@ namespace {
     static_assert(remove_comments("") == "");
 
 
+    auto configuration_file_path() -> std::filesystem::path {
+        return std::filesystem::current_path() / "vmt22a_config";
+    }
+
+
     constexpr auto allowed_keys = std::to_array<std::string_view>({
         "language version",
         "source directory",
@@ -94,7 +99,7 @@ auto language::default_configuration() -> Configuration {
 
 
 auto language::read_configuration() -> Configuration {
-    auto configuration_path = std::filesystem::current_path() / "vmt22a_config";
+    auto configuration_path = configuration_file_path();
 
     Configuration configuration;
     configuration.container().reserve(10);
@@ -154,8 +159,8 @@ auto language::read_configuration() -> Configuration {
             configuration.add(
                 std::string(key),
                 value.empty()
-                    ? std::optional(std::string(value))
-                    : std::nullopt
+                    ? std::nullopt
+                    : std::optional(std::string(value))
             );
         }
 
@@ -164,4 +169,13 @@ auto language::read_configuration() -> Configuration {
     else {
         return default_configuration();
     }
+}
+
+
+auto language::write_configuration(Configuration const& configuration) -> void {
+    std::ofstream file { configuration_file_path() };
+    if (!file) {
+        throw bu::exception("Could not write the configuration file");
+    }
+    file << configuration.string();
 }
\ No newline at end of file
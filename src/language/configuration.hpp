@@ -6,7 +6,9 @@
 
 namespace language {
 
-    constexpr bu::Usize version = 0;
+    // Incremented whenever the serialized program formats or the opcodes change,
+    // so that programs compiled by an earlier version are rejected instead of misread
+    constexpr bu::Usize version = 1;
 
 
     struct Configuration_key {
@@ -50,4 +52,7 @@ namespace language {
 
     auto read_configuration() -> Configuration;
 
+    // Writes the configuration to the file that read_configuration reads
+    auto write_configuration(Configuration const&) -> void;
+
 }
\ No newline at end of file
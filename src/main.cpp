@@ -15,6 +15,8 @@
 #include "vm/bytecode.hpp"
 #include "vm/virtual_machine.hpp"
 #include "vm/vm_formatting.hpp"
+#include "vm/vm_benchmark.hpp"
+#include "vm/superinstructions.hpp"
 
 #include "tests/tests.hpp"
 
@@ -156,16 +158,23 @@ auto main(int argc, char const** argv) -> int try {
         ("new"    , cli::string("name"), "Create a new vmt project")
         ("repl"   , cli::string("name"), "Run the given repl"      )
         ("machine"                                                 )
+        ("jit"    ,                      "Run the machine with the JIT enabled")
+#ifdef VMT22A_PROFILING
+        ("profile",                      "Profile the opcodes run by the machine, and write the profile to profile.json")
+        ("stack"  ,                      "Measure the stack used by the machine, and write a suggested stack capacity to vmt22a_config")
+#endif
+        ("trace"  ,                      "Record the last instructions run by the machine, and print them if it fails")
         ("resolve"                                                 )
         ("nocolor",                      "Disable colored output"  )
         ("time"   ,                      "Print the execution time")
-        ("test"   ,                      "Run all tests"           );
+        ("test"   ,                      "Run all tests"           )
+        ("bench"  ,                      "Run the VM benchmarks"   )
+        ("mine"   , cli::string("dir"),  "Print common opcode pairs in the compiled programs in dir");
 
     cli::Options options = bu::expect(cli::parse_command_line(argc, argv, description));
 
 
     auto configuration = language::read_configuration();
-    (void)configuration;
 
     bu::Logging_timer execution_timer { [&options](bu::Logging_timer::Duration const elapsed) {
             if (options["time"]) {
@@ -195,13 +204,20 @@ auto main(int argc, char const** argv) -> int try {
         tests::run_all_tests();
     }
 
-    if (options["machine"]) {
-        vm::Virtual_machine machine { .stack = bu::Bytestack { 32 } };
+    if (options["bench"]) {
+        vm::run_benchmarks();
+    }
 
-        auto const string = machine.program.constants.add_to_string_pool("Hello, world!\n");
+    if (std::string_view const* const directory = options["mine"]) {
+        vm::print_superinstruction_candidates(*directory);
+    }
+
+    if (options["machine"]) {
+        vm::Executable_program program;
+        auto const string = program.constants.add_to_string_pool("Hello, world!\n");
 
         using enum vm::Opcode;
-        machine.program.bytecode.write(
+        program.bytecode.write(
             ipush, 0_iz,
             iinc_top,
             idup,
@@ -211,7 +227,47 @@ auto main(int argc, char const** argv) -> int try {
             halt
         );
 
-        return machine.run();
+        auto dispatch_engine = options["jit"]   ? vm::Dispatch_engine::jit
+                             : options["trace"] ? vm::Dispatch_engine::traced
+                                                : vm::Dispatch_engine::threaded;
+#ifdef VMT22A_PROFILING
+        if (options["profile"] || options["stack"]) {
+            dispatch_engine = vm::Dispatch_engine::profiled;
+        }
+#endif
+
+        vm::Virtual_machine machine {
+            .image           = vm::Program_image::make(std::move(program)),
+            .stack_capacity  = 32,
+            .dispatch_engine = dispatch_engine,
+        };
+
+        auto const exit_code = machine.run();
+
+#ifdef VMT22A_PROFILING
+        if (options["profile"]) {
+            machine.profile.print_report();
+            std::ofstream { "profile.json" } << machine.profile.to_json();
+
+            bu::print("\n");
+            machine.collection_profile.print_report();
+        }
+
+        if (options["stack"]) {
+            machine.stack_profile.print_report();
+
+            auto capacity = "{} // suggested by --stack"_format(machine.stack_profile.suggested_capacity());
+            if (auto* const key = configuration.find("stack capacity")) {
+                *key = language::Configuration_key { std::move(capacity) };
+            }
+            else {
+                configuration.add("stack capacity"s, language::Configuration_key { std::move(capacity) });
+            }
+            language::write_configuration(configuration);
+        }
+#endif
+
+        return exit_code;
     }
 
     if (options["resolve"]) {
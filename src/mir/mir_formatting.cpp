@@ -140,6 +140,9 @@ namespace {
         auto operator()(mir::type::Reference const& reference) {
             return format("&{}{}", reference.mutability, reference.referenced_type);
         }
+        auto operator()(mir::type::Pointer const& pointer) {
+            return format("*{}", pointer.pointee_type);
+        }
         auto operator()(mir::type::Function const& function) {
             return format("fn({}): {}", function.parameter_types, function.return_type);
         }
@@ -46,6 +46,11 @@ namespace mir {
             bu::Wrapper<Type> referenced_type;
         };
 
+        // Points to memory allocated by the alloc opcode, which lives until its heap region is exited
+        struct Pointer {
+            bu::Wrapper<Type> pointee_type;
+        };
+
         struct Structure {
             bu::Wrapper<resolution::Struct_info> info;
         };
@@ -85,6 +90,7 @@ namespace mir {
             type::Slice,
             type::Function,
             type::Reference,
+            type::Pointer,
             type::Structure,
             type::Enumeration,
             type::General_variable,
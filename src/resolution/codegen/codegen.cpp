@@ -1,5 +1,20 @@
 #include "bu/utilities.hpp"
 #include "codegen.hpp"
+#include "vm/vm_formatting.hpp"
+
+
+auto resolution::arithmetic_opcode(vm::Opcode const wrapping, Overflow_behavior const behavior) -> vm::Opcode {
+    if (behavior == Overflow_behavior::wrap) {
+        return wrapping;
+    }
+    switch (wrapping) {
+    case vm::Opcode::iadd: return vm::Opcode::iadd_checked;
+    case vm::Opcode::isub: return vm::Opcode::isub_checked;
+    case vm::Opcode::imul: return vm::Opcode::imul_checked;
+    default:
+        bu::abort(std::format("{} has no checked counterpart", wrapping));
+    }
+}
 
 
 auto resolution::codegen(lir::Module&&) -> Module::Code {
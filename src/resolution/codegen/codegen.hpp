@@ -2,11 +2,25 @@
 
 #include "bu/utilities.hpp"
 #include "lir/lir.hpp"
+#include "vm/opcode.hpp"
 #include "resolution/resolution.hpp"
 
 
 namespace resolution {
 
+    // What integer addition, subtraction, and multiplication do on overflow
+    enum class Overflow_behavior {
+        trap, // The checked opcodes, which throw a vm::Trap
+        wrap, // The plain opcodes, which wrap around
+    };
+
+    // Debug builds trap, and release builds wrap around
+    constexpr Overflow_behavior default_overflow_behavior =
+        bu::compiling_in_debug_mode ? Overflow_behavior::trap : Overflow_behavior::wrap;
+
+    // Maps iadd, isub, or imul to the opcode that has the given behavior on overflow
+    auto arithmetic_opcode(vm::Opcode wrapping, Overflow_behavior = default_overflow_behavior) -> vm::Opcode;
+
     auto codegen(lir::Module&&) -> Module::Code;
 
 }
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include "bu/utilities.hpp"
 #include "hir/hir.hpp"
 #include "vm/bytecode.hpp"
+#include "vm/debug_table.hpp"
 
 
 namespace resolution {
@@ -14,6 +15,7 @@ namespace resolution {
         struct Code {
             vm::Bytecode           bytecode;
             std::vector<bu::Usize> module_address_offsets; // Keeps track of module offsets used in the code
+            vm::Debug_table        debug_table;            // Maps the offsets in the code back to the source
         };
 
         Interface inferface;
@@ -88,6 +88,10 @@ namespace {
             }
         }
 
+        auto operator()(mir::type::Pointer const& left, mir::type::Pointer const& right) -> void {
+            recurse(left.pointee_type, right.pointee_type);
+        }
+
         auto operator()(mir::type::Array const& left, mir::type::Array const& right) -> void {
             recurse(left.element_type, right.element_type);
         }
@@ -0,0 +1,347 @@
+#include "bu/utilities.hpp"
+#include "bounds_checks.hpp"
+#include "verifier.hpp"
+#include "opcode.hpp"
+
+
+namespace {
+
+    using Opcode = vm::Opcode;
+
+    // An integer local, identified by its offset from the activation record
+    using Local = bu::Isize;
+
+    constexpr Local integer_size = sizeof(bu::Isize);
+    constexpr Local frame_start  = sizeof(vm::Activation_record);
+
+
+    // A relation between integer locals that holds whenever control reaches an instruction
+    struct Fact {
+        enum class Kind : bu::U8 { nonnegative, below, at_most };
+
+        Kind  kind;
+        Local left;
+        Local right = 0; // Unused by nonnegative
+
+        [[nodiscard]] auto operator<=>(Fact const&) const noexcept = default;
+
+        auto any_local(auto const predicate) const -> bool {
+            return predicate(left) || (kind != Kind::nonnegative && predicate(right));
+        }
+
+        auto involves(Local const offset, Local const size) const -> bool {
+            return any_local([=](Local const local) { return local < offset + size && offset < local + integer_size; });
+        }
+    };
+
+    auto nonnegative(Local const local) noexcept -> Fact {
+        return { Fact::Kind::nonnegative, local };
+    }
+
+    auto below(Local const left, Local const right) noexcept -> Fact {
+        return { Fact::Kind::below, left, right };
+    }
+
+    auto at_most(Local const left, Local const right) noexcept -> Fact {
+        return { Fact::Kind::at_most, left, right };
+    }
+
+
+    // Kept sorted, so that the facts along two paths can be intersected
+    using Facts = std::vector<Fact>;
+
+    auto add(Facts& facts, Fact const fact) -> void {
+        auto const position = std::ranges::lower_bound(facts, fact);
+        if (position == facts.end() || *position != fact) {
+            facts.insert(position, fact);
+        }
+    }
+
+    auto contains(Facts const& facts, Fact const fact) -> bool {
+        return std::ranges::binary_search(facts, fact);
+    }
+
+    auto intersection(Facts const& a, Facts const& b) -> Facts {
+        Facts result;
+        std::ranges::set_intersection(a, b, std::back_inserter(result));
+        return result;
+    }
+
+
+    template <bu::trivial T>
+    auto read(std::span<std::byte const> const code, bu::Usize const offset) noexcept -> T {
+        T value;
+        std::memcpy(&value, code.data() + offset, sizeof value);
+        return value;
+    }
+
+    struct Local_access {
+        Local offset;
+        Local size;
+    };
+
+    // The part of the frame that the load_local or store_local at offset accesses, where
+    // general is either load_local or store_local. See vm::fuse_superinstructions for the
+    // order of their forms.
+    auto local_access(std::span<std::byte const> const code, bu::Usize const offset, Opcode const general)
+        -> std::optional<Local_access>
+    {
+        constexpr auto sized_form_sizes = std::to_array<Local>({ 1, 8, 16 });
+
+        auto const form     = static_cast<int>(code[offset]) - std::to_underlying(general);
+        auto const argument = offset + 1;
+
+        switch (form) {
+        case 0:
+            return Local_access {
+                read<vm::Local_offset_type>(code, argument),
+                read<vm::Local_size_type>(code, argument + sizeof(vm::Local_offset_type)),
+            };
+        case 1: case 2: case 3:
+            return Local_access { read<vm::Local_offset_type>(code, argument), sized_form_sizes[form - 1] };
+        case 4: case 5: case 6:
+            return Local_access { read<vm::Short_local_offset_type>(code, argument), sized_form_sizes[form - 4] };
+        default:
+            return std::nullopt;
+        }
+    }
+
+    auto is_conditional_jump(Opcode const opcode) noexcept -> bool {
+        return (opcode >= Opcode::jump_true && opcode <= Opcode::local_jump_true_32)
+            || (opcode >= Opcode::jump_false && opcode <= Opcode::local_jump_false_32);
+    }
+
+    auto writes_through_pointer(Opcode const opcode) noexcept -> bool {
+        switch (opcode) {
+        case Opcode::bitcopy_from_stack:
+        case Opcode::store_8: case Opcode::store_16: case Opcode::store_32:
+        case Opcode::index_store:
+        case Opcode::index_store_unchecked:
+        case Opcode::ivec_add: case Opcode::fvec_add:
+        case Opcode::ivec_mul: case Opcode::fvec_mul:
+        case Opcode::ivec_eq:  case Opcode::fvec_eq:
+        case Opcode::ivec_lt:  case Opcode::fvec_lt:
+        case Opcode::yield:
+            return true;
+        default:
+            return vm::is_call(opcode);
+        }
+    }
+
+
+    class Bounds_check_eliminator {
+        std::span<std::byte const>                        code;
+        std::vector<std::optional<vm::Control_flow_node>> graph;
+        std::vector<std::optional<bu::Usize>>             sole_predecessors;
+        std::vector<std::optional<Facts>>                 facts; // Those that hold before each instruction
+        bool                                              addresses_are_taken = false;
+
+        auto opcode_at(bu::Usize const offset) const noexcept -> Opcode {
+            return static_cast<Opcode>(code[offset]);
+        }
+
+        // The instruction that control always reaches the one at offset from, if there is one
+        auto previous(std::optional<bu::Usize> const offset) const -> std::optional<bu::Usize> {
+            return offset ? sole_predecessors[*offset] : std::nullopt;
+        }
+
+        auto is(std::optional<bu::Usize> const offset, Opcode const opcode) const -> bool {
+            return offset && opcode_at(*offset) == opcode;
+        }
+
+        // The local that the instruction at offset loads, if it is a load_local of the given size
+        auto loaded_local(std::optional<bu::Usize> const offset, Local const size) const -> std::optional<Local> {
+            if (offset) {
+                if (auto const access = local_access(code, *offset, Opcode::load_local); access && access->size == size) {
+                    return access->offset;
+                }
+            }
+            return std::nullopt;
+        }
+
+        auto pushes_nonnegative_constant(std::optional<bu::Usize> const offset) const -> bool {
+            return is(offset, Opcode::ipush) && read<bu::Isize>(code, *offset + 1) >= 0;
+        }
+
+        // The facts that hold after the instruction at offset, along the edge to its given successor
+        auto transfer(bu::Usize const offset, Facts facts, bu::Usize const successor_index) const -> Facts {
+            auto const& node   = *graph[offset];
+            auto const  opcode = opcode_at(offset);
+
+            // The stack above the preserved depth may have been popped and overwritten
+            auto const preserved_end = frame_start + static_cast<Local>(node.preserved_depth);
+            std::erase_if(facts, [=](Fact const& fact) {
+                return fact.any_local([=](Local const local) { return local + integer_size > preserved_end; });
+            });
+
+            if (auto const store = local_access(code, offset, Opcode::store_local)) {
+                Facts const before = facts;
+                std::erase_if(facts, [&](Fact const& fact) { return fact.involves(store->offset, store->size); });
+
+                if (store->size == integer_size) {
+                    auto const source = previous(offset);
+
+                    // An increment can not overflow while the value is below some other integer
+                    auto const is_safe_increment = [&] {
+                        return is(source, Opcode::iinc_top)
+                            && loaded_local(previous(source), integer_size) == store->offset
+                            && contains(before, nonnegative(store->offset))
+                            && std::ranges::any_of(before, [&](Fact const& fact) {
+                                   return fact.kind == Fact::Kind::below && fact.left == store->offset;
+                               });
+                    };
+                    if (pushes_nonnegative_constant(source) || is_safe_increment()) {
+                        add(facts, nonnegative(store->offset));
+                    }
+                }
+            }
+            else if (pushes_nonnegative_constant(offset)) {
+                // The constant becomes a new local on top of the stack
+                add(facts, nonnegative(preserved_end));
+            }
+            else if (opcode == Opcode::check_bounds) {
+                auto const length = previous(offset);
+                auto const end    = previous(length);
+                if (auto const l = loaded_local(length, integer_size), e = loaded_local(end, integer_size); l && e) {
+                    add(facts, at_most(*e, *l));
+                }
+            }
+            else if (is_conditional_jump(opcode)) {
+                auto const comparison = previous(offset);
+                auto const right      = previous(comparison);
+                auto const left       = previous(right);
+                auto const a          = loaded_local(left, integer_size);
+                auto const b          = loaded_local(right, integer_size);
+
+                if (a && b) {
+                    // The successors are the next instruction followed by the jump target
+                    bool const jumps_if_true = opcode <= Opcode::local_jump_true_32;
+                    bool const is_true       = jumps_if_true == (successor_index == 1);
+
+                    switch (comparison ? opcode_at(*comparison) : Opcode::_opcode_count) {
+                    case Opcode::ilt:  if (is_true)  add(facts, below(*a, *b)); break;
+                    case Opcode::igte: if (!is_true) add(facts, below(*a, *b)); break;
+                    case Opcode::igt:  if (is_true)  add(facts, below(*b, *a)); break;
+                    case Opcode::ilte: if (!is_true) add(facts, below(*b, *a)); break;
+                    default: break;
+                    }
+                }
+            }
+            else if (addresses_are_taken && writes_through_pointer(opcode)) {
+                facts.clear();
+            }
+
+            return facts;
+        }
+
+    public:
+
+        Bounds_check_eliminator(std::span<std::byte const> const code, std::vector<std::optional<vm::Control_flow_node>>&& graph)
+            : code              { code }
+            , graph             { std::move(graph) }
+            , sole_predecessors ( code.size() )
+            , facts             ( code.size() )
+        {
+            std::vector<bu::Usize> predecessor_counts(code.size());
+
+            for (bu::Usize offset = 0; offset != code.size(); ++offset) {
+                if (auto const& node = this->graph[offset]) {
+                    for (bu::Usize const successor : std::span { node->successors }.first(node->successor_count)) {
+                        ++predecessor_counts[successor];
+                        sole_predecessors[successor] = offset;
+                    }
+                    addresses_are_taken |= opcode_at(offset) == Opcode::push_address;
+                }
+            }
+            for (bu::Usize offset = 0; offset != code.size(); ++offset) {
+                if (predecessor_counts[offset] != 1 || (this->graph[offset] && this->graph[offset]->is_function_entry)) {
+                    sole_predecessors[offset] = std::nullopt;
+                }
+            }
+        }
+
+        // Finds the facts that hold before each instruction. Every function starts out knowing
+        // nothing, and the facts at each join are those that hold along every path into it.
+        auto analyze() -> void {
+            std::vector<bu::Usize> worklist;
+            for (bu::Usize offset = 0; offset != code.size(); ++offset) {
+                if (graph[offset] && graph[offset]->is_function_entry) {
+                    facts[offset].emplace();
+                    worklist.push_back(offset);
+                }
+            }
+
+            while (!worklist.empty()) {
+                auto const offset = worklist.back();
+                worklist.pop_back();
+
+                auto const& node = *graph[offset];
+                for (bu::Usize i = 0; i != node.successor_count; ++i) {
+                    auto const successor = node.successors[i];
+                    auto       edge      = transfer(offset, *facts[offset], i);
+
+                    if (!facts[successor]) {
+                        facts[successor] = std::move(edge);
+                        worklist.push_back(successor);
+                    }
+                    else if (auto narrowed = intersection(*facts[successor], edge); narrowed != *facts[successor]) {
+                        facts[successor] = std::move(narrowed);
+                        worklist.push_back(successor);
+                    }
+                }
+            }
+        }
+
+        auto is_in_bounds(bu::Usize const access) const -> bool {
+            auto const index_offset = previous(access);
+            auto const index        = loaded_local(index_offset, integer_size);
+            auto const slice        = loaded_local(previous(index_offset), 2 * integer_size);
+
+            if (!index || !slice || !facts[access]) {
+                return false;
+            }
+
+            Facts const& known  = *facts[access];
+            Local const  length = *slice + integer_size;
+
+            return contains(known, nonnegative(*index))
+                && (contains(known, below(*index, length))
+                    || std::ranges::any_of(known, [&](Fact const& fact) {
+                           return fact.kind == Fact::Kind::below
+                               && fact.left == *index
+                               && contains(known, at_most(fact.right, length));
+                       }));
+        }
+
+        auto is_reachable(bu::Usize const offset) const noexcept -> bool {
+            return graph[offset].has_value();
+        }
+    };
+
+}
+
+
+auto vm::eliminate_bounds_checks(Executable_program& program) -> bu::Usize {
+    auto graph = control_flow_graph(program);
+    if (!graph) {
+        throw std::move(graph.error());
+    }
+
+    auto& code = program.bytecode.bytes;
+
+    Bounds_check_eliminator eliminator { code, std::move(*graph) };
+    eliminator.analyze();
+
+    bu::Usize eliminated = 0;
+    for (bu::Usize offset = 0; offset != code.size(); ++offset) {
+        if (!eliminator.is_reachable(offset)) {
+            continue;
+        }
+        auto const opcode = static_cast<Opcode>(code[offset]);
+        if ((opcode == Opcode::index_load || opcode == Opcode::index_store) && eliminator.is_in_bounds(offset)) {
+            code[offset] = static_cast<std::byte>(opcode == Opcode::index_load ? Opcode::index_load_unchecked : Opcode::index_store_unchecked);
+            ++eliminated;
+        }
+    }
+    return eliminated;
+}
\ No newline at end of file
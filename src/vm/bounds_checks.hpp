@@ -0,0 +1,32 @@
+#pragma once
+
+#include "bu/utilities.hpp"
+#include "virtual_machine.hpp"
+
+
+namespace vm {
+
+    // Proves which index_load and index_store instructions can never be out of bounds,
+    // and replaces them with their unchecked forms in place, so offsets and stack maps
+    // stay valid. Returns the number of checks removed. Throws a Verification_error if
+    // the program is invalid.
+    //
+    // An access is proven when its slice and index are loaded from locals right before it,
+    // and on every path to it the index is known to be at least zero and either below
+    // the length of the slice, or below a bound that check_bounds has found to be within
+    // that length. The index is known to be at least zero when it was initialized with a
+    // nonnegative constant and is only ever incremented with iinc_top while below some
+    // bound. It is known to be below a bound when a comparison of the two, loaded from
+    // their locals, has decided the branch. So in a loop like
+    //
+    //     i = 0; while (i < slice.length) { ... slice[i] ...; ++i; }
+    //
+    // the access needs no check at all, and with `i < n` a check_bounds of n against the
+    // length before the loop replaces the check of every iteration.
+    //
+    // Locals whose address is taken with push_address could be changed through the pointer,
+    // so in programs that take addresses nothing is assumed to hold after an instruction
+    // that writes through a pointer, or that calls or yields to code that might.
+    auto eliminate_bounds_checks(Executable_program&) -> bu::Usize;
+
+}
\ No newline at end of file
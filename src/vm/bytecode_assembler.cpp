@@ -0,0 +1,288 @@
+#include "bu/utilities.hpp"
+#include "bytecode_assembler.hpp"
+
+
+namespace {
+
+    using Opcode = vm::Opcode;
+
+
+    static_assert(
+        std::to_underlying(Opcode::local_jump_fgte_i) - std::to_underlying(Opcode::local_jump_ieq_i)
+            == std::to_underlying(Opcode::fgte_i) - std::to_underlying(Opcode::ieq_i),
+        "Every local_jump_*_i opcode must correspond to the *_i opcode at the same position"
+    );
+
+    auto is_immediate_jump(Opcode const opcode) noexcept -> bool {
+        return opcode >= Opcode::local_jump_ieq_i && opcode <= Opcode::local_jump_fgte_i;
+    }
+
+    // The comparison that a local_jump_*_i instruction performs before jumping
+    auto comparison_of(Opcode const immediate_jump) noexcept -> Opcode {
+        return static_cast<Opcode>(
+            std::to_underlying(immediate_jump) - std::to_underlying(Opcode::local_jump_ieq_i) + std::to_underlying(Opcode::ieq_i));
+    }
+
+
+    // The encodings of each kind of jump, from the smallest to the largest.
+    // The last one is absolute, so it reaches every target.
+    constexpr std::array jump_forms       { Opcode::local_jump_8      , Opcode::local_jump      , Opcode::local_jump_32      , Opcode::jump       };
+    constexpr std::array jump_true_forms  { Opcode::local_jump_true_8 , Opcode::local_jump_true , Opcode::local_jump_true_32 , Opcode::jump_true  };
+    constexpr std::array jump_false_forms { Opcode::local_jump_false_8, Opcode::local_jump_false, Opcode::local_jump_false_32, Opcode::jump_false };
+
+}
+
+
+auto vm::Bytecode_assembler::new_label() -> Label {
+    labels.emplace_back();
+    return { labels.size() - 1 };
+}
+
+auto vm::Bytecode_assembler::bind(Label const label) -> void {
+    bu::always_assert(!labels.at(label.index).has_value());
+    labels[label.index] = Label_position {
+        .position               = code.current_offset(),
+        .preceding_branch_count = branches.size(),
+    };
+}
+
+
+auto vm::Bytecode_assembler::add_branch(
+    Branch_kind                const kind,
+    Opcode                     const opcode,
+    Label                      const target,
+    std::span<std::byte const> const operand) -> void
+{
+    bu::always_assert(target.index < labels.size());
+    bu::always_assert(operand.size() <= sizeof(bu::Isize));
+
+    Branch branch {
+        .kind         = kind,
+        .opcode       = opcode,
+        .target       = target,
+        .position     = code.current_offset(),
+        .operand      = {},
+        .operand_size = operand.size(),
+    };
+    std::ranges::copy(operand, branch.operand.begin());
+    branches.push_back(branch);
+}
+
+auto vm::Bytecode_assembler::jump(Label const target) -> void {
+    add_branch(Branch_kind::jump, Opcode::jump, target, {});
+}
+
+auto vm::Bytecode_assembler::jump_true(Label const target) -> void {
+    add_branch(Branch_kind::jump_true, Opcode::jump_true, target, {});
+}
+
+auto vm::Bytecode_assembler::jump_false(Label const target) -> void {
+    add_branch(Branch_kind::jump_false, Opcode::jump_false, target, {});
+}
+
+auto vm::Bytecode_assembler::call(Local_size_type const return_value_size, Label const target) -> void {
+    add_branch(Branch_kind::call, Opcode::call, target, std::as_bytes(std::span { &return_value_size, 1 }));
+}
+
+auto vm::Bytecode_assembler::call_0(Label const target) -> void {
+    add_branch(Branch_kind::call_0, Opcode::call_0, target, {});
+}
+
+auto vm::Bytecode_assembler::tail_call(
+    Local_size_type const return_value_size,
+    Local_size_type const argument_size,
+    Label           const target) -> void
+{
+    auto const sizes = std::to_array({ return_value_size, argument_size });
+    add_branch(Branch_kind::tail_call, Opcode::tail_call, target, std::as_bytes(std::span { sizes }));
+}
+
+
+auto vm::Bytecode_assembler::encode(
+    Branch    const& branch,
+    bu::Usize const  form,
+    bu::Usize const  offset,
+    bu::Usize const  target,
+    Bytecode&        out) -> bool
+{
+    auto const write_operand = [&] {
+        auto const operand = branch.operand_bytes();
+        out.bytes.insert(out.bytes.end(), operand.begin(), operand.end());
+    };
+
+    // Writes a relative jump followed by the operand of the branch, if any.
+    // The jump offset is relative to the end of the instruction.
+    auto const local_jump = [&]<class Offset>(Opcode const opcode, bu::Type<Offset>, bool const with_operand) -> bool {
+        auto const next     = offset + out.current_offset() + 1 + sizeof(Offset) + (with_operand ? branch.operand_size : 0);
+        auto const distance = static_cast<bu::Isize>(target) - static_cast<bu::Isize>(next);
+
+        if (distance < std::numeric_limits<Offset>::min() || distance > std::numeric_limits<Offset>::max()) {
+            return false;
+        }
+        out.write(opcode, static_cast<Offset>(distance));
+        if (with_operand) {
+            write_operand();
+        }
+        return true;
+    };
+
+    auto const jump = [&](std::span<Opcode const, 4> const forms) -> bool {
+        switch (form) {
+        case 0: return local_jump(forms[0], bu::type<Local_offset_8_type>, false);
+        case 1: return local_jump(forms[1], bu::type<Local_offset_type>, false);
+        case 2: return local_jump(forms[2], bu::type<Local_offset_32_type>, false);
+        case 3: out.write(forms[3], static_cast<Jump_offset_type>(target)); return true;
+        default: std::unreachable();
+        }
+    };
+
+    auto const call = [&](Opcode const near_opcode, Opcode const far_opcode) -> bool {
+        if (form == 0) {
+            if (target > std::numeric_limits<Jump_offset_32_type>::max()) {
+                return false;
+            }
+            out.write(near_opcode);
+            write_operand();
+            out.write(static_cast<Jump_offset_32_type>(target));
+        }
+        else {
+            out.write(far_opcode);
+            write_operand();
+            out.write(static_cast<Jump_offset_type>(target));
+        }
+        return true;
+    };
+
+    switch (branch.kind) {
+    case Branch_kind::jump:       return jump(jump_forms);
+    case Branch_kind::jump_true:  return jump(jump_true_forms);
+    case Branch_kind::jump_false: return jump(jump_false_forms);
+
+    case Branch_kind::jump_immediate:
+        if (form == 0) {
+            return local_jump(branch.opcode, bu::type<Local_offset_type>, true);
+        }
+        // The comparison pushes a bool, which the conditional jump then pops
+        out.write(comparison_of(branch.opcode));
+        write_operand();
+        if (form == 1) {
+            return local_jump(Opcode::local_jump_true_32, bu::type<Local_offset_32_type>, false);
+        }
+        out.write(Opcode::jump_true, static_cast<Jump_offset_type>(target));
+        return true;
+
+    case Branch_kind::call:   return call(Opcode::call_32, Opcode::call);
+    case Branch_kind::call_0: return call(Opcode::call_0_32, Opcode::call_0);
+
+    case Branch_kind::tail_call: // There is only the absolute form
+        out.write(Opcode::tail_call);
+        write_operand();
+        out.write(static_cast<Jump_offset_type>(target));
+        return true;
+
+    default:
+        std::unreachable();
+    }
+}
+
+
+auto vm::Bytecode_assembler::begin_function(std::string_view const name) -> void {
+    source_marks.push_back(Source_mark {
+        .where = { .position = code.current_offset(), .preceding_branch_count = branches.size() },
+        .what  = std::string { name },
+    });
+}
+
+auto vm::Bytecode_assembler::set_source_position(bu::Source_position const position) -> void {
+    source_marks.push_back(Source_mark {
+        .where = { .position = code.current_offset(), .preceding_branch_count = branches.size() },
+        .what  = position,
+    });
+}
+
+
+auto vm::Bytecode_assembler::assemble() const -> Bytecode {
+    return assemble_with_debug_table(nullptr);
+}
+
+auto vm::Bytecode_assembler::assemble(Debug_table& debug_table) const -> Bytecode {
+    return assemble_with_debug_table(&debug_table);
+}
+
+
+auto vm::Bytecode_assembler::assemble_with_debug_table(Debug_table* const debug_table) const -> Bytecode {
+    for (Branch const& branch : branches) {
+        if (!labels[branch.target.index]) {
+            bu::abort(std::format("label {} is used but never bound", branch.target.index));
+        }
+        if (branch.kind == Branch_kind::jump_immediate) {
+            bu::always_assert(is_immediate_jump(branch.opcode));
+            bu::always_assert(1 + sizeof(Local_offset_type) + branch.operand_size == 1 + argument_bytes(branch.opcode));
+        }
+    }
+
+    // Sizes start at zero and every branch starts in its smallest form, so each pass
+    // underestimates distances until the sizes stop changing. Every form that is
+    // chosen along the way is therefore no larger than the final one needs to be.
+    std::vector<bu::Usize> forms(branches.size());
+    std::vector<bu::Usize> sizes(branches.size());
+    std::vector<bu::Usize> growth(branches.size() + 1); // growth[i] is the total size of the first i branches
+    std::vector<Bytecode>  encoded(branches.size());
+
+    auto const final_offset = [&](bu::Usize const position, bu::Usize const preceding_branch_count) {
+        return position + growth[preceding_branch_count];
+    };
+
+    for (bool changed = true; changed; ) {
+        changed = false;
+
+        for (bu::Usize i = 0; i != branches.size(); ++i) {
+            growth[i + 1] = growth[i] + sizes[i];
+        }
+
+        for (bu::Usize i = 0; i != branches.size(); ++i) {
+            Branch const& branch = branches[i];
+
+            auto const [label_position, label_branch_count] = *labels[branch.target.index];
+            auto const offset = final_offset(branch.position, i);
+            auto const target = final_offset(label_position, label_branch_count);
+
+            encoded[i].bytes.clear();
+            while (!encode(branch, forms[i], offset, target, encoded[i])) {
+                encoded[i].bytes.clear();
+                ++forms[i];
+            }
+
+            if (encoded[i].current_offset() != sizes[i]) {
+                sizes[i] = encoded[i].current_offset();
+                changed  = true;
+            }
+        }
+    }
+
+    Bytecode result;
+    result.bytes.reserve(code.current_offset() + growth.back());
+
+    bu::Usize position = 0;
+    for (bu::Usize i = 0; i != branches.size(); ++i) {
+        result.bytes.insert(result.bytes.end(), code.bytes.begin() + position, code.bytes.begin() + branches[i].position);
+        result.bytes.insert(result.bytes.end(), encoded[i].bytes.begin(), encoded[i].bytes.end());
+        position = branches[i].position;
+    }
+    result.bytes.insert(result.bytes.end(), code.bytes.begin() + position, code.bytes.end());
+
+    if (debug_table) {
+        Debug_table_builder builder;
+        for (auto const& [where, what] : source_marks) {
+            if (auto const* const function = std::get_if<std::string>(&what)) {
+                builder.add_function(*function);
+            }
+            else {
+                builder.add_row(final_offset(where.position, where.preceding_branch_count), std::get<bu::Source_position>(what));
+            }
+        }
+        *debug_table = builder.build();
+    }
+
+    return result;
+}
\ No newline at end of file
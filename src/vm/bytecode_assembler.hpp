@@ -0,0 +1,104 @@
+#pragma once
+
+#include "bu/utilities.hpp"
+#include "virtual_machine.hpp"
+#include "opcode.hpp"
+#include "debug_table.hpp"
+
+
+namespace vm {
+
+    // Builds bytecode whose jumps and calls refer to labels instead of offsets.
+    // Every branch starts out in its smallest encoding, and assemble() widens
+    // the branches whose targets are out of range until every one fits. Since
+    // widening a branch can only push other targets further away, no branch is
+    // ever narrowed again, so the iteration always terminates.
+    class [[nodiscard]] Bytecode_assembler {
+    public:
+        struct Label {
+            bu::Usize index;
+        };
+    private:
+        enum class Branch_kind { jump, jump_true, jump_false, jump_immediate, call, call_0, tail_call };
+
+        struct Branch {
+            Branch_kind                              kind;
+            Opcode                                   opcode;       // The local_jump_*_i opcode of a jump_immediate
+            Label                                    target;
+            bu::Usize                                position;     // The offset in code at which the branch is inserted
+            std::array<std::byte, sizeof(bu::Isize)> operand;      // The immediate of a jump_immediate, or the sizes given to a call
+            bu::Usize                                operand_size;
+
+            auto operand_bytes() const noexcept -> std::span<std::byte const> {
+                return { operand.data(), operand_size };
+            }
+        };
+
+        // Writes the branch in the given form if its target is within the range of that form
+        static auto encode(Branch const&, bu::Usize form, bu::Usize offset, bu::Usize target, Bytecode& out) -> bool;
+
+        struct Label_position {
+            bu::Usize position;
+            bu::Usize preceding_branch_count;
+        };
+
+        // A source position or the start of a function, which moves along with the
+        // instructions that follow it when the branches before it are widened
+        struct Source_mark {
+            Label_position                                 where;
+            std::variant<std::string, bu::Source_position> what; // A function name or a position
+        };
+
+        Bytecode                                   code;
+        std::vector<Branch>                        branches;
+        std::vector<std::optional<Label_position>> labels;
+        std::vector<Source_mark>                   source_marks;
+
+        auto add_branch(Branch_kind, Opcode, Label, std::span<std::byte const> operand) -> void;
+
+        auto assemble_with_debug_table(Debug_table*) const -> Bytecode;
+    public:
+        auto new_label() -> Label;
+
+        // Makes the label refer to the instruction that is written next
+        auto bind(Label) -> void;
+
+        // Writes an instruction that has no jump target
+        auto write(bu::trivial auto const... args) -> void {
+            code.write(args...);
+        }
+
+        auto jump      (Label) -> void;
+        auto jump_true (Label) -> void;
+        auto jump_false(Label) -> void;
+
+        // One of the local_jump_*_i instructions. If the target is out of the range of
+        // its 16-bit offset, the comparison and the jump are written as two instructions.
+        auto jump_immediate(Opcode const opcode, Label const target, bu::trivial auto const immediate) -> void {
+            add_branch(Branch_kind::jump_immediate, opcode, target, std::as_bytes(std::span { &immediate, 1 }));
+        }
+
+        auto call(Local_size_type return_value_size, Label) -> void;
+        auto call_0(Label) -> void;
+
+        // For calls in tail position. The callee must take arguments and return
+        // a value of the same sizes as the function that contains the tail call.
+        auto tail_call(Local_size_type return_value_size, Local_size_type argument_size, Label) -> void;
+
+        // The positions given to set_source_position from now on are in the named function
+        auto begin_function(std::string_view name) -> void;
+
+        // Attributes the instructions that are written next to the position in the source.
+        // Must be preceded by begin_function.
+        auto set_source_position(bu::Source_position) -> void;
+
+        // Chooses the encoding of every branch, and writes the final bytecode.
+        // Every label that is jumped to or called must have been bound.
+        auto assemble() const -> Bytecode;
+
+        // Like assemble, and also writes the table that maps the final offsets of
+        // the instructions back to the positions given to set_source_position
+        auto assemble(Debug_table&) const -> Bytecode;
+    };
+
+}
\ No newline at end of file
@@ -0,0 +1,98 @@
+#include "bu/utilities.hpp"
+#include "collected_heap.hpp"
+
+
+namespace {
+
+    using Header = vm::Collected_heap::Object_header;
+
+    auto load_pointer(std::byte const* const slot) noexcept -> std::byte* {
+        std::byte* pointer;
+        std::memcpy(&pointer, slot, sizeof pointer);
+        return pointer;
+    }
+
+    auto store_pointer(std::byte* const slot, std::byte* const pointer) noexcept -> void {
+        std::memcpy(slot, &pointer, sizeof pointer);
+    }
+
+}
+
+
+auto vm::Collected_heap::evacuate(std::span<std::byte* const> const roots, bu::Usize const new_capacity) -> void {
+    std::byte* const from_begin = space.get();
+    std::byte* const from_end   = pointer;
+
+    auto destination = spare && new_capacity == capacity
+        ? std::move(spare)
+        : std::make_unique_for_overwrite<std::byte[]>(new_capacity);
+
+    std::byte* free = destination.get();
+
+    // Copies the object unless it has been copied already, and returns its new address.
+    // A payload always follows a header, so a pointer to the start of the space is not
+    // a pointer to an object, but a pointer to the end is, if the last payload is empty.
+    auto const forward = [&](std::byte* const payload) -> std::byte* {
+        if (payload <= from_begin || payload > from_end) {
+            return payload;
+        }
+        auto const header = reinterpret_cast<Header*>(payload - sizeof(Header));
+        if (header->pointer_count == forwarded) {
+            return reinterpret_cast<std::byte*>(header->size);
+        }
+
+        auto const size = sizeof(Header) + header->size;
+        std::memcpy(free, header, size);
+        std::byte* const moved = free + sizeof(Header);
+        free += size;
+
+        header->size          = reinterpret_cast<bu::Usize>(moved);
+        header->pointer_count = forwarded;
+        return moved;
+    };
+
+    for (std::byte* const slot : roots) {
+        store_pointer(slot, forward(load_pointer(slot)));
+    }
+
+    // Everything between scan and free has been copied, but its fields still point to the old space
+    for (std::byte* scan = destination.get(); scan != free; ) {
+        auto const header  = reinterpret_cast<Header*>(scan);
+        auto const payload = scan + sizeof(Header);
+
+        for (bu::Usize i = 0; i != header->pointer_count; ++i) {
+            std::byte* const field = payload + i * sizeof(std::byte*);
+            store_pointer(field, forward(load_pointer(field)));
+        }
+        scan = payload + header->size;
+    }
+
+    spare    = new_capacity == capacity ? std::move(space) : nullptr;
+    space    = std::move(destination);
+    capacity = new_capacity;
+    pointer  = free;
+    limit    = space.get() + capacity;
+    live     = static_cast<bu::Usize>(free - space.get());
+}
+
+
+auto vm::Collected_heap::collect(
+    std::span<std::byte* const> const roots,
+    bu::Usize                   const payload_size,
+    Collection_profile&               profile) -> void
+{
+    auto const start     = std::chrono::steady_clock::now();
+    auto const allocated = used_bytes() - live;
+    auto const requested = allocation_size(payload_size);
+
+    // Everything that has been allocated fits in a space of the current capacity
+    evacuate(roots, std::max(capacity, initial_capacity));
+
+    // Keep at least half of the space free, so that collections do not become more frequent as the heap fills
+    if ((live + requested) * 2 > capacity) {
+        evacuate(roots, std::max(capacity * 2, std::bit_ceil((live + requested) * 2)));
+    }
+
+    auto const pause = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+    profile.record(allocated, live, static_cast<bu::U64>(pause.count()));
+}
\ No newline at end of file
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "bu/utilities.hpp"
+#include "profiler.hpp"
+
+
+namespace vm {
+
+    // The garbage collected heap of one fiber. Objects are allocated by bumping a
+    // pointer, and when the space runs out, the objects that are reachable from the
+    // roots are copied to a new space, breadth first, which compacts them and frees
+    // the rest at once. Only pointers that the collector knows about are updated, so
+    // a collected object may only be referred to from the slots named by the stack
+    // maps of the program and from the pointer fields of other collected objects.
+    //
+    // A pointer to an object points to its payload, which is preceded by a header.
+    // The first pointer_count words of the payload are pointer fields, each of which
+    // holds a pointer to an object or null, and the rest is left alone.
+    class [[nodiscard]] Collected_heap {
+    public:
+        struct Object_header {
+            bu::Usize size;          // The size of the payload, or the new address of a forwarded object
+            bu::Usize pointer_count; // The number of pointer fields, or forwarded
+        };
+
+        static constexpr bu::Usize forwarded = std::numeric_limits<bu::Usize>::max();
+
+        // Every payload is aligned to this, so any value can be stored in it
+        static constexpr bu::Usize alignment = alignof(std::max_align_t);
+
+        // The size of the first space, which grows when more than half of it survives a collection
+        static constexpr bu::Usize initial_capacity = 1 << 16;
+    private:
+        static_assert(sizeof(Object_header) % alignment == 0);
+
+        std::unique_ptr<std::byte[]> space;
+        std::unique_ptr<std::byte[]> spare;        // The previous space, kept to be copied into by the next collection
+        bu::Usize                    capacity = 0; // The size of both space and spare
+        std::byte*                   pointer  = nullptr;
+        std::byte*                   limit    = nullptr;
+        bu::Usize                    live     = 0; // The bytes in use after the last collection
+
+        // Copies the reachable objects to a space of the given capacity
+        auto evacuate(std::span<std::byte* const> roots, bu::Usize new_capacity) -> void;
+    public:
+        static auto allocation_size(bu::Usize const payload_size) noexcept -> bu::Usize {
+            return sizeof(Object_header) + ((payload_size + alignment - 1) & ~(alignment - 1));
+        }
+
+        // Returns null if the space is full, in which case collect has to be called first
+        ALWAYS_INLINE auto allocate(bu::Usize const payload_size, bu::Usize const pointer_count) noexcept -> std::byte* {
+            auto const size = allocation_size(payload_size);
+            if (static_cast<bu::Usize>(limit - pointer) < size) [[unlikely]] {
+                return nullptr;
+            }
+            auto const header = std::exchange(pointer, pointer + size);
+            ::new (header) Object_header { .size = size - sizeof(Object_header), .pointer_count = pointer_count };
+            std::memset(header + sizeof(Object_header), 0, pointer_count * sizeof(std::byte*));
+            return header + sizeof(Object_header);
+        }
+
+        // Frees every object that can not be reached from the roots, and makes room for an
+        // object of the given payload size. Each root is the address of a slot, which
+        // need not be aligned, that holds a pointer to an object or anything else that is
+        // not a pointer into this heap. A slot may be given more than once.
+        auto collect(std::span<std::byte* const> roots, bu::Usize payload_size, Collection_profile&) -> void;
+
+        // The bytes taken by the objects allocated so far, including the unreachable ones
+        auto used_bytes() const noexcept -> bu::Usize {
+            return space ? static_cast<bu::Usize>(pointer - space.get()) : 0;
+        }
+
+        auto capacity_bytes() const noexcept -> bu::Usize {
+            return capacity;
+        }
+    };
+
+}
\ No newline at end of file
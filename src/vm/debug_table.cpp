@@ -0,0 +1,296 @@
+#include "bu/utilities.hpp"
+#include "debug_table.hpp"
+
+
+namespace {
+
+    using Checkpoint = vm::Debug_table::Checkpoint;
+
+    static_assert(std::is_trivially_copyable_v<Checkpoint>);
+
+
+    // LEB128: seven bits per byte, starting from the lowest, with the high bit set on every byte but the last
+    auto write_varint(std::vector<std::byte>& out, bu::Usize value) -> void {
+        for (; value >= 0x80; value >>= 7) {
+            out.push_back(static_cast<std::byte>((value & 0x7F) | 0x80));
+        }
+        out.push_back(static_cast<std::byte>(value));
+    }
+
+    auto read_varint(std::byte const*& pointer) noexcept -> bu::Usize {
+        bu::Usize value = 0;
+        for (bu::Usize shift = 0; ; shift += 7) {
+            auto const byte = static_cast<bu::Usize>(*pointer++);
+            value |= (byte & 0x7F) << shift;
+            if (byte < 0x80) {
+                return value;
+            }
+        }
+    }
+
+    // Lines usually move by a little in either direction, so the sign goes in the lowest bit
+    auto zigzag(bu::Isize const delta) noexcept -> bu::Usize {
+        return static_cast<bu::Usize>(delta) << 1 ^ static_cast<bu::Usize>(delta >> 63);
+    }
+
+    auto unzigzag(bu::Usize const encoded) noexcept -> bu::Isize {
+        return static_cast<bu::Isize>(encoded >> 1) ^ -static_cast<bu::Isize>(encoded & 1);
+    }
+
+
+    template <bu::trivial T>
+    auto read_at(std::span<std::byte const> const bytes, bu::Usize const position) -> T {
+        assert(position + sizeof(T) <= bytes.size());
+        T value;
+        std::memcpy(&value, bytes.data() + position, sizeof value);
+        return value;
+    }
+
+    // The positions of the parts of a table, which follow from its header
+    struct Layout {
+        bu::Usize checkpoint_count;
+        bu::Usize function_count;
+        bu::Usize checkpoints;
+        bu::Usize name_ends;
+        bu::Usize names;
+        bu::Usize rows;
+
+        explicit Layout(std::span<std::byte const> const bytes)
+            : checkpoint_count { read_at<bu::Usize>(bytes, 0) }
+            , function_count   { read_at<bu::Usize>(bytes, sizeof(bu::Usize)) }
+            , checkpoints      { 2 * sizeof(bu::Usize) }
+            , name_ends        { checkpoints + checkpoint_count * sizeof(Checkpoint) }
+            , names            { name_ends + function_count * sizeof(bu::Usize) }
+            , rows             { names + (function_count != 0 ? read_at<bu::Usize>(bytes, names - sizeof(bu::Usize)) : 0) } {}
+    };
+
+    // Decodes the row that follows the given one, and advances the pointer past it
+    auto read_row(std::byte const*& pointer, Checkpoint const& previous) noexcept -> Checkpoint {
+        auto const offset_delta = read_varint(pointer);
+
+        Checkpoint row = previous;
+        row.offset += offset_delta >> 1;
+        if (offset_delta & 1) {
+            row.function = read_varint(pointer);
+        }
+        row.line   = static_cast<bu::Usize>(static_cast<bu::Isize>(previous.line) + unzigzag(read_varint(pointer)));
+        row.column = read_varint(pointer);
+        return row;
+    }
+
+    auto function_name(std::span<std::byte const> const bytes, Layout const& layout, bu::Usize const function) -> std::string_view {
+        auto const name_end   = read_at<bu::Usize>(bytes, layout.name_ends + function * sizeof(bu::Usize));
+        auto const name_start = function != 0 ? read_at<bu::Usize>(bytes, layout.name_ends + (function - 1) * sizeof(bu::Usize)) : 0;
+        return { reinterpret_cast<char const*>(bytes.data() + layout.names + name_start), name_end - name_start };
+    }
+
+}
+
+
+auto vm::Debug_table::validate(std::span<std::byte const> const serialized) -> void {
+    if (serialized.empty()) {
+        return;
+    }
+
+    auto const invalid = [] {
+        return bu::exception("The debug table is not valid");
+    };
+
+    if (serialized.size() < 2 * sizeof(bu::Usize)) {
+        throw invalid();
+    }
+    auto const checkpoint_count = read_at<bu::Usize>(serialized, 0);
+    auto const function_count   = read_at<bu::Usize>(serialized, sizeof(bu::Usize));
+    if (checkpoint_count > serialized.size() / sizeof(Checkpoint) || function_count > serialized.size() / sizeof(bu::Usize)) {
+        throw invalid();
+    }
+
+    auto const names = 2 * sizeof(bu::Usize) + checkpoint_count * sizeof(Checkpoint) + function_count * sizeof(bu::Usize);
+    if (names > serialized.size() || Layout { serialized }.rows > serialized.size()) {
+        throw invalid();
+    }
+}
+
+
+auto vm::Debug_table::deserialize(std::span<std::byte const> const serialized) -> Debug_table {
+    validate(serialized);
+
+    Debug_table table;
+    if (!serialized.empty()) {
+        table.storage = std::make_shared<std::vector<std::byte> const>(serialized.begin(), serialized.end());
+        table.bytes   = *table.storage;
+    }
+    return table;
+}
+
+auto vm::Debug_table::view(std::span<std::byte const> const serialized) -> Debug_table {
+    validate(serialized);
+
+    Debug_table table;
+    table.bytes = serialized;
+    return table;
+}
+
+
+auto vm::Debug_table::find(bu::Usize const offset) const -> std::optional<Debug_location> {
+    if (bytes.empty()) {
+        return std::nullopt;
+    }
+
+    Layout const layout { bytes };
+
+    auto const checkpoint_at = [&](bu::Usize const index) {
+        return read_at<Checkpoint>(bytes, layout.checkpoints + index * sizeof(Checkpoint));
+    };
+
+    // The first checkpoint past the offset, so the run that covers the offset starts at the one before it
+    auto const indices = std::views::iota(bu::Usize { 0 }, layout.checkpoint_count);
+    auto const next    = *std::ranges::partition_point(indices, [&](bu::Usize const index) {
+        return checkpoint_at(index).offset <= offset;
+    });
+    if (next == 0) {
+        return std::nullopt;
+    }
+
+    Checkpoint row = checkpoint_at(next - 1);
+
+    std::byte const*       pointer = bytes.data() + layout.rows + row.row_position;
+    std::byte const* const stop    = next != layout.checkpoint_count
+        ? bytes.data() + layout.rows + checkpoint_at(next).row_position
+        : bytes.data() + bytes.size();
+
+    while (pointer != stop) {
+        Checkpoint const following = read_row(pointer, row);
+        if (following.offset > offset) {
+            break;
+        }
+        row = following;
+    }
+
+    return Debug_location {
+        .function = function_name(bytes, layout, row.function),
+        .position = { .line = row.line, .column = row.column },
+    };
+}
+
+
+auto vm::Debug_table::relocated(std::span<bu::Usize const> const relocated_offsets) const -> Debug_table {
+    if (bytes.empty()) {
+        return {};
+    }
+
+    Layout const layout { bytes };
+    Debug_table_builder builder;
+
+    for (bu::Usize function = 0; function != layout.function_count; ++function) {
+        builder.functions.emplace_back(function_name(bytes, layout, function));
+    }
+
+    auto const add_row = [&](Checkpoint const& row) {
+        builder.add_row(Debug_table_builder::Row {
+            .offset   = relocated_offsets[row.offset],
+            .function = row.function,
+            .position = { .line = row.line, .column = row.column },
+        });
+    };
+
+    // Every run starts with a checkpoint, and the rows of the runs are encoded back to back
+    std::byte const* pointer = bytes.data() + layout.rows;
+    for (bu::Usize index = 0; index != layout.checkpoint_count; ++index) {
+        Checkpoint row = read_at<Checkpoint>(bytes, layout.checkpoints + index * sizeof(Checkpoint));
+        add_row(row);
+
+        std::byte const* const stop = index + 1 != layout.checkpoint_count
+            ? bytes.data() + layout.rows + read_at<Checkpoint>(bytes, layout.checkpoints + (index + 1) * sizeof(Checkpoint)).row_position
+            : bytes.data() + bytes.size();
+
+        while (pointer != stop) {
+            row = read_row(pointer, row);
+            add_row(row);
+        }
+    }
+
+    return builder.build();
+}
+
+
+auto vm::Debug_table_builder::add_function(std::string_view const name) -> void {
+    functions.emplace_back(name);
+}
+
+auto vm::Debug_table_builder::add_row(bu::Usize const offset, bu::Source_position const position) -> void {
+    bu::always_assert(!functions.empty());
+    add_row(Row { offset, functions.size() - 1, position });
+}
+
+auto vm::Debug_table_builder::add_row(Row const row) -> void {
+    bu::always_assert(rows.empty() || rows.back().offset <= row.offset);
+
+    if (!rows.empty() && rows.back().offset == row.offset) {
+        rows.back() = row;
+    }
+    else if (rows.empty() || rows.back().function != row.function || rows.back().position != row.position) {
+        rows.push_back(row);
+    }
+}
+
+
+auto vm::Debug_table_builder::build() const -> Debug_table {
+    Debug_table table;
+    if (rows.empty()) {
+        return table;
+    }
+    std::vector<std::byte> bytes;
+
+    std::vector<Checkpoint> checkpoints;
+    std::vector<std::byte>  encoded;
+
+    for (bu::Usize i = 0; i != rows.size(); ++i) {
+        Row const& row = rows[i];
+
+        if (i % Debug_table::run_length == 0) {
+            checkpoints.push_back(Checkpoint {
+                .offset       = row.offset,
+                .function     = row.function,
+                .line         = row.position.line,
+                .column       = row.position.column,
+                .row_position = encoded.size(),
+            });
+            continue;
+        }
+
+        Row const& previous = rows[i - 1];
+        bool const is_new_function = row.function != previous.function;
+
+        write_varint(encoded, (row.offset - previous.offset) << 1 | bu::Usize { is_new_function });
+        if (is_new_function) {
+            write_varint(encoded, row.function);
+        }
+        write_varint(encoded, zigzag(static_cast<bu::Isize>(row.position.line - previous.position.line)));
+        write_varint(encoded, row.position.column);
+    }
+
+    auto const write = [&](bu::trivial auto const... args) {
+        bu::serialize_to(std::back_inserter(bytes), args...);
+    };
+
+    write(checkpoints.size(), functions.size());
+    for (Checkpoint const& checkpoint : checkpoints) {
+        write(checkpoint);
+    }
+
+    bu::Usize name_end = 0;
+    for (std::string const& function : functions) {
+        name_end += function.size();
+        write(name_end);
+    }
+    for (std::string const& function : functions) {
+        auto const name = std::as_bytes(std::span { function });
+        bytes.insert(bytes.end(), name.begin(), name.end());
+    }
+    bytes.insert(bytes.end(), encoded.begin(), encoded.end());
+
+    table.storage = std::make_shared<std::vector<std::byte> const>(std::move(bytes));
+    table.bytes   = *table.storage;
+    return table;
+}
\ No newline at end of file
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "bu/utilities.hpp"
+#include "bu/source.hpp"
+
+
+namespace vm {
+
+    // Where the instruction at a bytecode offset came from
+    struct Debug_location {
+        std::string_view    function;
+        bu::Source_position position;
+    };
+
+
+    // Maps bytecode offsets back to the functions and the source positions they were
+    // compiled from. A row holds the position of the instructions from its offset up
+    // to the offset of the next row. The table is a single buffer that is serialized
+    // as is, so loading it decodes nothing, and a lookup decodes only the rows near
+    // the offset. Each run of rows starts with a checkpoint of fixed size that holds
+    // the row in full. The checkpoints are binary searched, and the rest of the run is
+    // delta encoded as variable length integers, so a row usually takes a few bytes.
+    // A table either shares ownership of its buffer, or views one owned by someone
+    // else, such as the mapping of a Mapped_program. Copies share the buffer.
+    class [[nodiscard]] Debug_table {
+    public:
+        struct Checkpoint {
+            bu::Usize offset;
+            bu::Usize function;
+            bu::Usize line;
+            bu::Usize column;
+            bu::Usize row_position; // Where the encoding of the rest of the run starts
+        };
+
+        static constexpr bu::Usize run_length = 16; // The rows that share a checkpoint
+    private:
+        // The checkpoint count, the function count, the checkpoints, the end of each
+        // function name within the names, the names, and then the encoded rows
+        std::span<std::byte const>                    bytes;
+        std::shared_ptr<std::vector<std::byte> const> storage; // Owns bytes, unless they are viewed
+
+        // Throws bu::Exception unless the bytes hold the parts of a table
+        static auto validate(std::span<std::byte const>) -> void;
+
+        friend class Debug_table_builder;
+    public:
+        // The table that maps every offset to nothing
+        Debug_table() = default;
+
+        auto serialized() const noexcept -> std::span<std::byte const> {
+            return bytes;
+        }
+
+        // A table that owns a copy of the serialized bytes
+        static auto deserialize(std::span<std::byte const>) -> Debug_table;
+
+        // A table that views the serialized bytes in place, which must outlive it
+        static auto view(std::span<std::byte const>) -> Debug_table;
+
+        auto is_empty() const noexcept -> bool {
+            return bytes.empty();
+        }
+
+        // The location of the instruction at the offset, or nothing if no row covers it
+        auto find(bu::Usize offset) const -> std::optional<Debug_location>;
+
+        // A table that owns a copy of this one, with the offset of each row replaced by
+        // the element of relocated_offsets at that offset. The relocated offsets must not
+        // decrease, and rows that are relocated to the same offset keep the last location.
+        auto relocated(std::span<bu::Usize const> relocated_offsets) const -> Debug_table;
+    };
+
+
+    // Collects the rows of a Debug_table in the order of their offsets
+    class [[nodiscard]] Debug_table_builder {
+        struct Row {
+            bu::Usize           offset;
+            bu::Usize           function;
+            bu::Source_position position;
+        };
+
+        std::vector<std::string> functions;
+        std::vector<Row>         rows;
+
+        auto add_row(Row) -> void;
+
+        friend class Debug_table;
+    public:
+        // The rows added after this one belong to the function
+        auto add_function(std::string_view name) -> void;
+
+        // The instructions from the offset up to the offset of the next row were compiled
+        // from the position. The offset must not be less than that of the previous row,
+        // which is replaced if the offsets are equal.
+        auto add_row(bu::Usize offset, bu::Source_position) -> void;
+
+        auto build() const -> Debug_table;
+    };
+
+}
\ No newline at end of file
@@ -0,0 +1,105 @@
+#include "bu/utilities.hpp"
+#include "execution_trace.hpp"
+#include "vm_formatting.hpp"
+
+#include <bit>
+#include <mutex>
+
+
+namespace {
+
+    static_assert(sizeof(vm::Opcode) == 1, "The opcode must fit in the low 8 bits of a slot");
+
+    thread_local vm::Trace_dump_on_terminate* current_dump = nullptr;
+
+    std::terminate_handler previous_terminate_handler = nullptr;
+
+    auto dump_and_terminate() -> void {
+        if (current_dump) {
+            vm::dump_trace(current_dump->trace, current_dump->code, current_dump->debug_table);
+        }
+        if (previous_terminate_handler) {
+            previous_terminate_handler();
+        }
+        std::abort();
+    }
+
+    auto install_terminate_handler() -> void {
+        static std::once_flag flag;
+        std::call_once(flag, [] {
+            previous_terminate_handler = std::set_terminate(dump_and_terminate);
+        });
+    }
+
+}
+
+
+auto vm::Execution_trace::reset(bu::Usize const capacity) -> void {
+    auto const rounded = std::bit_ceil(std::max<bu::Usize>(capacity, 1));
+    slots    = std::make_unique<Slot[]>(rounded);
+    mask     = rounded - 1;
+    started  = 0;
+    finished = 0;
+}
+
+
+auto vm::Execution_trace::snapshot() const -> std::vector<Entry> {
+    if (!slots) {
+        return {};
+    }
+
+    auto const count = finished.load(std::memory_order_acquire);
+    auto const first = count > capacity() ? count - capacity() : 0;
+
+    std::vector<Entry> entries;
+    entries.reserve(count - first);
+
+    for (bu::Usize index = first; index != count; ++index) {
+        Slot const& slot = slots[index & mask];
+        auto const offset_and_opcode = slot.offset_and_opcode.load(std::memory_order_relaxed);
+
+        entries.push_back(Entry {
+            .opcode      = static_cast<Opcode>(offset_and_opcode & 0xFF),
+            .offset      = offset_and_opcode >> 8,
+            .stack_depth = slot.stack_depth.load(std::memory_order_relaxed),
+        });
+    }
+
+    // Entry i shares its slot with entry i + capacity, whose recording may have begun during the copy
+    std::atomic_thread_fence(std::memory_order_acquire);
+    auto const overwritten = started.load(std::memory_order_relaxed);
+    if (overwritten > first + capacity()) {
+        auto const lost = std::min(overwritten - capacity() - first, entries.size());
+        entries.erase(entries.begin(), entries.begin() + static_cast<bu::Isize>(lost));
+    }
+
+    return entries;
+}
+
+
+auto vm::dump_trace(
+    Execution_trace            const& trace,
+    std::span<std::byte const> const  code,
+    Debug_table                const* debug_table) -> void
+{
+    bu::print<std::cerr>("The last instructions executed:\n{}", Trace_listing { trace.snapshot(), code, debug_table });
+    std::cerr.flush();
+}
+
+
+vm::Trace_dump_on_terminate::Trace_dump_on_terminate(
+    Execution_trace            const& trace,
+    std::span<std::byte const> const  code,
+    Debug_table                const* debug_table)
+    : previous    { current_dump }
+    , trace       { trace }
+    , code        { code }
+    , debug_table { debug_table }
+{
+    install_terminate_handler();
+    current_dump = this;
+}
+
+vm::Trace_dump_on_terminate::~Trace_dump_on_terminate() {
+    current_dump = previous;
+}
\ No newline at end of file
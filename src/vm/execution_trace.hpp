@@ -0,0 +1,99 @@
+#pragma once
+
+#include "bu/utilities.hpp"
+#include "opcode.hpp"
+#include "debug_table.hpp"
+
+#include <atomic>
+
+
+namespace vm {
+
+    // The most recent instructions executed by Dispatch_engine::traced, in a ring buffer
+    // whose oldest entries are overwritten. Recording an instruction costs a handful of
+    // plain stores. Only the thread that runs the machine records, so snapshot() never
+    // waits for it, and may be called from any thread, such as a watchdog, while the
+    // machine runs.
+    class [[nodiscard]] Execution_trace {
+    public:
+        struct Entry {
+            Opcode    opcode;
+            bu::Usize offset;      // The bytecode offset of the instruction
+            bu::Usize stack_depth; // The bytes in use on the stack before the instruction executed
+        };
+
+        static constexpr bu::Usize default_capacity = 1024;
+    private:
+        // The fields are relaxed atomics, so a snapshot that races with the recording
+        // thread reads stale values instead of causing undefined behavior
+        struct Slot {
+            std::atomic<bu::Usize> offset_and_opcode; // The offset shifted left by 8 bits
+            std::atomic<bu::Usize> stack_depth;
+        };
+
+        std::unique_ptr<Slot[]> slots;
+        bu::Usize               mask = 0;
+        std::atomic<bu::Usize>  started  = 0; // The number of entries whose recording has begun
+        std::atomic<bu::Usize>  finished = 0; // The number of entries that have been recorded completely
+    public:
+        // Discards every entry, and makes room for the given number of entries rounded up to
+        // a power of two. Must not be called while the trace is recorded or copied.
+        auto reset(bu::Usize capacity = default_capacity) -> void;
+
+        auto capacity() const noexcept -> bu::Usize {
+            return slots ? mask + 1 : 0;
+        }
+
+        // The number of entries recorded since the last reset, including the overwritten ones
+        auto recorded_count() const noexcept -> bu::Usize {
+            return finished.load(std::memory_order_acquire);
+        }
+
+        ALWAYS_INLINE auto record(Opcode const opcode, bu::Usize const offset, bu::Usize const stack_depth) noexcept -> void {
+            auto const index = finished.load(std::memory_order_relaxed);
+            Slot&      slot  = slots[index & mask];
+
+            // A snapshot that reads the new contents of the slot also reads that they were started
+            started.store(index + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+
+            slot.offset_and_opcode.store(offset << 8 | static_cast<bu::Usize>(opcode), std::memory_order_relaxed);
+            slot.stack_depth.store(stack_depth, std::memory_order_relaxed);
+            finished.store(index + 1, std::memory_order_release);
+        }
+
+        // The entries in the buffer, from the oldest to the newest. Entries that are
+        // overwritten while they are being copied are left out.
+        auto snapshot() const -> std::vector<Entry>;
+    };
+
+
+    // The entries of a trace along with the bytecode they were recorded from,
+    // which vm_formatting.hpp formats as a disassembly of the instructions
+    struct Trace_listing {
+        std::vector<Execution_trace::Entry> entries;
+        std::span<std::byte const>          code;
+        Debug_table const*                  debug_table = nullptr; // If present, gives the source location of each instruction
+    };
+
+    // Writes the listing of the trace to standard error
+    auto dump_trace(Execution_trace const&, std::span<std::byte const> code, Debug_table const* = nullptr) -> void;
+
+
+    // While an instance exists, std::terminate on the same thread, such as the call made
+    // by bu::abort, dumps the trace before the process ends. Instances may be nested.
+    class [[nodiscard]] Trace_dump_on_terminate {
+        Trace_dump_on_terminate* previous;
+    public:
+        Execution_trace const&     trace;
+        std::span<std::byte const> code;
+        Debug_table const*         debug_table;
+
+        Trace_dump_on_terminate(Execution_trace const&, std::span<std::byte const> code, Debug_table const* = nullptr);
+        ~Trace_dump_on_terminate();
+
+        Trace_dump_on_terminate(Trace_dump_on_terminate const&) = delete;
+        auto operator=(Trace_dump_on_terminate const&) -> Trace_dump_on_terminate& = delete;
+    };
+
+}
\ No newline at end of file
@@ -0,0 +1,43 @@
+#include "bu/utilities.hpp"
+#include "heap.hpp"
+
+
+auto vm::Heap::allocate_in_next_chunk(bu::Usize const size) -> std::byte* {
+    // Until the first allocation, or after exiting a region that was entered before
+    // it, the pointer is null and there is no current chunk, so chunks[0] is next
+    auto const next = pointer ? current + 1 : 0;
+
+    // A chunk that was kept after a region exited is reused if it is large enough.
+    // Otherwise a new chunk is inserted before it, and it is reused later.
+    if (next == chunks.size() || chunks[next].size < size) {
+        auto const new_size = std::max(size, chunk_size);
+        chunks.insert(
+            chunks.begin() + static_cast<bu::Isize>(next),
+            Chunk { .memory = std::make_unique_for_overwrite<std::byte[]>(new_size), .size = new_size });
+    }
+
+    current = next;
+    pointer = chunks[current].memory.get() + size;
+    limit   = chunks[current].memory.get() + chunks[current].size;
+    return chunks[current].memory.get();
+}
+
+
+auto vm::Heap::exit_region() -> void {
+    bu::always_assert(!regions.empty());
+    auto const [chunk, position] = regions.back();
+    regions.pop_back();
+
+    current = chunk;
+    pointer = position;
+    limit   = pointer ? chunks[current].memory.get() + chunks[current].size : nullptr;
+}
+
+
+auto vm::Heap::reserved_bytes() const noexcept -> bu::Usize {
+    bu::Usize total = 0;
+    for (Chunk const& chunk : chunks) {
+        total += chunk.size;
+    }
+    return total;
+}
\ No newline at end of file
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "bu/utilities.hpp"
+
+
+namespace vm {
+
+    // The heap of one fiber. Memory is allocated by bumping a pointer through
+    // chunks, and is only released in bulk: region_enter saves the position of the
+    // pointer, and the matching region_exit returns to it, which frees everything
+    // allocated in between at once. Chunks are kept after a region exits, so a
+    // loop that enters and exits a region allocates from the system only once.
+    // Memory allocated outside of every region lives as long as the fiber.
+    class [[nodiscard]] Heap {
+        struct Chunk {
+            std::unique_ptr<std::byte[]> memory;
+            bu::Usize                    size;
+        };
+
+        struct Position {
+            bu::Usize  chunk;
+            std::byte* pointer;
+        };
+
+        std::vector<Chunk>    chunks;
+        std::vector<Position> regions;
+        bu::Usize             current = 0;       // The index of the chunk that is being bumped through
+        std::byte*            pointer = nullptr;
+        std::byte*            limit   = nullptr;
+
+        auto allocate_in_next_chunk(bu::Usize size) -> std::byte*;
+    public:
+        // Every allocation is aligned to this, so any value can be stored in it
+        static constexpr bu::Usize alignment = alignof(std::max_align_t);
+
+        // The smallest chunk that is allocated from the system
+        static constexpr bu::Usize chunk_size = 1 << 16;
+
+        Heap() = default;
+
+        Heap(Heap&&) noexcept = default;
+        auto operator=(Heap&&) noexcept -> Heap& = default;
+
+        ALWAYS_INLINE auto allocate(bu::Usize const size) -> std::byte* {
+            auto const rounded = (size + alignment - 1) & ~(alignment - 1);
+            if (static_cast<bu::Usize>(limit - pointer) < rounded) [[unlikely]] {
+                return allocate_in_next_chunk(rounded);
+            }
+            return std::exchange(pointer, pointer + rounded);
+        }
+
+        auto enter_region() -> void {
+            regions.push_back({ current, pointer });
+        }
+
+        // Frees everything allocated since the matching enter_region
+        auto exit_region() -> void;
+
+        // The number of regions that have been entered but not exited
+        auto region_depth() const noexcept -> bu::Usize {
+            return regions.size();
+        }
+
+        // The memory allocated from the system, whether or not it is in use
+        auto reserved_bytes() const noexcept -> bu::Usize;
+    };
+
+}
\ No newline at end of file
@@ -0,0 +1,90 @@
+#include "bu/utilities.hpp"
+#include "host.hpp"
+#include "verifier.hpp"
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+
+auto vm::Host::verify() -> void {
+    is_verified = false;
+    (void)bu::expect(vm::verify(image->code(), image->string_pool().size(), stack_capacity));
+    is_verified = true;
+}
+
+
+auto vm::Host::run(bu::Usize const instance_count) -> std::vector<int> {
+    if (dispatch_engine == Dispatch_engine::jit && !is_verified && !is_unverifiable) {
+        is_verified     = vm::verify(image->code(), image->string_pool().size(), stack_capacity).has_value();
+        is_unverifiable = !is_verified;
+    }
+
+    std::vector<int>         exit_codes(instance_count);
+    std::vector<std::string> outputs(instance_count);
+    std::vector<bool>        has_finished(instance_count); // Guarded by output_mutex, like outputs
+    bu::Usize                next_output = 0;              // The first instance whose output has not been passed on
+    std::mutex               output_mutex;
+    std::atomic<bu::Usize>   next_instance = 0;
+
+    failures.clear();
+
+    auto const work = [&] {
+        Virtual_machine machine {
+            .image              = image,
+            .stack_capacity     = stack_capacity,
+            .stack_kind         = stack_kind,
+            .dispatch_engine    = dispatch_engine,
+            .jit_call_threshold = jit_call_threshold,
+            .is_verified        = is_verified,
+            .is_unverifiable    = is_unverifiable,
+        };
+        machine.output.policy = Flush_policy::capture;
+
+        for (;;) {
+            auto const instance = next_instance.fetch_add(1, std::memory_order_relaxed);
+            if (instance >= instance_count) {
+                break;
+            }
+
+            std::optional<std::string> failure;
+            try {
+                exit_codes[instance] = machine.run();
+            }
+            catch (bu::Exception const& exception) { // vm::Trap or vm::Stack_fault
+                exit_codes[instance] = failure_exit_code;
+                failure              = exception.what();
+            }
+
+            std::scoped_lock const lock { output_mutex };
+            if (failure) {
+                failures.push_back(Failure { .instance = instance, .message = std::move(*failure) });
+            }
+            outputs[instance]      = machine.output.take();
+            has_finished[instance] = true;
+
+            for (; next_output != instance_count && has_finished[next_output]; ++next_output) {
+                output.print(outputs[next_output]);
+                std::string {}.swap(outputs[next_output]);
+            }
+        }
+    };
+
+    auto const worker_count = std::min(
+        thread_count != 0 ? thread_count : std::max<bu::Usize>(1, std::thread::hardware_concurrency()),
+        instance_count
+    );
+
+    {
+        std::vector<std::jthread> workers;
+        workers.reserve(worker_count);
+        for (bu::Usize i = 0; i != worker_count; ++i) {
+            workers.emplace_back(work);
+        }
+    }
+
+    std::ranges::sort(failures, {}, &Failure::instance);
+
+    output.flush();
+    return exit_codes;
+}
\ No newline at end of file
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "bu/utilities.hpp"
+#include "virtual_machine.hpp"
+
+
+namespace vm {
+
+    // Runs many independent executions of one program on a pool of worker threads.
+    // Every worker owns a machine with its own fibers, compiled code, and output
+    // buffer, and all of the machines share the image, so the workers synchronize
+    // only to take the next instance and to hand over its output.
+    struct [[nodiscard]] Host {
+        std::shared_ptr<Program_image const> image;
+        bu::Usize                            stack_capacity     = 0;
+        Stack_kind                           stack_kind         = Stack_kind::heap;
+        Dispatch_engine                      dispatch_engine    = Dispatch_engine::threaded;
+        bu::Usize                            jit_call_threshold = 1000;
+        bu::Usize                            thread_count       = 0; // Zero means one per hardware thread
+        bool                                 is_verified        = false;
+        bool                                 is_unverifiable    = false; // As in Virtual_machine
+
+
+        // An instance that trapped or faulted instead of halting
+        struct Failure {
+            bu::Usize   instance;
+            std::string message;
+        };
+
+        static constexpr int failure_exit_code = -1; // The exit code given to a failed instance
+
+
+        // Runs the program instance_count times, and returns the exit codes in the
+        // order of the instances. The output of every instance is collected on its
+        // own, and passed on to output once every earlier instance has been passed
+        // on, so the output of different instances is never interleaved. An instance
+        // that throws vm::Trap or vm::Stack_fault is recorded in failures, and the
+        // rest of the instances run as usual.
+        auto run(bu::Usize instance_count) -> std::vector<int>;
+
+        // Like Virtual_machine::verify, but once for every worker
+        auto verify() -> void;
+
+
+        Output_buffer        output;   // The merged output of every instance
+        std::vector<Failure> failures; // The failed instances of the last run, in order
+    };
+
+}
\ No newline at end of file
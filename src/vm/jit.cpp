@@ -0,0 +1,908 @@
+#include "bu/utilities.hpp"
+#include "jit.hpp"
+#include "opcode.hpp"
+
+
+#ifdef _WIN32
+
+// Copied the necessary declarations from Windows.h, for the same reason as in bu/color.cpp
+
+extern "C" {
+    typedef unsigned long DWORD;
+    typedef int           BOOL;
+    typedef DWORD*        PDWORD;
+    typedef unsigned long long SIZE_T;
+
+    void* __declspec(dllimport) VirtualAlloc(void*, SIZE_T, DWORD, DWORD);
+    BOOL  __declspec(dllimport) VirtualProtect(void*, SIZE_T, DWORD, PDWORD);
+    BOOL  __declspec(dllimport) VirtualFree(void*, SIZE_T, DWORD);
+}
+
+#define MEM_COMMIT         0x00001000
+#define MEM_RESERVE        0x00002000
+#define MEM_RELEASE        0x00008000
+#define PAGE_READWRITE     0x04
+#define PAGE_EXECUTE_READ  0x20
+
+#else
+
+#include <sys/mman.h>
+
+#endif
+
+
+class vm::Jit::Executable_memory {
+    std::byte* pointer;
+    bu::Usize  size;
+public:
+    // Copies the code to newly allocated memory, which is then made executable and read-only
+    explicit Executable_memory(std::span<std::byte const> const code)
+        : pointer { nullptr }
+        , size    { code.size() }
+    {
+#ifdef _WIN32
+        pointer = static_cast<std::byte*>(VirtualAlloc(nullptr, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+        if (!pointer) {
+            bu::abort("could not allocate memory for compiled code");
+        }
+        std::memcpy(pointer, code.data(), size);
+
+        DWORD old_protection;
+        if (!VirtualProtect(pointer, size, PAGE_EXECUTE_READ, &old_protection)) {
+            bu::abort("could not make compiled code executable");
+        }
+#else
+        void* const memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) {
+            bu::abort("could not allocate memory for compiled code");
+        }
+        pointer = static_cast<std::byte*>(memory);
+        std::memcpy(pointer, code.data(), size);
+
+        if (mprotect(pointer, size, PROT_READ | PROT_EXEC) != 0) {
+            bu::abort("could not make compiled code executable");
+        }
+#endif
+    }
+
+    Executable_memory(Executable_memory&& other) noexcept
+        : pointer { std::exchange(other.pointer, nullptr) }
+        , size    { other.size } {}
+
+    ~Executable_memory() {
+        if (pointer) {
+#ifdef _WIN32
+            VirtualFree(pointer, 0, MEM_RELEASE);
+#else
+            munmap(pointer, size);
+#endif
+        }
+    }
+
+    auto data() const noexcept -> std::byte* {
+        return pointer;
+    }
+};
+
+
+namespace {
+
+    using Opcode = vm::Opcode;
+
+
+    enum class Register : bu::U8 {
+        rax, rcx, rdx, rbx, rsp, rbp, rsi, rdi,
+        r8 , r9 , r10, r11, r12, r13, r14, r15,
+    };
+
+    enum class Condition : bu::U8 {
+        overflow      = 0x0,
+        no_overflow   = 0x1,
+        below         = 0x2, // Unsigned
+        above_equal   = 0x3, // Unsigned
+        equal         = 0x4,
+        not_equal     = 0x5,
+        below_equal   = 0x6, // Unsigned
+        above         = 0x7, // Unsigned
+        less          = 0xC,
+        greater_equal = 0xD,
+        less_equal    = 0xE,
+        greater       = 0xF,
+    };
+
+    // Every condition code differs from its negation only in the lowest bit
+    constexpr auto negation(Condition const condition) noexcept -> Condition {
+        return static_cast<Condition>(static_cast<bu::U8>(condition) ^ 1);
+    }
+
+    struct Memory {
+        Register base;
+        bu::I32  displacement = 0;
+    };
+
+
+    // Compiled code keeps the state of the interpreter in callee-saved registers
+
+    constexpr Register stack_pointer     = Register::rbx;
+    constexpr Register activation_record = Register::r12;
+    constexpr Register context           = Register::r13;
+
+#ifdef _WIN32
+    constexpr Register first_argument  = Register::rcx;
+    constexpr Register second_argument = Register::rdx;
+#else
+    constexpr Register first_argument  = Register::rdi;
+    constexpr Register second_argument = Register::rsi;
+#endif
+
+    constexpr auto field(bu::Usize const offset) noexcept -> bu::I32 {
+        return static_cast<bu::I32>(offset);
+    }
+
+    constexpr Memory context_stack_pointer       { context, field(offsetof(vm::Jit_context, stack_pointer      )) };
+    constexpr Memory context_activation_record   { context, field(offsetof(vm::Jit_context, activation_record  )) };
+    constexpr Memory context_instruction_pointer { context, field(offsetof(vm::Jit_context, instruction_pointer)) };
+    constexpr Memory context_budget              { context, field(offsetof(vm::Jit_context, budget             )) };
+
+    constexpr Memory return_value_address { activation_record, field(offsetof(vm::Activation_record, return_value_address)) };
+    constexpr Memory return_address       { activation_record, field(offsetof(vm::Activation_record, return_address      )) };
+    constexpr Memory caller               { activation_record, field(offsetof(vm::Activation_record, caller              )) };
+
+    // The top of the stack, size bytes below the stack pointer
+    constexpr auto top(bu::Usize const size) noexcept -> Memory {
+        return { stack_pointer, -static_cast<bu::I32>(size) };
+    }
+
+
+    // Encodes the handful of x86-64 instructions that the templates are made of.
+    // Every memory operand is encoded as a base register with a 32-bit displacement.
+    class Assembler {
+        std::vector<std::byte> code;
+
+        auto emit(std::integral auto const... bytes) -> void {
+            (code.push_back(static_cast<std::byte>(bytes)), ...);
+        }
+
+        template <bu::trivial T>
+        auto emit_value(T const value) -> void {
+            bu::serialize_to(std::back_inserter(code), value);
+        }
+
+        static constexpr auto index(Register const reg) noexcept -> bu::U8 {
+            return static_cast<bu::U8>(reg);
+        }
+
+        // reg is either a register or an opcode extension
+        auto emit_prefix(bool const is_wide, bu::U8 const reg, Register const base) -> void {
+            auto const prefix = 0x40 | (is_wide << 3) | ((reg >> 3) << 2) | (index(base) >> 3);
+            if (prefix != 0x40) {
+                emit(prefix);
+            }
+        }
+
+        auto emit_memory_operation(bool                              const is_wide,
+                                   std::initializer_list<bu::U8>     const opcode,
+                                   bu::U8                            const reg,
+                                   Memory                            const memory) -> void
+        {
+            emit_prefix(is_wide, reg, memory.base);
+            for (bu::U8 const byte : opcode) {
+                emit(byte);
+            }
+            emit(0x80 | ((reg & 7) << 3) | (index(memory.base) & 7));
+            if ((index(memory.base) & 7) == index(Register::rsp)) {
+                emit(0x24); // rsp and r12 can only be used as a base through a SIB byte
+            }
+            emit_value(memory.displacement);
+        }
+
+        auto emit_register_operation(std::initializer_list<bu::U8> const opcode,
+                                     bu::U8                        const reg,
+                                     Register                      const rm) -> void
+        {
+            emit_prefix(true, reg, rm);
+            for (bu::U8 const byte : opcode) {
+                emit(byte);
+            }
+            emit(0xC0 | ((reg & 7) << 3) | (index(rm) & 7));
+        }
+    public:
+        auto offset() const noexcept -> bu::Usize {
+            return code.size();
+        }
+
+        auto bytes() const noexcept -> std::span<std::byte const> {
+            return code;
+        }
+
+        auto mov(Register const destination, bu::Isize const immediate) -> void {
+            emit_prefix(true, 0, destination);
+            emit(0xB8 + (index(destination) & 7));
+            emit_value(immediate);
+        }
+        auto mov(Register const destination, Register const source) -> void {
+            emit_register_operation({ 0x89 }, index(source), destination);
+        }
+        auto mov(Register const destination, Memory const source) -> void {
+            emit_memory_operation(true, { 0x8B }, index(destination), source);
+        }
+        auto mov(Memory const destination, Register const source) -> void {
+            emit_memory_operation(true, { 0x89 }, index(source), destination);
+        }
+
+        auto mov_al(Memory const source) -> void {
+            emit_memory_operation(false, { 0x8A }, index(Register::rax), source);
+        }
+        auto mov(Memory const destination, bu::U8 const immediate) -> void {
+            emit_memory_operation(false, { 0xC6 }, 0, destination);
+            emit(immediate);
+        }
+        auto mov_byte(Memory const destination) -> void { // from al
+            emit_memory_operation(false, { 0x88 }, index(Register::rax), destination);
+        }
+
+        auto lea(Register const destination, Memory const source) -> void {
+            emit_memory_operation(true, { 0x8D }, index(destination), source);
+        }
+
+        auto add(Register const destination, bu::I32 const immediate) -> void {
+            emit_register_operation({ 0x81 }, 0, destination);
+            emit_value(immediate);
+        }
+        auto sub(Register const destination, bu::I32 const immediate) -> void {
+            emit_register_operation({ 0x81 }, 5, destination);
+            emit_value(immediate);
+        }
+        auto add(Memory const destination, bu::I32 const immediate) -> void {
+            emit_memory_operation(true, { 0x81 }, 0, destination);
+            emit_value(immediate);
+        }
+        auto add(Memory const destination, Register const source) -> void {
+            emit_memory_operation(true, { 0x01 }, index(source), destination);
+        }
+        auto sub(Memory const destination, Register const source) -> void {
+            emit_memory_operation(true, { 0x29 }, index(source), destination);
+        }
+        auto add(Register const destination, Memory const source) -> void {
+            emit_memory_operation(true, { 0x03 }, index(destination), source);
+        }
+        auto sub(Register const destination, Memory const source) -> void {
+            emit_memory_operation(true, { 0x2B }, index(destination), source);
+        }
+
+        auto imul(Register const destination, Memory const source) -> void {
+            emit_memory_operation(true, { 0x0F, 0xAF }, index(destination), source);
+        }
+        auto imul(Register const destination, Register const source) -> void {
+            emit_register_operation({ 0x0F, 0xAF }, index(destination), source);
+        }
+
+        // rax = rdx:rax / divisor, after cqo has sign-extended rax into rdx
+        auto cqo() -> void {
+            emit(0x48, 0x99);
+        }
+        auto idiv(Memory const divisor) -> void {
+            emit_memory_operation(true, { 0xF7 }, 7, divisor);
+        }
+        auto idiv(Register const divisor) -> void {
+            emit_register_operation({ 0xF7 }, 7, divisor);
+        }
+
+        auto cmp(Register const left, Memory const right) -> void {
+            emit_memory_operation(true, { 0x3B }, index(left), right);
+        }
+        auto cmp(Memory const left, bu::U8 const immediate) -> void {
+            emit_memory_operation(false, { 0x80 }, 7, left);
+            emit(immediate);
+        }
+
+        auto set_al(Condition const condition) -> void {
+            emit(0x0F, 0x90 + static_cast<bu::U8>(condition), 0xC0);
+        }
+
+        auto and_al(Memory const source) -> void {
+            emit_memory_operation(false, { 0x22 }, index(Register::rax), source);
+        }
+        auto or_al(Memory const source) -> void {
+            emit_memory_operation(false, { 0x0A }, index(Register::rax), source);
+        }
+        auto xor_al(bu::U8 const immediate) -> void {
+            emit(0x34, immediate);
+        }
+        auto xor_byte(Memory const destination, bu::U8 const immediate) -> void {
+            emit_memory_operation(false, { 0x80 }, 6, destination);
+            emit(immediate);
+        }
+
+        auto push(Register const reg) -> void {
+            emit_prefix(false, 0, reg);
+            emit(0x50 + (index(reg) & 7));
+        }
+        auto pop(Register const reg) -> void {
+            emit_prefix(false, 0, reg);
+            emit(0x58 + (index(reg) & 7));
+        }
+        auto ret() -> void {
+            emit(0xC3);
+        }
+        auto jmp(Register const target) -> void {
+            emit_prefix(false, 0, target);
+            emit(0xFF, 0xE0 | (index(target) & 7));
+        }
+
+        // Jumps return the offset of their 32-bit displacement, to be patched once the target is known
+        auto jmp() -> bu::Usize {
+            emit(0xE9);
+            emit_value(bu::I32 {});
+            return offset() - sizeof(bu::I32);
+        }
+        auto jump_if(Condition const condition) -> bu::Usize {
+            emit(0x0F, 0x80 + static_cast<bu::U8>(condition));
+            emit_value(bu::I32 {});
+            return offset() - sizeof(bu::I32);
+        }
+
+        auto patch(bu::Usize const displacement_offset, bu::Usize const target) -> void {
+            auto const displacement = static_cast<bu::I32>(
+                static_cast<bu::Isize>(target) - static_cast<bu::Isize>(displacement_offset + sizeof(bu::I32))
+            );
+            std::memcpy(code.data() + displacement_offset, &displacement, sizeof displacement);
+        }
+    };
+
+
+    struct Compiled_function {
+        std::vector<std::byte>           code;
+        std::vector<bu::Pair<bu::Usize>> entry_points; // Bytecode offsets paired with native offsets
+    };
+
+
+    // Translates every instruction reachable from the start of a function. Control
+    // never leaves the function through a jump, because the bytecode is verified.
+    class Function_compiler {
+        static constexpr bu::Usize not_compiled = std::numeric_limits<bu::Usize>::max();
+
+        std::span<std::byte const>       bytecode;
+        std::byte const*                 anchor;
+        Assembler                        assembler;
+        std::vector<bu::Usize>           native_offsets;
+        std::vector<bu::Pair<bu::Usize>> jumps;     // Displacement offsets paired with bytecode targets
+        std::vector<bu::Usize>           worklist;
+        std::vector<bu::Usize>           entry_offsets;
+        bu::Usize                        function_offset    = 0;
+        bu::Usize                        exit_offset        = 0;
+        bu::Usize                        instruction_offset = 0; // The offset of the instruction being compiled
+        bool                             checks_budget;
+
+        template <bu::trivial T>
+        auto read(bu::Usize const offset) const noexcept -> T {
+            T value;
+            std::memcpy(&value, bytecode.data() + offset, sizeof value);
+            return value;
+        }
+
+        // The function is entered through its prologue, which loads the state of the
+        // interpreter from the context and jumps to the requested entry point. Exits
+        // store the state back and return to the interpreter.
+        auto emit_prologue_and_exit() -> void {
+            assembler.push(stack_pointer);
+            assembler.push(activation_record);
+            assembler.push(context);
+            assembler.mov(context, first_argument);
+            assembler.mov(stack_pointer, context_stack_pointer);
+            assembler.mov(activation_record, context_activation_record);
+            assembler.jmp(second_argument);
+
+            exit_offset = assembler.offset();
+            assembler.mov(context_stack_pointer, stack_pointer);
+            assembler.mov(context_activation_record, activation_record);
+            assembler.pop(context);
+            assembler.pop(activation_record);
+            assembler.pop(stack_pointer);
+            assembler.ret();
+        }
+
+        auto exit_to(bu::Usize const bytecode_offset) -> void {
+            assembler.mov(Register::rax, reinterpret_cast<bu::Isize>(anchor + bytecode_offset));
+            assembler.mov(context_instruction_pointer, Register::rax);
+            assembler.patch(assembler.jmp(), exit_offset);
+        }
+
+        // Every loop passes through a backward jump, so those are the only jumps that
+        // charge the budget, just like in the interpreter. Once the budget runs out,
+        // the jump exits to the interpreter at its target instead of taking it, and
+        // the target becomes an entry point, so the next resume continues the loop
+        // in compiled code.
+        auto is_charged(bu::Usize const target) const noexcept -> bool {
+            return checks_budget && target <= instruction_offset;
+        }
+
+        auto charge_budget_and_jump_to(bu::Usize const target) -> void {
+            assembler.add(context_budget, -1);
+            jumps.emplace_back(assembler.jump_if(Condition::not_equal), target);
+            worklist.push_back(target);
+            entry_offsets.push_back(target);
+            exit_to(target);
+        }
+
+        auto jump_to(bu::Usize const target) -> void {
+            if (is_charged(target)) {
+                charge_budget_and_jump_to(target);
+                return;
+            }
+            jumps.emplace_back(assembler.jmp(), target);
+            worklist.push_back(target);
+        }
+
+        auto jump_to_if(Condition const condition, bu::Usize const target) -> void {
+            if (is_charged(target)) {
+                auto const not_taken = assembler.jump_if(negation(condition));
+                charge_budget_and_jump_to(target);
+                assembler.patch(not_taken, assembler.offset());
+                return;
+            }
+            jumps.emplace_back(assembler.jump_if(condition), target);
+            worklist.push_back(target);
+        }
+
+        // Copies size bytes between two addresses held in r11 and r10
+        auto copy(bu::Usize const size) -> void {
+            constexpr Register source = Register::r11, destination = Register::r10;
+
+            if (size <= 64) {
+                bu::Usize offset = 0;
+                for (; offset + sizeof(bu::Isize) <= size; offset += sizeof(bu::Isize)) {
+                    assembler.mov(Register::rax, Memory { source, field(offset) });
+                    assembler.mov(Memory { destination, field(offset) }, Register::rax);
+                }
+                for (; offset != size; ++offset) {
+                    assembler.mov_al(Memory { source, field(offset) });
+                    assembler.mov_byte(Memory { destination, field(offset) });
+                }
+            }
+            else {
+                assembler.mov(Register::rcx, static_cast<bu::Isize>(size));
+                auto const loop = assembler.offset();
+                assembler.mov_al(Memory { source });
+                assembler.mov_byte(Memory { destination });
+                assembler.add(source, 1);
+                assembler.add(destination, 1);
+                assembler.sub(Register::rcx, 1);
+                assembler.patch(assembler.jump_if(Condition::not_equal), loop);
+            }
+        }
+
+        auto load_local(bu::Isize const offset, bu::Usize const size) -> void { // -> bytes
+            assembler.lea(Register::r11, Memory { activation_record, static_cast<bu::I32>(offset) });
+            assembler.lea(Register::r10, Memory { stack_pointer });
+            copy(size);
+            assembler.add(stack_pointer, static_cast<bu::I32>(size));
+        }
+
+        auto store_local(bu::Isize const offset, bu::Usize const size) -> void { // bytes ->
+            assembler.sub(stack_pointer, static_cast<bu::I32>(size));
+            assembler.lea(Register::r10, Memory { activation_record, static_cast<bu::I32>(offset) });
+            assembler.lea(Register::r11, Memory { stack_pointer });
+            copy(size);
+        }
+
+        auto compare(Condition const condition) -> void { // left, right -> bool
+            assembler.mov(Register::rax, top(16));
+            assembler.cmp(Register::rax, top(8));
+            assembler.set_al(condition);
+            assembler.mov_byte(top(16));
+            assembler.sub(stack_pointer, 15);
+        }
+
+        auto compare_immediate(Condition const condition, bu::Isize const left) -> void { // right -> bool
+            assembler.mov(Register::rax, left);
+            assembler.cmp(Register::rax, top(8));
+            assembler.set_al(condition);
+            assembler.mov_byte(top(8));
+            assembler.sub(stack_pointer, 7);
+        }
+
+        auto logic(bool const is_and, bool const is_negated) -> void { // bool, bool -> bool
+            assembler.mov_al(top(2));
+            if (is_and) {
+                assembler.and_al(top(1));
+            }
+            else {
+                assembler.or_al(top(1));
+            }
+            if (is_negated) {
+                assembler.xor_al(1);
+            }
+            assembler.mov_byte(top(2));
+            assembler.sub(stack_pointer, 1);
+        }
+
+        auto jump_bool(Condition const condition, bu::Usize const target) -> void { // bool ->
+            assembler.sub(stack_pointer, 1);
+            assembler.cmp(Memory { stack_pointer }, 0);
+            jump_to_if(condition, target);
+        }
+
+        auto local_jump_immediate(Condition const condition, bu::Usize const offset, bu::Usize const next, bool const is_popped) -> void {
+            auto const target = static_cast<bu::Usize>(static_cast<bu::Isize>(next) + read<vm::Local_offset_type>(offset + 1));
+            if (is_popped) {
+                assembler.sub(stack_pointer, sizeof(bu::Isize));
+            }
+            assembler.mov(Register::rax, read<bu::Isize>(offset + 1 + sizeof(vm::Local_offset_type)));
+            assembler.cmp(Register::rax, is_popped ? Memory { stack_pointer } : top(8));
+            jump_to_if(condition, target);
+        }
+
+        // Emits the template of one instruction, and returns whether
+        // control may continue to the instruction that follows it
+        auto compile_instruction(bu::Usize const offset, bu::Usize const next) -> bool {
+            auto const argument = offset + 1;
+
+            auto const local_target = [&]<class Offset = vm::Local_offset_type>(bu::Type<Offset> = {}) {
+                return static_cast<bu::Usize>(static_cast<bu::Isize>(next) + read<Offset>(argument));
+            };
+
+            switch (static_cast<Opcode>(bytecode[offset])) {
+            case Opcode::ipush:
+                assembler.mov(Register::rax, read<bu::Isize>(argument));
+                assembler.mov(Memory { stack_pointer }, Register::rax);
+                assembler.add(stack_pointer, sizeof(bu::Isize));
+                return true;
+            case Opcode::push_true:
+            case Opcode::push_false:
+                assembler.mov(Memory { stack_pointer }, bu::U8 { bytecode[offset] == static_cast<std::byte>(Opcode::push_true) });
+                assembler.add(stack_pointer, 1);
+                return true;
+
+            case Opcode::idup:
+                assembler.mov(Register::rax, top(8));
+                assembler.mov(Memory { stack_pointer }, Register::rax);
+                assembler.add(stack_pointer, sizeof(bu::Isize));
+                return true;
+            case Opcode::bdup:
+                assembler.mov_al(top(1));
+                assembler.mov_byte(Memory { stack_pointer });
+                assembler.add(stack_pointer, 1);
+                return true;
+
+            case Opcode::iadd:
+            case Opcode::isub:
+                assembler.mov(Register::rax, top(8));
+                if (bytecode[offset] == static_cast<std::byte>(Opcode::iadd)) {
+                    assembler.add(top(16), Register::rax);
+                }
+                else {
+                    assembler.sub(top(16), Register::rax);
+                }
+                assembler.sub(stack_pointer, sizeof(bu::Isize));
+                return true;
+            case Opcode::imul:
+                assembler.mov(Register::rax, top(16));
+                assembler.imul(Register::rax, top(8));
+                assembler.mov(top(16), Register::rax);
+                assembler.sub(stack_pointer, sizeof(bu::Isize));
+                return true;
+            case Opcode::idiv:
+                assembler.mov(Register::rax, top(16));
+                assembler.cqo();
+                assembler.idiv(top(8));
+                assembler.mov(top(16), Register::rax);
+                assembler.sub(stack_pointer, sizeof(bu::Isize));
+                return true;
+
+            case Opcode::iadd_checked:
+            case Opcode::isub_checked:
+            case Opcode::imul_checked:
+            {
+                // The result is computed in a register, so that the operands are still on
+                // the stack when an overflow exits to the interpreter, which then traps
+                assembler.mov(Register::rax, top(16));
+                switch (static_cast<Opcode>(bytecode[offset])) {
+                case Opcode::iadd_checked: assembler.add(Register::rax, top(8)); break;
+                case Opcode::isub_checked: assembler.sub(Register::rax, top(8)); break;
+                default:                   assembler.imul(Register::rax, top(8)); break;
+                }
+                auto const no_overflow = assembler.jump_if(Condition::no_overflow);
+                exit_to(offset);
+                assembler.patch(no_overflow, assembler.offset());
+                assembler.mov(top(16), Register::rax);
+                assembler.sub(stack_pointer, sizeof(bu::Isize));
+                return true;
+            }
+
+            case Opcode::iinc_top:
+                assembler.add(top(8), 1);
+                return true;
+
+            case Opcode::ieq : compare(Condition::equal        ); return true;
+            case Opcode::ineq: compare(Condition::not_equal    ); return true;
+            case Opcode::ilt : compare(Condition::less         ); return true;
+            case Opcode::ilte: compare(Condition::less_equal   ); return true;
+            case Opcode::igt : compare(Condition::greater      ); return true;
+            case Opcode::igte: compare(Condition::greater_equal); return true;
+
+            case Opcode::ult : compare(Condition::below        ); return true;
+            case Opcode::ulte: compare(Condition::below_equal  ); return true;
+            case Opcode::ugt : compare(Condition::above        ); return true;
+            case Opcode::ugte: compare(Condition::above_equal  ); return true;
+
+            case Opcode::ieq_i : compare_immediate(Condition::equal        , read<bu::Isize>(argument)); return true;
+            case Opcode::ineq_i: compare_immediate(Condition::not_equal    , read<bu::Isize>(argument)); return true;
+            case Opcode::ilt_i : compare_immediate(Condition::less         , read<bu::Isize>(argument)); return true;
+            case Opcode::ilte_i: compare_immediate(Condition::less_equal   , read<bu::Isize>(argument)); return true;
+            case Opcode::igt_i : compare_immediate(Condition::greater      , read<bu::Isize>(argument)); return true;
+            case Opcode::igte_i: compare_immediate(Condition::greater_equal, read<bu::Isize>(argument)); return true;
+
+            case Opcode::land:  logic(true,  false); return true;
+            case Opcode::lnand: logic(true,  true ); return true;
+            case Opcode::lor:   logic(false, false); return true;
+            case Opcode::lnor:  logic(false, true ); return true;
+            case Opcode::lnot:
+                assembler.xor_byte(top(1), 1);
+                return true;
+
+            case Opcode::bitcopy_from_stack:
+            {
+                auto const size = read<vm::Local_size_type>(argument);
+                assembler.mov(Register::r10, top(8));
+                assembler.sub(stack_pointer, static_cast<bu::I32>(sizeof(std::byte*) + size));
+                assembler.lea(Register::r11, Memory { stack_pointer });
+                copy(size);
+                return true;
+            }
+            case Opcode::bitcopy_to_stack:
+            {
+                auto const size = read<vm::Local_size_type>(argument);
+                assembler.mov(Register::r11, top(8));
+                assembler.sub(stack_pointer, sizeof(std::byte*));
+                assembler.lea(Register::r10, Memory { stack_pointer });
+                copy(size);
+                assembler.add(stack_pointer, size);
+                return true;
+            }
+            case Opcode::load_local:
+                load_local(read<vm::Local_offset_type>(argument), read<vm::Local_size_type>(argument + sizeof(vm::Local_offset_type)));
+                return true;
+            case Opcode::load_local_1:        load_local(read<vm::Local_offset_type>(argument), 1);        return true;
+            case Opcode::load_local_8:        load_local(read<vm::Local_offset_type>(argument), 8);        return true;
+            case Opcode::load_local_16:       load_local(read<vm::Local_offset_type>(argument), 16);       return true;
+            case Opcode::load_local_1_short:  load_local(read<vm::Short_local_offset_type>(argument), 1);  return true;
+            case Opcode::load_local_8_short:  load_local(read<vm::Short_local_offset_type>(argument), 8);  return true;
+            case Opcode::load_local_16_short: load_local(read<vm::Short_local_offset_type>(argument), 16); return true;
+
+            case Opcode::store_local:
+                store_local(read<vm::Local_offset_type>(argument), read<vm::Local_size_type>(argument + sizeof(vm::Local_offset_type)));
+                return true;
+            case Opcode::store_local_1:        store_local(read<vm::Local_offset_type>(argument), 1);        return true;
+            case Opcode::store_local_8:        store_local(read<vm::Local_offset_type>(argument), 8);        return true;
+            case Opcode::store_local_16:       store_local(read<vm::Local_offset_type>(argument), 16);       return true;
+            case Opcode::store_local_1_short:  store_local(read<vm::Short_local_offset_type>(argument), 1);  return true;
+            case Opcode::store_local_8_short:  store_local(read<vm::Short_local_offset_type>(argument), 8);  return true;
+            case Opcode::store_local_16_short: store_local(read<vm::Short_local_offset_type>(argument), 16); return true;
+
+            case Opcode::push_address:
+                assembler.lea(Register::rax, Memory { activation_record, read<vm::Local_offset_type>(argument) });
+                assembler.mov(Memory { stack_pointer }, Register::rax);
+                assembler.add(stack_pointer, sizeof(std::byte*));
+                return true;
+            case Opcode::push_return_value_address:
+                assembler.mov(Register::rax, return_value_address);
+                assembler.mov(Memory { stack_pointer }, Register::rax);
+                assembler.add(stack_pointer, sizeof(std::byte*));
+                return true;
+
+            case Opcode::jump:
+                jump_to(read<vm::Jump_offset_type>(argument));
+                return false;
+            case Opcode::local_jump:
+                jump_to(local_target());
+                return false;
+            case Opcode::local_jump_8:
+                jump_to(local_target(bu::type<vm::Local_offset_8_type>));
+                return false;
+            case Opcode::local_jump_32:
+                jump_to(local_target(bu::type<vm::Local_offset_32_type>));
+                return false;
+
+            case Opcode::jump_true:          jump_bool(Condition::not_equal, read<vm::Jump_offset_type>(argument)); return true;
+            case Opcode::local_jump_true:    jump_bool(Condition::not_equal, local_target()); return true;
+            case Opcode::local_jump_true_8:  jump_bool(Condition::not_equal, local_target(bu::type<vm::Local_offset_8_type>)); return true;
+            case Opcode::local_jump_true_32: jump_bool(Condition::not_equal, local_target(bu::type<vm::Local_offset_32_type>)); return true;
+
+            case Opcode::jump_false:          jump_bool(Condition::equal, read<vm::Jump_offset_type>(argument)); return true;
+            case Opcode::local_jump_false:    jump_bool(Condition::equal, local_target()); return true;
+            case Opcode::local_jump_false_8:  jump_bool(Condition::equal, local_target(bu::type<vm::Local_offset_8_type>)); return true;
+            case Opcode::local_jump_false_32: jump_bool(Condition::equal, local_target(bu::type<vm::Local_offset_32_type>)); return true;
+
+            case Opcode::local_jump_ieq_i : local_jump_immediate(Condition::equal        , offset, next, true); return true;
+            case Opcode::local_jump_ineq_i: local_jump_immediate(Condition::not_equal    , offset, next, true); return true;
+            case Opcode::local_jump_ilt_i : local_jump_immediate(Condition::less         , offset, next, true); return true;
+            case Opcode::local_jump_ilte_i: local_jump_immediate(Condition::less_equal   , offset, next, true); return true;
+            case Opcode::local_jump_igt_i : local_jump_immediate(Condition::greater      , offset, next, true); return true;
+            case Opcode::local_jump_igte_i: local_jump_immediate(Condition::greater_equal, offset, next, true); return true;
+
+            case Opcode::idup_local_jump_ieq_i : local_jump_immediate(Condition::equal        , offset, next, false); return true;
+            case Opcode::idup_local_jump_ineq_i: local_jump_immediate(Condition::not_equal    , offset, next, false); return true;
+            case Opcode::idup_local_jump_ilt_i : local_jump_immediate(Condition::less         , offset, next, false); return true;
+            case Opcode::idup_local_jump_ilte_i: local_jump_immediate(Condition::less_equal   , offset, next, false); return true;
+            case Opcode::idup_local_jump_igt_i : local_jump_immediate(Condition::greater      , offset, next, false); return true;
+            case Opcode::idup_local_jump_igte_i: local_jump_immediate(Condition::greater_equal, offset, next, false); return true;
+
+            case Opcode::ipush_iadd:
+                assembler.mov(Register::rax, read<bu::Isize>(argument));
+                assembler.add(top(8), Register::rax);
+                return true;
+            case Opcode::ipush_isub:
+                assembler.mov(Register::rax, read<bu::Isize>(argument));
+                assembler.sub(top(8), Register::rax);
+                return true;
+            case Opcode::ipush_imul:
+                assembler.mov(Register::rax, top(8));
+                assembler.mov(Register::rcx, read<bu::Isize>(argument));
+                assembler.imul(Register::rax, Register::rcx);
+                assembler.mov(top(8), Register::rax);
+                return true;
+            case Opcode::ipush_idiv:
+                assembler.mov(Register::rax, top(8));
+                assembler.mov(Register::rcx, read<bu::Isize>(argument));
+                assembler.cqo();
+                assembler.idiv(Register::rcx);
+                assembler.mov(top(8), Register::rax);
+                return true;
+
+            case Opcode::call:
+            case Opcode::call_0:
+            case Opcode::call_32:
+            case Opcode::call_0_32:
+                // The interpreter performs the call, so that it can count it and
+                // enter the callee's compiled code if there is any. The return
+                // address becomes an entry point of this function.
+                exit_to(offset);
+                worklist.push_back(next);
+                entry_offsets.push_back(next);
+                return false;
+
+            case Opcode::tail_call:
+            {
+                auto const return_value_size = read<vm::Local_size_type>(argument);
+                auto const argument_size     = read<vm::Local_size_type>(argument + sizeof(vm::Local_size_type));
+                auto const target            = read<vm::Jump_offset_type>(argument + 2 * sizeof(vm::Local_size_type));
+
+                if (target != function_offset) {
+                    // The interpreter performs the call, as with call
+                    exit_to(offset);
+                    return false;
+                }
+
+                // A tail call of this function becomes a jump back to its start.
+                // The arguments move to lower addresses, so a forward copy is safe.
+                assembler.lea(Register::r11, Memory { stack_pointer, -static_cast<bu::I32>(argument_size) });
+                assembler.lea(Register::r10, Memory { activation_record, -static_cast<bu::I32>(return_value_size + argument_size) });
+                copy(argument_size);
+                assembler.lea(stack_pointer, Memory { activation_record, field(sizeof(vm::Activation_record)) });
+                jump_to(target);
+                return false;
+            }
+
+            case Opcode::ret:
+                assembler.mov(Register::rax, return_address);
+                assembler.mov(context_instruction_pointer, Register::rax);
+                assembler.mov(stack_pointer, activation_record);
+                assembler.mov(activation_record, caller);
+                assembler.patch(assembler.jmp(), exit_offset);
+                return false;
+
+            default:
+                // Instructions without a template, including halt, are left to the interpreter.
+                // Unless the instruction was halt, the interpreter then continues in compiled
+                // code at the next instruction, so a loop that contains one stays compiled.
+                exit_to(offset);
+                if (static_cast<Opcode>(bytecode[offset]) != Opcode::halt && next < bytecode.size()) {
+                    worklist.push_back(next);
+                    entry_offsets.push_back(next);
+                }
+                return false;
+            }
+        }
+
+        auto compile_from(bu::Usize offset) -> void {
+            while (native_offsets[offset] == not_compiled) {
+                native_offsets[offset] = assembler.offset();
+                instruction_offset     = offset;
+
+                auto const next = offset + 1 + vm::argument_bytes(static_cast<Opcode>(bytecode[offset]));
+                if (!compile_instruction(offset, next)) {
+                    return;
+                }
+                offset = next;
+            }
+            jumps.emplace_back(assembler.jmp(), offset); // Continue in code that has already been compiled
+        }
+    public:
+        Function_compiler(std::span<std::byte const> const bytecode, bool const checks_budget)
+            : bytecode       { bytecode }
+            , anchor         { bytecode.data() }
+            , native_offsets(bytecode.size(), not_compiled)
+            , checks_budget  { checks_budget } {}
+
+        auto compile(bu::Usize const function_offset) && -> Compiled_function {
+            this->function_offset = function_offset;
+            emit_prologue_and_exit();
+
+            entry_offsets.push_back(function_offset);
+            worklist.push_back(function_offset);
+
+            while (!worklist.empty()) {
+                auto const offset = worklist.back();
+                worklist.pop_back();
+                if (native_offsets[offset] == not_compiled) {
+                    compile_from(offset);
+                }
+            }
+
+            for (auto const [displacement_offset, target] : jumps) {
+                assembler.patch(displacement_offset, native_offsets[target]);
+            }
+
+            Compiled_function function;
+            function.code.assign(assembler.bytes().begin(), assembler.bytes().end());
+            for (bu::Usize const offset : entry_offsets) {
+                function.entry_points.emplace_back(offset, native_offsets[offset]);
+            }
+            return function;
+        }
+    };
+
+}
+
+
+vm::Jit::Jit(std::span<std::byte> const bytecode, bu::Usize const call_threshold, bool const checks_budget)
+    : anchor            { bytecode.data() }
+    , call_threshold    { call_threshold }
+    , is_budget_checked { checks_budget }
+    , call_counts       (bytecode.size())
+    , entry_points      (bytecode.size() + 1) {}
+
+vm::Jit::~Jit() = default;
+
+
+auto vm::Jit::count_call(bu::Usize const function_offset) -> void {
+    auto& count = call_counts[function_offset];
+
+    if (count <= call_threshold && count++ == call_threshold) {
+        compile(function_offset);
+    }
+}
+
+
+auto vm::Jit::run_compiled_code(Jit_context& context) const -> void {
+    for (;;) {
+        auto const [function, address] = entry_points[static_cast<bu::Usize>(context.instruction_pointer - anchor)];
+        if (!function || (is_budget_checked && context.budget == 0)) {
+            return;
+        }
+        function(&context, address);
+    }
+}
+
+
+auto vm::Jit::compiled_function_count() const noexcept -> bu::Usize {
+    return compiled_functions.size();
+}
+
+
+auto vm::Jit::compile(bu::Usize const function_offset) -> void {
+    if constexpr (is_supported) {
+        auto const [code, function_entry_points] =
+            Function_compiler { { anchor, call_counts.size() }, is_budget_checked }.compile(function_offset);
+
+        std::byte* const start    = compiled_functions.emplace_back(code).data();
+        auto       const function = reinterpret_cast<decltype(Entry_point::function)>(start);
+
+        for (auto const [bytecode_offset, native_offset] : function_entry_points) {
+            if (!entry_points[bytecode_offset].function) {
+                entry_points[bytecode_offset] = { .function = function, .address = start + native_offset };
+            }
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "bu/utilities.hpp"
+#include "virtual_machine.hpp"
+
+
+namespace vm {
+
+    // The state that compiled code shares with the interpreter. Compiled code uses the
+    // same Bytestack and Activation_record layout as the interpreter, so either can
+    // continue a frame the other one started.
+    struct Jit_context {
+        std::byte*         stack_pointer;
+        Activation_record* activation_record;
+        std::byte*         instruction_pointer; // Where the interpreter resumes
+        bu::Usize          budget = 0;          // Only read and written by code compiled with budget checks
+    };
+
+
+    // A baseline template JIT for x86-64. Once a function has been called more
+    // than call_threshold times, each of its instructions is translated into a fixed
+    // sequence of machine code. Instructions without a template, as well as calls
+    // and halt, exit to the interpreter, which then continues at that instruction.
+    // Returns from compiled code exit to the interpreter at the return address. The
+    // return addresses, the instructions after the ones without a template, and the
+    // targets of the backward jumps that exit when the budget runs out are all entry
+    // points, through which the interpreter goes back into compiled code.
+    //
+    // Compiled code does not check the bounds of the stack, so the bytecode must have
+    // been verified, and the jit engine interprets bytecode that fails verification.
+    // On other architectures, functions are simply never compiled.
+    //
+    // With budget checks, every backward jump in compiled code charges the budget
+    // of the context, and exits to the interpreter at its target once it runs out.
+    class [[nodiscard]] Jit {
+    public:
+        class Executable_memory;
+
+        static constexpr bool is_supported =
+#if defined(__x86_64__) || defined(_M_X64)
+            true;
+#else
+            false;
+#endif
+
+        Jit(std::span<std::byte> bytecode, bu::Usize call_threshold, bool checks_budget = false);
+        ~Jit();
+
+        // Counts a call to the function at the given bytecode offset, and compiles
+        // the function once it has been called more than call_threshold times
+        auto count_call(bu::Usize function_offset) -> void;
+
+        // Runs compiled code for as long as the instruction pointer of the context
+        // is at an entry point, and the budget has not run out
+        auto run_compiled_code(Jit_context&) const -> void;
+
+        auto is_entry_point(std::byte const* const instruction_pointer) const noexcept -> bool {
+            return entry_points[static_cast<bu::Usize>(instruction_pointer - anchor)].function != nullptr;
+        }
+
+        auto checks_budget() const noexcept -> bool {
+            return is_budget_checked;
+        }
+
+        // The number of functions that have been compiled so far
+        auto compiled_function_count() const noexcept -> bu::Usize;
+
+    private:
+        struct Entry_point {
+            void(*function)(Jit_context*, std::byte const*) = nullptr; // The compiled function's prologue
+            std::byte const* address = nullptr;                         // Where execution continues within it
+        };
+
+        std::byte*                     anchor;
+        bu::Usize                      call_threshold;
+        bool                           is_budget_checked;
+        std::vector<bu::Usize>         call_counts;
+        std::vector<Entry_point>       entry_points; // Indexed by bytecode offset
+        std::vector<Executable_memory> compiled_functions;
+
+        auto compile(bu::Usize function_offset) -> void;
+    };
+
+}
\ No newline at end of file
@@ -0,0 +1,197 @@
+#include "bu/utilities.hpp"
+#include "language/configuration.hpp"
+#include "virtual_machine.hpp"
+
+
+#ifdef _WIN32
+
+// Copied the necessary declarations from Windows.h, for the same reason as in bu/color.cpp
+
+extern "C" {
+    typedef unsigned long DWORD;
+    typedef int           BOOL;
+    typedef void*         HANDLE;
+    typedef long long     LONG_PTR;
+    typedef long long     LARGE_INTEGER;
+
+    HANDLE __declspec(dllimport) CreateFileW(wchar_t const*, DWORD, DWORD, void*, DWORD, DWORD, HANDLE);
+    BOOL   __declspec(dllimport) GetFileSizeEx(HANDLE, LARGE_INTEGER*);
+    HANDLE __declspec(dllimport) CreateFileMappingW(HANDLE, void*, DWORD, DWORD, DWORD, wchar_t const*);
+    void*  __declspec(dllimport) MapViewOfFile(HANDLE, DWORD, DWORD, DWORD, unsigned long long);
+    BOOL   __declspec(dllimport) UnmapViewOfFile(void const*);
+    BOOL   __declspec(dllimport) CloseHandle(HANDLE);
+}
+
+#define GENERIC_READ          0x80000000
+#define FILE_SHARE_READ       0x00000001
+#define OPEN_EXISTING         3
+#define FILE_ATTRIBUTE_NORMAL 0x00000080
+#define PAGE_WRITECOPY        0x08
+#define FILE_MAP_COPY         0x00000001
+#define INVALID_HANDLE_VALUE  ((HANDLE)(LONG_PTR)-1)
+
+#else
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#endif
+
+
+namespace {
+
+    // Maps the whole file copy-on-write, so that relocating the string pool
+    // copies only the pages it occupies. Returns the base and the size.
+    auto map_file(std::filesystem::path const& path) -> bu::Pair<std::byte*, bu::Usize> {
+#ifdef _WIN32
+        HANDLE const file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            throw bu::exception("Could not open '{}'", path.string());
+        }
+
+        LARGE_INTEGER size = 0;
+        HANDLE mapping = nullptr;
+        void*  base    = nullptr;
+
+        if (GetFileSizeEx(file, &size) && size != 0) {
+            mapping = CreateFileMappingW(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+        }
+        if (mapping) {
+            base = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+            CloseHandle(mapping);
+        }
+        CloseHandle(file);
+
+        if (!base) {
+            throw bu::exception("Could not map '{}'", path.string());
+        }
+        return { static_cast<std::byte*>(base), static_cast<bu::Usize>(size) };
+#else
+        int const file = open(path.c_str(), O_RDONLY);
+        if (file == -1) {
+            throw bu::exception("Could not open '{}'", path.string());
+        }
+
+        struct stat status {};
+        void* base = MAP_FAILED;
+
+        if (fstat(file, &status) == 0 && status.st_size != 0) {
+            base = mmap(nullptr, static_cast<bu::Usize>(status.st_size), PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+        }
+        close(file);
+
+        if (base == MAP_FAILED) {
+            throw bu::exception("Could not map '{}'", path.string());
+        }
+        return { static_cast<std::byte*>(base), static_cast<bu::Usize>(status.st_size) };
+#endif
+    }
+
+    auto unmap_file(std::byte* const base, [[maybe_unused]] bu::Usize const size) noexcept -> void {
+#ifdef _WIN32
+        UnmapViewOfFile(base);
+#else
+        munmap(base, size);
+#endif
+    }
+
+}
+
+
+auto vm::Mapped_program::map(std::filesystem::path const& path) -> Mapped_program {
+    Mapped_program program;
+    auto const [base, size] = map_file(path);
+    program.base = base;
+    program.size = size;
+
+    auto const invalid = [&](std::string_view const reason) {
+        return bu::exception("'{}' is not a valid mapped program: {}", path.string(), reason);
+    };
+
+    bu::Usize cursor = 0;
+    auto const read = [&]<class T>(bu::Type<T>) -> T {
+        if (program.size - cursor < sizeof(T)) {
+            throw invalid("the header is truncated");
+        }
+        T value;
+        std::memcpy(&value, program.base + cursor, sizeof value);
+        cursor += sizeof value;
+        return value;
+    };
+
+    if (read(bu::type<std::remove_const_t<decltype(magic)>>) != magic) {
+        throw invalid("the magic number does not match");
+    }
+    if (auto const version = read(bu::type<bu::Usize>); version != language::version) {
+        throw bu::exception(
+            "Attempted to map a program compiled with vmt22a version {}, but the current version is {}",
+            version,
+            language::version
+        );
+    }
+
+    program.capacity = read(bu::type<bu::Usize>);
+
+    auto const string_pool_offset = read(bu::type<bu::Usize>);
+    auto const string_count       = read(bu::type<bu::Usize>);
+    auto const bytecode_offset    = read(bu::type<bu::Usize>);
+    auto const bytecode_size      = read(bu::type<bu::Usize>);
+    auto const debug_table_size   = read(bu::type<bu::Usize>);
+
+    if (string_pool_offset % alignof(Constants::String) != 0
+        || string_pool_offset > program.size
+        || string_count > (program.size - string_pool_offset) / sizeof(Constants::String)
+        || bytecode_offset != string_pool_offset + string_count * sizeof(Constants::String)
+        || debug_table_size > program.size - bytecode_offset
+        || bytecode_size != program.size - bytecode_offset - debug_table_size)
+    {
+        throw invalid("the sections do not match the size of the file");
+    }
+
+    // Turn the offsets stored in the string pool into pointers into the mapping
+    auto const pool = reinterpret_cast<Constants::String*>(program.base + string_pool_offset);
+    for (bu::Usize i = 0; i != string_count; ++i) {
+        auto const offset = reinterpret_cast<bu::Usize>(pool[i].pointer);
+        if (offset > string_pool_offset || pool[i].length > string_pool_offset - offset) {
+            throw invalid("a string constant is out of bounds");
+        }
+        pool[i].pointer = reinterpret_cast<char const*>(program.base + offset);
+    }
+
+    program.strings  = { pool, string_count };
+    program.bytecode = { program.base + bytecode_offset, bytecode_size };
+    program.table    = Debug_table::view({ program.base + bytecode_offset + bytecode_size, debug_table_size });
+    return program;
+}
+
+
+vm::Mapped_program::Mapped_program(Mapped_program&& other) noexcept
+    : base     { std::exchange(other.base, nullptr) }
+    , size     { std::exchange(other.size, 0) }
+    , bytecode { std::exchange(other.bytecode, {}) }
+    , strings  { std::exchange(other.strings, {}) }
+    , table    { std::exchange(other.table, {}) }
+    , capacity { other.capacity } {}
+
+auto vm::Mapped_program::operator=(Mapped_program&& other) noexcept -> Mapped_program& {
+    if (this != &other) {
+        if (base) {
+            unmap_file(base, size);
+        }
+        base     = std::exchange(other.base, nullptr);
+        size     = std::exchange(other.size, 0);
+        bytecode = std::exchange(other.bytecode, {});
+        strings  = std::exchange(other.strings, {});
+        table    = std::exchange(other.table, {});
+        capacity = other.capacity;
+    }
+    return *this;
+}
+
+vm::Mapped_program::~Mapped_program() {
+    if (base) {
+        unmap_file(base, size);
+    }
+}
\ No newline at end of file
@@ -8,13 +8,17 @@ namespace vm {
     enum class Opcode : bu::U8 {
         ipush , fpush , cpush , spush , push_true, push_false,
         idup  , fdup  , cdup  , sdup  , bdup  ,
-        iprint, fprint, cprint, sprint, bprint,
+        iprint, fprint, cprint, sprint, bprint, flush,
 
         iadd, fadd,
         isub, fsub,
         imul, fmul,
         idiv, fdiv,
 
+        // Like iadd, isub, and imul, except that instead of wrapping around on
+        // overflow, they throw a vm::Trap that names the instruction's offset
+        iadd_checked, isub_checked, imul_checked,
+
         iinc_top,
 
         ieq , feq , ceq , beq ,
@@ -39,14 +43,56 @@ namespace vm {
         cast_ftob,
         cast_ctob,
 
+        // Integers narrower than 64 bits are kept on the stack as 64-bit integers within the
+        // range of their type, so the 64-bit arithmetic and comparisons apply to them. Only
+        // u64 needs its own division and comparisons. ext_* wraps a 64-bit result into the
+        // range of a type by extending its low bits. load_* pops a pointer, and pushes the
+        // extended integer it points to. store_* pops a pointer and an integer, and stores
+        // the low bits of the integer, so narrow integers take only their width in memory.
+        ext_i8 , ext_i16 , ext_i32 , ext_u8 , ext_u16 , ext_u32 ,
+        load_i8, load_i16, load_i32, load_u8, load_u16, load_u32,
+        store_8, store_16, store_32,
+        udiv, ult, ulte, ugt, ugte,
+
         bitcopy_from_stack,
         bitcopy_to_stack,
         push_address,
         push_return_value_address,
 
-        jump,       local_jump,
-        jump_true,  local_jump_true,
-        jump_false, local_jump_false,
+        // Allocation from the heap of the fiber. alloc pops a size in bytes and pushes
+        // a pointer to that many bytes, which stay valid until the innermost region
+        // that was entered before the allocation is exited.
+        alloc, region_enter, region_exit,
+
+        // Pops a size in bytes, and pushes a pointer to a new garbage collected object
+        // with that much payload, the first n words of which are the pointer fields,
+        // where n is the argument. May collect garbage first, see vm::Stack_maps.
+        alloc_object,
+
+        // Operations on arrays of n elements, where n is popped first. The element-wise
+        // operations then pop pointers to the right operand, the left operand, and the
+        // destination, which may overlap either operand exactly. Comparisons write a bool
+        // per element. The reductions pop a pointer to the array, and push the result.
+        ivec_add, fvec_add, ivec_mul, fvec_mul,
+        ivec_eq , fvec_eq , ivec_lt , fvec_lt ,
+        ivec_sum, fvec_sum, ivec_min, fvec_min, ivec_max, fvec_max,
+
+        // Access elements of a slice, which is a pointer followed by a length. Each pops an
+        // index and a slice. index_load then pushes the element, whose size is the argument,
+        // and index_store pops the element to store. The checked forms abort on an index out
+        // of bounds. check_bounds pops a length and an end, and aborts unless the range of
+        // indices [0, end) is within the length, which lets one check before a loop cover
+        // the accesses in it. See vm::eliminate_bounds_checks.
+        index_load, index_store, index_load_unchecked, index_store_unchecked, check_bounds,
+
+        // Copies between the stack and the frame of the current function. The sized forms
+        // copy 1, 8, or 16 bytes, and the short forms take an unsigned 8-bit frame offset.
+        load_local , load_local_1 , load_local_8 , load_local_16 , load_local_1_short , load_local_8_short , load_local_16_short ,
+        store_local, store_local_1, store_local_8, store_local_16, store_local_1_short, store_local_8_short, store_local_16_short,
+
+        jump,       local_jump,       local_jump_8,       local_jump_32,
+        jump_true,  local_jump_true,  local_jump_true_8,  local_jump_true_32,
+        jump_false, local_jump_false, local_jump_false_8, local_jump_false_32,
 
         local_jump_ieq_i , local_jump_feq_i , local_jump_ceq_i , local_jump_beq_i ,
         local_jump_ineq_i, local_jump_fneq_i, local_jump_cneq_i, local_jump_bneq_i,
@@ -55,8 +101,15 @@ namespace vm {
         local_jump_igt_i , local_jump_fgt_i ,
         local_jump_igte_i, local_jump_fgte_i,
 
-        call, call_0, ret,
+        call, call_0, call_32, call_0_32, tail_call, ret,
 
+        // Superinstructions, produced only by vm::fuse_superinstructions
+        ipush_iadd, ipush_isub, ipush_imul, ipush_idiv,
+        idup_local_jump_ieq_i , idup_local_jump_ineq_i,
+        idup_local_jump_ilt_i , idup_local_jump_ilte_i,
+        idup_local_jump_igt_i , idup_local_jump_igte_i,
+
+        yield, // Suspends the current fiber, which continues at the next instruction when resumed
         halt,
 
         _opcode_count
@@ -64,4 +117,12 @@ namespace vm {
 
     auto argument_bytes(Opcode) noexcept -> bu::Usize;
 
+    constexpr auto is_call(Opcode const opcode) noexcept -> bool {
+        return opcode == Opcode::call
+            || opcode == Opcode::call_0
+            || opcode == Opcode::call_32
+            || opcode == Opcode::call_0_32
+            || opcode == Opcode::tail_call;
+    }
+
 }
\ No newline at end of file
@@ -0,0 +1,53 @@
+#include "bu/utilities.hpp"
+#include "output.hpp"
+
+#include <cerrno>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+
+namespace {
+
+    // Returns the number of bytes written, or a negative number on failure
+    auto write_some(int const file_descriptor, char const* const data, bu::Usize const size) noexcept -> bu::Isize {
+#ifdef _WIN32
+        auto const chunk = static_cast<unsigned>(std::min<bu::Usize>(size, std::numeric_limits<int>::max()));
+        return _write(file_descriptor, data, chunk);
+#else
+        return ::write(file_descriptor, data, size);
+#endif
+    }
+
+}
+
+
+auto vm::Output_buffer::flush() -> void {
+    if (buffer.empty() || policy == Flush_policy::capture) {
+        return;
+    }
+
+    // Output written through std::cout or stdio must not be overtaken
+    std::cout.flush();
+    std::fflush(stdout);
+
+    char const* data      = buffer.data();
+    bu::Usize   remaining = buffer.size();
+
+    while (remaining != 0) {
+        auto const written = write_some(file_descriptor, data, remaining);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            bu::abort(std::format("could not write to file descriptor {}", file_descriptor));
+        }
+        data      += written;
+        remaining -= static_cast<bu::Usize>(written);
+    }
+
+    buffer.clear();
+}
\ No newline at end of file
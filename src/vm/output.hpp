@@ -0,0 +1,92 @@
+#pragma once
+
+#include "bu/utilities.hpp"
+
+
+namespace vm {
+
+    enum class Flush_policy {
+        size_threshold, // Flush once the buffer holds at least flush_threshold bytes
+        newline,        // Flush after every print that writes a newline
+        explicit_flush, // Flush only on the flush opcode and when the program halts
+        capture,        // Never flush, and let the owner collect the output with take()
+    };
+
+
+    // Collects the output of the print opcodes, and writes it directly to a file
+    // descriptor according to the flush policy. Numbers are formatted with
+    // std::to_chars, which avoids the overhead of std::format on every print.
+    class [[nodiscard]] Output_buffer {
+        std::string buffer;
+
+        ALWAYS_INLINE auto after_print(bool const wrote_newline) -> void {
+            switch (policy) {
+            case Flush_policy::size_threshold:
+                if (buffer.size() >= flush_threshold) {
+                    flush();
+                }
+                break;
+            case Flush_policy::newline:
+                if (wrote_newline) {
+                    flush();
+                }
+                break;
+            default:
+                break;
+            }
+        }
+
+        template <class T>
+        ALWAYS_INLINE auto append_number(T const value) -> void {
+            std::array<char, 32> characters; // Enough for any bu::Isize and the shortest form of any bu::Float
+            auto const [end, error] = std::to_chars(characters.data(), characters.data() + characters.size(), value);
+            assert(error == std::errc {});
+            buffer.append(characters.data(), end);
+        }
+    public:
+        Flush_policy policy          = Flush_policy::size_threshold;
+        bu::Usize    flush_threshold = 1 << 16;
+        int          file_descriptor = 1; // Standard output
+
+        // Each of these prints the value followed by a newline, like the print opcodes
+        auto print(bu::Isize const value) -> void {
+            append_number(value);
+            buffer.push_back('\n');
+            after_print(true);
+        }
+        auto print(bu::Float const value) -> void {
+            append_number(value);
+            buffer.push_back('\n');
+            after_print(true);
+        }
+        auto print(bu::Char const value) -> void {
+            buffer.push_back(value);
+            buffer.push_back('\n');
+            after_print(true);
+        }
+        auto print(bool const value) -> void {
+            buffer.append(value ? "true\n" : "false\n");
+            after_print(true);
+        }
+
+        // Prints the string as is, without a newline
+        auto print(std::string_view const string) -> void {
+            buffer.append(string);
+            after_print(string.find('\n') != std::string_view::npos);
+        }
+
+        // Writes the buffered output to the file descriptor, and empties the buffer
+        auto flush() -> void;
+
+        // The output that has not been flushed yet
+        auto buffered() const noexcept -> std::string_view {
+            return buffer;
+        }
+
+        // Empties the buffer without writing it, and returns what it held
+        auto take() noexcept -> std::string {
+            return std::exchange(buffer, {});
+        }
+    };
+
+}
\ No newline at end of file
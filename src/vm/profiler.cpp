@@ -0,0 +1,203 @@
+#include "bu/utilities.hpp"
+#include "profiler.hpp"
+#include "vm_formatting.hpp"
+
+
+namespace {
+
+    constexpr bu::Usize opcode_count      = vm::Opcode_profile::opcode_count;
+    constexpr bu::Usize shown_pair_count  = 30;
+    constexpr bu::Usize shown_frame_count = 30;
+
+
+    struct Opcode_entry {
+        vm::Opcode opcode;
+        bu::U64    executions;
+        bu::U64    cycles;
+
+        auto cycles_per_execution() const noexcept -> double {
+            return static_cast<double>(cycles) / static_cast<double>(executions);
+        }
+    };
+
+    struct Pair_entry {
+        vm::Opcode first;
+        vm::Opcode second;
+        bu::U64    executions;
+    };
+
+
+    auto sorted_opcodes(vm::Opcode_profile const& profile) -> std::vector<Opcode_entry> {
+        std::vector<Opcode_entry> entries;
+        for (bu::Usize i = 0; i != profile.executions.size(); ++i) {
+            if (profile.executions[i] != 0) {
+                entries.push_back({ static_cast<vm::Opcode>(i), profile.executions[i], profile.cycles[i] });
+            }
+        }
+        std::ranges::stable_sort(entries, std::greater {}, &Opcode_entry::executions);
+        return entries;
+    }
+
+    auto sorted_pairs(vm::Opcode_profile const& profile) -> std::vector<Pair_entry> {
+        std::vector<Pair_entry> entries;
+        for (bu::Usize i = 0; i != profile.pair_executions.size(); ++i) {
+            if (profile.pair_executions[i] != 0) {
+                entries.push_back({
+                    .first      = static_cast<vm::Opcode>(i / opcode_count),
+                    .second     = static_cast<vm::Opcode>(i % opcode_count),
+                    .executions = profile.pair_executions[i],
+                });
+            }
+        }
+        std::ranges::stable_sort(entries, std::greater {}, &Pair_entry::executions);
+        return entries;
+    }
+
+    auto percentage(bu::U64 const part, bu::U64 const total) noexcept -> double {
+        return total == 0 ? 0.0 : 100.0 * static_cast<double>(part) / static_cast<double>(total);
+    }
+
+}
+
+
+auto vm::Opcode_profile::reset() -> void {
+    executions.assign(opcode_count, 0);
+    cycles.assign(opcode_count, 0);
+    pair_executions.assign(opcode_count * opcode_count, 0);
+}
+
+
+auto vm::Opcode_profile::print_report() const -> void {
+    auto const total_executions = std::reduce(executions.begin(), executions.end(), bu::U64 {});
+    auto const total_cycles     = std::reduce(cycles.begin(), cycles.end(), bu::U64 {});
+
+    bu::print(
+        "{:<24} {:>14} {:>7} {:>16} {:>7} {:>12}\n",
+        "opcode", "executions", "%", "cycles", "%", "cycles/exec"
+    );
+    for (Opcode_entry const& entry : sorted_opcodes(*this)) {
+        bu::print(
+            "{:<24} {:>14} {:>6.2f}% {:>16} {:>6.2f}% {:>12.1f}\n",
+            entry.opcode,
+            entry.executions,
+            percentage(entry.executions, total_executions),
+            entry.cycles,
+            percentage(entry.cycles, total_cycles),
+            entry.cycles_per_execution()
+        );
+    }
+
+    bu::print("\nThe most common opcode pairs:\n");
+    for (auto const [first, second, pair_count] : sorted_pairs(*this) | std::views::take(shown_pair_count)) {
+        bu::print(
+            "{:>14} {:>6.2f}% {} {}\n",
+            pair_count,
+            percentage(pair_count, total_executions),
+            first,
+            second
+        );
+    }
+}
+
+
+auto vm::Opcode_profile::to_json() const -> std::string {
+    std::string json = "{\n  \"opcodes\": [";
+
+    auto const opcodes = sorted_opcodes(*this);
+    for (bu::Usize i = 0; i != opcodes.size(); ++i) {
+        std::format_to(
+            std::back_inserter(json),
+            "{}\n    {{ \"name\": \"{}\", \"executions\": {}, \"cycles\": {} }}",
+            i == 0 ? "" : ",",
+            opcodes[i].opcode,
+            opcodes[i].executions,
+            opcodes[i].cycles
+        );
+    }
+
+    json += "\n  ],\n  \"pairs\": [";
+
+    auto const pairs = sorted_pairs(*this);
+    for (bu::Usize i = 0; i != pairs.size(); ++i) {
+        std::format_to(
+            std::back_inserter(json),
+            "{}\n    {{ \"first\": \"{}\", \"second\": \"{}\", \"executions\": {} }}",
+            i == 0 ? "" : ",",
+            pairs[i].first,
+            pairs[i].second,
+            pairs[i].executions
+        );
+    }
+
+    json += "\n  ]\n}\n";
+    return json;
+}
+
+
+auto vm::Stack_profile::reset(bu::Usize const code_size) -> void {
+    peak_depth      = 0;
+    peak_call_depth = 0;
+    frame_sizes.assign(code_size, 0);
+    active_functions.clear();
+}
+
+
+auto vm::Stack_profile::suggested_capacity() const noexcept -> bu::Usize {
+    constexpr bu::Usize granularity = 64;
+    auto const capacity = peak_depth + peak_depth / 4;
+    return (capacity + granularity - 1) / granularity * granularity;
+}
+
+
+auto vm::Stack_profile::print_report() const -> void {
+    bu::print(
+        "peak stack depth:         {} bytes\n"
+        "deepest call chain:       {} calls\n"
+        "suggested stack capacity: {} bytes\n",
+        peak_depth,
+        peak_call_depth,
+        suggested_capacity()
+    );
+
+    std::vector<bu::Pair<bu::Usize>> frames; // Function offsets paired with frame sizes
+    for (bu::Usize offset = 0; offset != frame_sizes.size(); ++offset) {
+        if (frame_sizes[offset] != 0) {
+            frames.emplace_back(offset, frame_sizes[offset]);
+        }
+    }
+    std::ranges::stable_sort(frames, std::greater {}, &bu::Pair<bu::Usize>::second);
+
+    bu::print("\nThe largest frames:\n{:>14} {:>14}\n", "function", "bytes");
+    for (auto const [offset, size] : frames | std::views::take(shown_frame_count)) {
+        bu::print("{:>14} {:>14}\n", offset, size);
+    }
+}
+
+
+auto vm::Collection_profile::print_report() const -> void {
+    if (collections == 0) {
+        bu::print("no garbage collections\n");
+        return;
+    }
+
+    auto const reclaimed = allocated_bytes > surviving_bytes ? allocated_bytes - surviving_bytes : 0;
+    auto const seconds   = static_cast<double>(total_pause) / 1e9;
+
+    bu::print(
+        "garbage collections:      {}\n"
+        "allocated:                {} bytes\n"
+        "survived:                 {} bytes ({:.2f}%)\n"
+        "total pause:              {:.3f} ms\n"
+        "mean pause:               {:.3f} ms\n"
+        "longest pause:            {:.3f} ms\n"
+        "throughput:               {:.1f} MB reclaimed per second of pause\n",
+        collections,
+        allocated_bytes,
+        surviving_bytes,
+        percentage(surviving_bytes, allocated_bytes),
+        static_cast<double>(total_pause) / 1e6,
+        static_cast<double>(total_pause) / 1e6 / static_cast<double>(collections),
+        static_cast<double>(longest_pause) / 1e6,
+        seconds == 0 ? 0.0 : static_cast<double>(reclaimed) / 1e6 / seconds
+    );
+}
\ No newline at end of file
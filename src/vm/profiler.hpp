@@ -0,0 +1,115 @@
+#pragma once
+
+#include "bu/utilities.hpp"
+#include "opcode.hpp"
+
+#include <unordered_map>
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#elif defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+
+namespace vm {
+
+    // The time stamp counter where available, and nanoseconds elsewhere
+    inline auto read_cycle_counter() noexcept -> bu::U64 {
+#if defined(_M_X64) || defined(__x86_64__)
+        return __rdtsc();
+#else
+        return static_cast<bu::U64>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+    }
+
+
+    // Execution and cycle counts per opcode, and execution counts per pair of
+    // consecutively executed opcodes, collected by Dispatch_engine::profiled.
+    // Only the profiled engine records anything, so the others pay nothing for it,
+    // and it only exists in builds that define VMT22A_PROFILING, as the debug builds do.
+    struct Opcode_profile {
+        static constexpr bu::Usize opcode_count = static_cast<bu::Usize>(Opcode::_opcode_count);
+
+        std::vector<bu::U64> executions;      // Indexed by opcode
+        std::vector<bu::U64> cycles;          // Indexed by opcode
+        std::vector<bu::U64> pair_executions; // Indexed by first * opcode_count + second
+
+        // Discards every count, and makes room for a new profile
+        auto reset() -> void;
+
+        ALWAYS_INLINE auto record(Opcode const previous, Opcode const opcode, bu::U64 const elapsed_cycles) noexcept -> void {
+            auto const index = static_cast<bu::Usize>(opcode);
+            ++executions[index];
+            cycles[index] += elapsed_cycles;
+            if (previous != Opcode::_opcode_count) {
+                ++pair_executions[static_cast<bu::Usize>(previous) * opcode_count + index];
+            }
+        }
+
+        // Prints every executed opcode and the most common pairs, from the most to the least frequently executed
+        auto print_report() const -> void;
+
+        // The complete profile as a JSON object with the members "opcodes" and "pairs", both sorted like the report
+        auto to_json() const -> std::string;
+    };
+
+
+    // The stack usage of every fiber run by Dispatch_engine::profiled, from which the
+    // smallest stack capacity that would have sufficed can be read. The frame of a
+    // function spans from its activation record to the top of the stack, so its
+    // arguments and return value count towards the frame of its caller.
+    struct Stack_profile {
+        bu::Usize              peak_depth      = 0; // The most bytes of a stack in use at once
+        bu::Usize              peak_call_depth = 0; // The most activation records on a stack at once
+        std::vector<bu::Usize> frame_sizes;         // The largest frame of each function, indexed by its bytecode offset
+
+        // The functions whose frames are on the stack of each unfinished fiber, keyed by
+        // the bottom of the stack. The first one is the entry point of the fiber.
+        std::unordered_map<std::byte const*, std::vector<bu::Usize>> active_functions;
+
+        // Discards every measurement, and makes room for bytecode of the given size
+        auto reset(bu::Usize code_size) -> void;
+
+        ALWAYS_INLINE auto record(
+            std::vector<bu::Usize> const& functions,
+            bu::Usize              const  depth,
+            bu::Usize              const  frame_size) noexcept -> void
+        {
+            auto& largest   = frame_sizes[functions.back()];
+            largest         = std::max(largest, frame_size);
+            peak_depth      = std::max(peak_depth, depth);
+            peak_call_depth = std::max(peak_call_depth, functions.size() - 1);
+        }
+
+        // The peak depth with a quarter added as headroom, rounded up to a multiple of 64
+        auto suggested_capacity() const noexcept -> bu::Usize;
+
+        // Prints the peaks and the largest frames, from the largest to the smallest
+        auto print_report() const -> void;
+    };
+
+
+    // The collections of the garbage collected heaps of every fiber. Unlike the other
+    // profiles, this one is recorded by every engine, because collections are rare,
+    // and recording one costs nothing next to the collection itself.
+    struct Collection_profile {
+        bu::U64 collections     = 0;
+        bu::U64 allocated_bytes = 0; // Allocated before each collection, so allocations since the last one are not counted
+        bu::U64 surviving_bytes = 0; // Copied by collections
+        bu::U64 total_pause     = 0; // In nanoseconds
+        bu::U64 longest_pause   = 0; // In nanoseconds
+
+        auto record(bu::U64 const allocated, bu::U64 const surviving, bu::U64 const pause) noexcept -> void {
+            ++collections;
+            allocated_bytes += allocated;
+            surviving_bytes += surviving;
+            total_pause     += pause;
+            longest_pause    = std::max(longest_pause, pause);
+        }
+
+        // Prints the pause times, and the throughput as the bytes reclaimed per second of pause
+        auto print_report() const -> void;
+    };
+
+}
\ No newline at end of file
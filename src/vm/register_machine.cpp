@@ -0,0 +1,228 @@
+#include "bu/utilities.hpp"
+#include "bu/safe_integer.hpp"
+#include "register_machine.hpp"
+
+
+namespace {
+
+    // The number of registers a single frame can address
+    constexpr bu::Usize frame_size = std::numeric_limits<vm::Register_index>::max() + 1;
+
+
+    template <bu::trivial T>
+    ALWAYS_INLINE auto extract(std::byte*& pointer) noexcept -> T {
+        T argument;
+        std::memcpy(&argument, pointer, sizeof(T));
+        pointer += sizeof(T);
+        return argument;
+    }
+
+    template <class T>
+    ALWAYS_INLINE auto load(bu::Isize const* const frame, vm::Register_index const index) noexcept -> T {
+        if constexpr (std::same_as<T, bu::Float>) {
+            return std::bit_cast<bu::Float>(frame[index]);
+        }
+        else {
+            return frame[index];
+        }
+    }
+
+    template <class T>
+    ALWAYS_INLINE auto store(bu::Isize* const frame, vm::Register_index const index, T const value) noexcept -> void {
+        if constexpr (std::same_as<T, bu::Float>) {
+            frame[index] = std::bit_cast<bu::Isize>(value);
+        }
+        else {
+            frame[index] = static_cast<bu::Isize>(value);
+        }
+    }
+
+
+    template <class T, template <class> class F>
+    ALWAYS_INLINE auto binary_op(std::byte*& ip, bu::Isize* const frame) noexcept -> void {
+        auto const destination = extract<vm::Register_index>(ip);
+        auto const left        = load<T>(frame, extract<vm::Register_index>(ip));
+        auto const right       = load<T>(frame, extract<vm::Register_index>(ip));
+        store(frame, destination, F<T>{}(left, right));
+    }
+
+    template <class T, template <class> class F>
+    ALWAYS_INLINE auto immediate_binary_op(std::byte*& ip, bu::Isize* const frame) noexcept -> void {
+        auto const destination = extract<vm::Register_index>(ip);
+        auto const left        = load<T>(frame, extract<vm::Register_index>(ip));
+        auto const right       = extract<T>(ip);
+        store(frame, destination, F<T>{}(left, right));
+    }
+
+    template <bool value>
+    ALWAYS_INLINE auto jump_bool(std::byte*& ip, bu::Isize const* const frame) noexcept -> void {
+        auto const condition = load<bu::Isize>(frame, extract<vm::Register_index>(ip));
+        auto const offset    = extract<vm::Local_offset_type>(ip);
+        if ((condition != 0) == value) {
+            ip += offset;
+        }
+    }
+
+    template <template <class> class F>
+    ALWAYS_INLINE auto compare_jump(std::byte*& ip, bu::Isize const* const frame) noexcept -> void {
+        auto const left   = load<bu::Isize>(frame, extract<vm::Register_index>(ip));
+        auto const right  = load<bu::Isize>(frame, extract<vm::Register_index>(ip));
+        auto const offset = extract<vm::Local_offset_type>(ip);
+        if (F<bu::Isize>{}(left, right)) {
+            ip += offset;
+        }
+    }
+
+}
+
+
+auto vm::Register_machine::run() -> int {
+    if (registers.size() < frame_size) {
+        bu::abort(std::format("a register machine needs at least {} registers", frame_size));
+    }
+
+    std::byte* const anchor      = bytecode.bytes.data();
+    std::byte*       ip          = anchor;
+    bu::Isize*       frame       = registers.data();
+    bu::Isize* const frame_limit = registers.data() + (registers.size() - frame_size);
+
+    frames.clear();
+
+    for (;;) {
+        switch (extract<Register_opcode>(ip)) {
+        case Register_opcode::imove:
+        {
+            auto const destination = extract<Register_index>(ip);
+            store(frame, destination, extract<bu::Isize>(ip));
+            break;
+        }
+        case Register_opcode::fmove:
+        {
+            auto const destination = extract<Register_index>(ip);
+            store(frame, destination, extract<bu::Float>(ip));
+            break;
+        }
+        case Register_opcode::move:
+        {
+            auto const destination = extract<Register_index>(ip);
+            frame[destination] = frame[extract<Register_index>(ip)];
+            break;
+        }
+
+        case Register_opcode::iadd: binary_op<bu::Isize, bu::wrapping_plus      >(ip, frame); break;
+        case Register_opcode::fadd: binary_op<bu::Float, std::plus              >(ip, frame); break;
+        case Register_opcode::isub: binary_op<bu::Isize, bu::wrapping_minus     >(ip, frame); break;
+        case Register_opcode::fsub: binary_op<bu::Float, std::minus             >(ip, frame); break;
+        case Register_opcode::imul: binary_op<bu::Isize, bu::wrapping_multiplies>(ip, frame); break;
+        case Register_opcode::fmul: binary_op<bu::Float, std::multiplies        >(ip, frame); break;
+        case Register_opcode::idiv: binary_op<bu::Isize, std::divides           >(ip, frame); break;
+        case Register_opcode::fdiv: binary_op<bu::Float, std::divides           >(ip, frame); break;
+
+        case Register_opcode::iadd_i: immediate_binary_op<bu::Isize, bu::wrapping_plus      >(ip, frame); break;
+        case Register_opcode::isub_i: immediate_binary_op<bu::Isize, bu::wrapping_minus     >(ip, frame); break;
+        case Register_opcode::imul_i: immediate_binary_op<bu::Isize, bu::wrapping_multiplies>(ip, frame); break;
+
+        case Register_opcode::ieq : binary_op<bu::Isize, std::equal_to    >(ip, frame); break;
+        case Register_opcode::feq : binary_op<bu::Float, std::equal_to    >(ip, frame); break;
+        case Register_opcode::ineq: binary_op<bu::Isize, std::not_equal_to>(ip, frame); break;
+        case Register_opcode::fneq: binary_op<bu::Float, std::not_equal_to>(ip, frame); break;
+        case Register_opcode::ilt : binary_op<bu::Isize, std::less        >(ip, frame); break;
+        case Register_opcode::flt : binary_op<bu::Float, std::less        >(ip, frame); break;
+        case Register_opcode::ilte: binary_op<bu::Isize, std::less_equal  >(ip, frame); break;
+        case Register_opcode::flte: binary_op<bu::Float, std::less_equal  >(ip, frame); break;
+
+        case Register_opcode::jump:
+        {
+            auto const offset = extract<Local_offset_type>(ip);
+            ip += offset;
+            break;
+        }
+        case Register_opcode::jump_true:  jump_bool<true >(ip, frame); break;
+        case Register_opcode::jump_false: jump_bool<false>(ip, frame); break;
+
+        case Register_opcode::jump_ieq : compare_jump<std::equal_to    >(ip, frame); break;
+        case Register_opcode::jump_ineq: compare_jump<std::not_equal_to>(ip, frame); break;
+        case Register_opcode::jump_ilt : compare_jump<std::less        >(ip, frame); break;
+        case Register_opcode::jump_ilte: compare_jump<std::less_equal  >(ip, frame); break;
+
+        case Register_opcode::iprint:
+            output.print(load<bu::Isize>(frame, extract<Register_index>(ip)));
+            break;
+        case Register_opcode::fprint:
+            output.print(load<bu::Float>(frame, extract<Register_index>(ip)));
+            break;
+
+        case Register_opcode::call:
+        {
+            auto const base   = extract<Register_index>(ip);
+            auto const target = extract<Jump_offset_type>(ip);
+
+            if (frame + base > frame_limit) [[unlikely]] {
+                bu::abort("register file overflow");
+            }
+
+            frames.push_back({ .registers = frame, .return_address = ip });
+            frame += base;
+            ip     = anchor + target;
+            break;
+        }
+        case Register_opcode::ret:
+        {
+            if (frames.empty()) [[unlikely]] {
+                bu::abort(std::format("ret outside of any function at offset {}", std::distance(anchor, ip - 1)));
+            }
+            auto const [caller, return_address] = frames.back();
+            frames.pop_back();
+            frame = caller;
+            ip    = return_address;
+            break;
+        }
+
+        case Register_opcode::halt:
+        {
+            auto const exit_code = load<bu::Isize>(frame, extract<Register_index>(ip));
+            output.flush();
+            return static_cast<int>(exit_code);
+        }
+
+        default:
+            bu::abort(
+                std::format(
+                    "invalid register opcode {} at offset {}",
+                    static_cast<bu::U8>(ip[-1]),
+                    std::distance(anchor, ip - 1)
+                )
+            );
+        }
+    }
+}
+
+
+
+auto vm::argument_bytes(Register_opcode const opcode) noexcept -> bu::Usize {
+    constexpr auto r = sizeof(Register_index);
+
+    static constexpr auto bytecounts = std::to_array<bu::Usize>({
+        r + sizeof(bu::Isize), r + sizeof(bu::Float), 2 * r, // move
+
+        3 * r, 3 * r, 3 * r, 3 * r,                                 // add, sub
+        3 * r, 3 * r, 3 * r, 3 * r,                                 // mul, div
+        2 * r + sizeof(bu::Isize), 2 * r + sizeof(bu::Isize), 2 * r + sizeof(bu::Isize), // immediate
+
+        3 * r, 3 * r, 3 * r, 3 * r, // eq, neq
+        3 * r, 3 * r, 3 * r, 3 * r, // lt, lte
+
+        sizeof(Local_offset_type),                                          // jump
+        r + sizeof(Local_offset_type), r + sizeof(Local_offset_type),       // jump_bool
+        2 * r + sizeof(Local_offset_type), 2 * r + sizeof(Local_offset_type), // jump_eq
+        2 * r + sizeof(Local_offset_type), 2 * r + sizeof(Local_offset_type), // jump_lt
+
+        r, r, // print
+
+        r + sizeof(Jump_offset_type), // call
+        0,                            // ret
+        r,                            // halt
+    });
+    static_assert(bytecounts.size() == static_cast<bu::Usize>(Register_opcode::_opcode_count));
+    return bytecounts[static_cast<bu::Usize>(opcode)];
+}
\ No newline at end of file
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "bu/utilities.hpp"
+#include "bytecode.hpp"
+#include "virtual_machine.hpp"
+#include "output.hpp"
+
+
+namespace vm {
+
+    // A register-based alternative to the stack machine. Every instruction addresses
+    // slots of the current frame directly, so `iadd r1, r2, r3` replaces the push,
+    // push, add, and store sequence the stack machine would need. Each register holds
+    // one bu::Isize or bu::Float, and comparisons store 0 or 1 in their destination.
+
+    using Register_index = bu::U8;
+
+    enum class Register_opcode : bu::U8 {
+        imove, fmove, move,                  // dst, immediate / dst, src
+
+        iadd  , fadd  , isub, fsub,          // dst, left, right
+        imul  , fmul  , idiv, fdiv,
+        iadd_i, isub_i, imul_i,              // dst, left, immediate
+
+        ieq , feq , ineq, fneq,              // dst, left, right
+        ilt , flt , ilte, flte,
+
+        jump,                                // offset
+        jump_true, jump_false,               // condition, offset
+        jump_ieq , jump_ineq,                // left, right, offset
+        jump_ilt , jump_ilte,
+
+        iprint, fprint,                      // src
+
+        call,                                // base, target
+        ret,
+        halt,                                // src
+
+        _opcode_count
+    };
+
+    auto argument_bytes(Register_opcode) noexcept -> bu::Usize;
+
+
+    // Distinct from Bytecode so that the two instruction sets are never mixed up
+    struct Register_bytecode : Bytecode {};
+
+
+    struct [[nodiscard]] Register_machine {
+        // The frame of a call begins at the register `base` of the caller's frame,
+        // so arguments are passed by writing them to the registers from `base`
+        // onwards, and the callee leaves its result in its own register 0.
+        struct Frame {
+            bu::Isize* registers;
+            std::byte* return_address;
+        };
+
+        Register_bytecode      bytecode;
+        std::vector<bu::Isize> registers = std::vector<bu::Isize>(1024);
+        std::vector<Frame>     frames;
+        Output_buffer          output;
+
+        auto run() -> int;
+    };
+
+}
\ No newline at end of file
@@ -0,0 +1,39 @@
+#include "bu/utilities.hpp"
+#include "scheduler.hpp"
+
+
+auto vm::Scheduler::spawn(Jump_offset_type const entry) -> Fiber_id {
+    fibers.push_back(machine.spawn(entry));
+    return { fibers.size() - 1 };
+}
+
+
+auto vm::Scheduler::run() -> void {
+    std::vector<bu::Usize> ready;
+    std::vector<bu::Usize> still_ready;
+
+    for (bu::Usize i = 0; i != fibers.size(); ++i) {
+        if (!fibers[i].is_finished()) {
+            ready.push_back(i);
+        }
+    }
+
+    // Round robin, in the order in which the fibers were spawned
+    while (!ready.empty()) {
+        for (bu::Usize const index : ready) {
+            machine.resume(fibers[index]);
+            if (!fibers[index].is_finished()) {
+                still_ready.push_back(index);
+            }
+        }
+        std::swap(ready, still_ready);
+        still_ready.clear();
+    }
+}
+
+
+auto vm::Scheduler::exit_code(Fiber_id const id) const -> int {
+    Fiber const& fiber = fibers.at(id.index);
+    bu::always_assert(fiber.is_finished());
+    return *fiber.exit_code;
+}
\ No newline at end of file
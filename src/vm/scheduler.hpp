@@ -0,0 +1,41 @@
+#pragma once
+
+#include "bu/utilities.hpp"
+#include "virtual_machine.hpp"
+
+
+namespace vm {
+
+    // Multiplexes many fibers of one program on the calling thread. Each fiber runs
+    // until it executes yield or halt, or runs out of the budget of the machine,
+    // after which the next ready fiber is resumed, so a switch costs no more than
+    // writing back and reloading the registers of the engine. The fibers share the
+    // program, its constants, the output buffer, and the compiled code of the
+    // machine, and each one owns only its stack and its heaps.
+    class [[nodiscard]] Scheduler {
+    public:
+        struct Fiber_id {
+            bu::Usize index;
+        };
+    private:
+        Virtual_machine&   machine;
+        std::vector<Fiber> fibers;
+    public:
+        explicit Scheduler(Virtual_machine& machine) noexcept
+            : machine { machine } {}
+
+        // Adds a fiber that starts at the given offset in the bytecode
+        auto spawn(Jump_offset_type entry = 0) -> Fiber_id;
+
+        // Resumes the unfinished fibers in turn until every one of them has halted
+        auto run() -> void;
+
+        // The exit code of a fiber that has halted
+        auto exit_code(Fiber_id) const -> int;
+
+        auto fiber_count() const noexcept -> bu::Usize {
+            return fibers.size();
+        }
+    };
+
+}
\ No newline at end of file
@@ -31,6 +31,69 @@ auto vm::Executable_program::serialize() const -> std::vector<std::byte> {
         buffer.insert(buffer.end(), bytecode.bytes.begin(), bytecode.bytes.end());
     }
 
+    {
+        write(stack_maps.span().size());
+        for (auto const& [offset, slots] : stack_maps.span()) {
+            write(offset, slots.size());
+            for (Local_offset_type const slot : slots) {
+                write(slot);
+            }
+        }
+    }
+
+    {
+        auto const table = debug_table.serialized();
+        write(table.size());
+        buffer.insert(buffer.end(), table.begin(), table.end());
+    }
+
+    return buffer;
+}
+
+
+auto vm::Executable_program::serialize_for_mapping() const -> std::vector<std::byte> {
+    static_assert(sizeof(Constants::String) == 2 * sizeof(bu::Usize));
+
+    if (!stack_maps.span().empty()) {
+        throw bu::exception("A program with stack maps can not be serialized for mapping");
+    }
+
+    std::vector<std::byte> buffer;
+
+    auto const write = [&](bu::trivial auto const... args) {
+        bu::serialize_to(std::back_inserter(buffer), args...);
+    };
+
+    // The header: the magic, the version, the stack capacity, the offset and length
+    // of the string pool, the offset and size of the bytecode, and the size of the
+    // debug table, which follows the bytecode
+    constexpr bu::Usize header_size = sizeof Mapped_program::magic + 7 * sizeof(bu::Usize);
+    constexpr bu::Usize alignment   = alignof(Constants::String);
+
+    auto const string_pool_offset = (header_size + constants.string_buffer.size() + alignment - 1) / alignment * alignment;
+    auto const string_count       = constants.string_buffer_views.size();
+    auto const bytecode_offset    = string_pool_offset + string_count * sizeof(Constants::String);
+
+    write(Mapped_program::magic, language::version, stack_capacity);
+    auto const table = debug_table.serialized();
+
+    write(string_pool_offset, string_count, bytecode_offset, bytecode.bytes.size(), table.size());
+
+    buffer.insert(
+        buffer.end(),
+        reinterpret_cast<std::byte const*>(constants.string_buffer.data()),
+        reinterpret_cast<std::byte const*>(constants.string_buffer.data() + constants.string_buffer.size())
+    );
+    buffer.resize(string_pool_offset);
+
+    // Each string is stored as a Constants::String whose pointer holds the
+    // offset of the string from the start of the file until it is relocated
+    for (auto const [offset, length] : constants.string_buffer_views) {
+        write(header_size + offset, length);
+    }
+
+    buffer.insert(buffer.end(), bytecode.bytes.begin(), bytecode.bytes.end());
+    buffer.insert(buffer.end(), table.begin(), table.end());
     return buffer;
 }
 
@@ -41,7 +104,7 @@ namespace {
 
     template <bu::trivial T>
     auto extract(Byte_span& span) -> T {
-        assert(span.size() >= sizeof(T));
+        bu::always_assert(span.size() >= sizeof(T));
 
         T value;
         std::memcpy(&value, span.data(), sizeof(T));
@@ -84,10 +147,33 @@ auto vm::Executable_program::deserialize(Byte_span bytes) -> Executable_program
 
     {
         auto const bytecode_size = extract<bu::Usize>(bytes);
-        bu::always_assert(bytecode_size == bytes.size());
+        bu::always_assert(bytecode_size <= bytes.size());
 
         program.bytecode.bytes.assign(bytes.data(), bytes.data() + bytecode_size);
+        bytes = bytes.subspan(bytecode_size);
+    }
+
+    for (auto i = extract<bu::Usize>(bytes); i != 0; --i) {
+        auto const offset     = extract<Jump_offset_type>(bytes);
+        auto const slot_count = extract<bu::Usize>(bytes);
+        bu::always_assert(slot_count <= bytes.size() / sizeof(Local_offset_type));
+
+        std::vector<Local_offset_type> slots(slot_count);
+        for (Local_offset_type& slot : slots) {
+            slot = extract<Local_offset_type>(bytes);
+        }
+        program.stack_maps.add(Jump_offset_type { offset }, std::move(slots));
+    }
+
+    {
+        auto const table_size = extract<bu::Usize>(bytes);
+        bu::always_assert(table_size <= bytes.size());
+
+        // The table is copied as is, and only decoded piece by piece by lookups
+        program.debug_table = Debug_table::deserialize(bytes.first(table_size));
+        bytes = bytes.subspan(table_size);
     }
+    bu::always_assert(bytes.empty());
 
     return program;
 }
\ No newline at end of file
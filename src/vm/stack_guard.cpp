@@ -0,0 +1,147 @@
+#include "bu/utilities.hpp"
+#include "stack_guard.hpp"
+
+#ifndef _WIN32
+#include <mutex>
+#include <csignal>
+#include <csetjmp>
+#endif
+
+
+namespace {
+
+    thread_local vm::Stack_guard* current_guard = nullptr;
+
+#ifndef _WIN32
+
+    enum Fault_kind : int { no_fault, overflow, underflow };
+
+    thread_local sigjmp_buf* current_jump_buffer = nullptr;
+
+    struct sigaction previous_segv_action;
+    struct sigaction previous_bus_action;
+
+    // The stack that is watched on this thread
+    thread_local bu::Bytestack* current_stack = nullptr;
+
+
+    auto handle_fault(int const signal, siginfo_t* const info, void* const context) -> void {
+        if (current_jump_buffer) {
+            auto const address = static_cast<std::byte const*>(info->si_addr);
+            auto const bottom  = current_stack->base();
+            auto const top     = bottom + current_stack->capacity();
+
+            // A growable stack has not yet made this part accessible, so the
+            // faulting instruction succeeds when it is retried after the return
+            if (address >= bottom && address < top && current_stack->commit(address)) {
+                return;
+            }
+            if (address >= top && address < top + bu::Bytestack::guard_size) {
+                siglongjmp(*current_jump_buffer, overflow);
+            }
+            if (address < bottom && address >= bottom - bu::Bytestack::guard_size) {
+                siglongjmp(*current_jump_buffer, underflow);
+            }
+        }
+
+        // The fault is not ours, so it is passed on to the previous handler. This handler
+        // stays installed, because other threads may be in guarded runs, and the faults
+        // of later runs must still be caught.
+        auto const& previous = signal == SIGSEGV ? previous_segv_action : previous_bus_action;
+
+        if (previous.sa_flags & SA_SIGINFO) {
+            previous.sa_sigaction(signal, info, context);
+        }
+        else if (previous.sa_handler != SIG_DFL && previous.sa_handler != SIG_IGN) {
+            previous.sa_handler(signal);
+        }
+        else {
+            // Ignoring the fault would only retry the faulting instruction forever, so either
+            // way the default action ends the process, once this handler returns
+            struct sigaction default_action {};
+            default_action.sa_handler = SIG_DFL;
+            sigemptyset(&default_action.sa_mask);
+            sigaction(signal, &default_action, nullptr);
+            raise(signal);
+        }
+    }
+
+    auto install_fault_handler() -> void {
+        static std::once_flag flag;
+        std::call_once(flag, [] {
+            struct sigaction action {};
+            action.sa_sigaction = handle_fault;
+            action.sa_flags     = SA_SIGINFO;
+            sigemptyset(&action.sa_mask);
+
+            // Some platforms raise SIGBUS instead of SIGSEGV for inaccessible pages
+            if (sigaction(SIGSEGV, &action, &previous_segv_action) != 0
+                || sigaction(SIGBUS, &action, &previous_bus_action) != 0)
+            {
+                bu::abort("could not install the stack fault handler");
+            }
+        });
+    }
+
+#endif
+
+}
+
+
+vm::Stack_fault::Stack_fault(bu::Usize const offset, bool const is_overflow, std::optional<Debug_location> const& location)
+    : bu::Exception { location
+        ? std::format("Stack {} at offset {} ({} {})", is_overflow ? "overflow" : "underflow", offset, location->function, location->position)
+        : std::format("Stack {} at offset {}", is_overflow ? "overflow" : "underflow", offset) }
+    , offset        { offset }
+    , is_overflow   { is_overflow } {}
+
+
+auto vm::Stack_guard::current() noexcept -> Stack_guard* {
+    return current_guard;
+}
+
+
+auto vm::Stack_guard::run_erased(void(* const function)(void*), void* const argument) -> void {
+#ifdef _WIN32
+    current_guard = this;
+    try {
+        function(argument);
+    }
+    catch (...) {
+        current_guard = nullptr;
+        throw;
+    }
+    current_guard = nullptr;
+#else
+    install_fault_handler();
+    bu::always_assert(current_guard == nullptr);
+
+    // What is read after a fault is either thread local or volatile, so the jump loses none of it
+    sigjmp_buf jump_buffer;
+    current_guard       = this;
+    current_stack       = &stack;
+    current_jump_buffer = &jump_buffer;
+
+    auto const uninstall = [] {
+        current_guard       = nullptr;
+        current_stack       = nullptr;
+        current_jump_buffer = nullptr;
+    };
+
+    if (int const fault = sigsetjmp(jump_buffer, 1); fault != no_fault) {
+        uninstall();
+        auto const offset = static_cast<bu::Usize>(instruction - anchor);
+        throw Stack_fault { offset, fault == overflow };
+    }
+
+    // The function may throw, for example when an instruction traps
+    try {
+        function(argument);
+    }
+    catch (...) {
+        uninstall();
+        throw;
+    }
+    uninstall();
+#endif
+}
\ No newline at end of file
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "bu/utilities.hpp"
+#include "bu/bytestack.hpp"
+#include "debug_table.hpp"
+
+
+namespace vm {
+
+    // Thrown by Virtual_machine::resume when a fiber touches a guard of its stack. The
+    // message names the source location of the instruction if the debug table has it.
+    struct [[nodiscard]] Stack_fault : bu::Exception {
+        bu::Usize offset;      // The bytecode offset of the instruction that faulted
+        bool      is_overflow; // Otherwise the stack underflowed
+
+        Stack_fault(bu::Usize offset, bool is_overflow, std::optional<Debug_location> const& = std::nullopt);
+    };
+
+
+    // Turns the faults caused by touching the guards of a guarded bu::Bytestack into
+    // Stack_fault exceptions, so that stack operations need no bounds checks of their
+    // own. The engine publishes the address of each instruction before executing it,
+    // which lets the exception name the instruction that faulted. When the fault
+    // happens in compiled code, that is the instruction that entered it. Faults in
+    // the part of a growable stack that is not yet accessible grow the stack instead.
+    //
+    // Faults are caught with a signal handler, so on Windows the guards are never
+    // watched, the machine keeps checking the bounds of guarded stacks itself, and
+    // growable stacks are made wholly accessible when they are created.
+    class [[nodiscard]] Stack_guard {
+        bu::Bytestack&   stack;
+        std::byte const* anchor;
+
+        auto run_erased(void(*)(void*), void*) -> void;
+    public:
+        static constexpr bool is_supported =
+#ifdef _WIN32
+            false;
+#else
+            true;
+#endif
+
+        std::byte const* volatile instruction = nullptr; // Published by the engine
+
+        Stack_guard(bu::Bytestack& stack, std::byte const* anchor) noexcept
+            : stack  { stack }
+            , anchor { anchor } {}
+
+        Stack_guard(Stack_guard const&) = delete;
+        auto operator=(Stack_guard const&) -> Stack_guard& = delete;
+
+        // Runs f with the guards of the stack watched on the calling thread. If f touches
+        // one, it is abandoned without unwinding and Stack_fault is thrown, so f must
+        // not own anything that needs to be destroyed. Exceptions thrown by f itself
+        // unwind as usual, and stop the guard from watching the stack.
+        template <std::invocable F>
+        auto run(F&& f) -> void {
+            run_erased([](void* const function) { (*static_cast<std::remove_reference_t<F>*>(function))(); }, std::addressof(f));
+        }
+
+        // The guard that is running on the calling thread, if any
+        static auto current() noexcept -> Stack_guard*;
+    };
+
+}
\ No newline at end of file
@@ -0,0 +1,421 @@
+#include "bu/utilities.hpp"
+#include "superinstructions.hpp"
+#include "virtual_machine.hpp"
+#include "vm_formatting.hpp"
+
+
+namespace {
+
+    using Opcode = vm::Opcode;
+
+
+    struct Fusion {
+        Opcode first;
+        Opcode second;
+        Opcode fused; // Takes the arguments of first followed by those of second
+    };
+
+    constexpr auto fusions = std::to_array<Fusion>({
+        { Opcode::push_address, Opcode::bitcopy_to_stack,   Opcode::load_local  },
+        { Opcode::push_address, Opcode::bitcopy_from_stack, Opcode::store_local },
+
+        { Opcode::ipush, Opcode::iadd, Opcode::ipush_iadd },
+        { Opcode::ipush, Opcode::isub, Opcode::ipush_isub },
+        { Opcode::ipush, Opcode::imul, Opcode::ipush_imul },
+        { Opcode::ipush, Opcode::idiv, Opcode::ipush_idiv },
+
+        { Opcode::idup, Opcode::local_jump_ieq_i , Opcode::idup_local_jump_ieq_i  },
+        { Opcode::idup, Opcode::local_jump_ineq_i, Opcode::idup_local_jump_ineq_i },
+        { Opcode::idup, Opcode::local_jump_ilt_i , Opcode::idup_local_jump_ilt_i  },
+        { Opcode::idup, Opcode::local_jump_ilte_i, Opcode::idup_local_jump_ilte_i },
+        { Opcode::idup, Opcode::local_jump_igt_i , Opcode::idup_local_jump_igt_i  },
+        { Opcode::idup, Opcode::local_jump_igte_i, Opcode::idup_local_jump_igte_i },
+    });
+
+    auto find_fusion(Opcode const first, Opcode const second) noexcept -> std::optional<Opcode> {
+        for (Fusion const& fusion : fusions) {
+            if (fusion.first == first && fusion.second == second) {
+                return fusion.fused;
+            }
+        }
+        return std::nullopt;
+    }
+
+
+    static_assert(
+        std::to_underlying(Opcode::load_local_16_short) - std::to_underlying(Opcode::load_local) == 6
+            && std::to_underlying(Opcode::store_local_16_short) - std::to_underlying(Opcode::store_local) == 6,
+        "load_local and store_local must each be followed by their three sized and three short forms"
+    );
+
+    // Writes a load_local or store_local in the smallest form that its offset and size allow
+    auto write_local_access(
+        vm::Bytecode&               out,
+        Opcode                const general,
+        vm::Local_offset_type const offset,
+        vm::Local_size_type   const size) -> void
+    {
+        constexpr auto sized_form_sizes = std::to_array<vm::Local_size_type>({ 1, 8, 16 });
+
+        auto const sized = std::ranges::find(sized_form_sizes, size);
+        if (sized == sized_form_sizes.end()) {
+            out.write(general, offset, size);
+            return;
+        }
+
+        auto const form = static_cast<bu::Usize>(std::distance(sized_form_sizes.begin(), sized));
+        auto const opcode_at = [=](bu::Usize const distance) {
+            return static_cast<Opcode>(std::to_underlying(general) + distance);
+        };
+
+        if (offset >= 0 && offset <= std::numeric_limits<vm::Short_local_offset_type>::max()) {
+            out.write(opcode_at(4 + form), static_cast<vm::Short_local_offset_type>(offset));
+        }
+        else {
+            out.write(opcode_at(1 + form), offset);
+        }
+    }
+
+
+    // Describes where and how the jump target of an instruction is encoded, if it has one
+    struct Jump_encoding {
+        enum class Kind { none, absolute, local };
+
+        Kind      kind            = Kind::none;
+        bu::Usize argument_offset = 0;
+        bu::Usize width           = 0; // The size of the encoded target or offset in bytes
+    };
+
+    auto jump_encoding(Opcode const opcode) noexcept -> Jump_encoding {
+        switch (opcode) {
+        case Opcode::jump:
+        case Opcode::jump_true:
+        case Opcode::jump_false:
+        case Opcode::call_0:
+            return { Jump_encoding::Kind::absolute, 0, sizeof(vm::Jump_offset_type) };
+        case Opcode::call:
+            return { Jump_encoding::Kind::absolute, sizeof(vm::Local_size_type), sizeof(vm::Jump_offset_type) };
+        case Opcode::call_0_32:
+            return { Jump_encoding::Kind::absolute, 0, sizeof(vm::Jump_offset_32_type) };
+        case Opcode::call_32:
+            return { Jump_encoding::Kind::absolute, sizeof(vm::Local_size_type), sizeof(vm::Jump_offset_32_type) };
+        case Opcode::tail_call:
+            return { Jump_encoding::Kind::absolute, 2 * sizeof(vm::Local_size_type), sizeof(vm::Jump_offset_type) };
+
+        case Opcode::local_jump_8:
+        case Opcode::local_jump_true_8:
+        case Opcode::local_jump_false_8:
+            return { Jump_encoding::Kind::local, 0, sizeof(vm::Local_offset_8_type) };
+        case Opcode::local_jump_32:
+        case Opcode::local_jump_true_32:
+        case Opcode::local_jump_false_32:
+            return { Jump_encoding::Kind::local, 0, sizeof(vm::Local_offset_32_type) };
+
+        case Opcode::local_jump:
+        case Opcode::local_jump_true:
+        case Opcode::local_jump_false:
+        case Opcode::local_jump_ieq_i:  case Opcode::local_jump_feq_i:  case Opcode::local_jump_ceq_i:  case Opcode::local_jump_beq_i:
+        case Opcode::local_jump_ineq_i: case Opcode::local_jump_fneq_i: case Opcode::local_jump_cneq_i: case Opcode::local_jump_bneq_i:
+        case Opcode::local_jump_ilt_i:  case Opcode::local_jump_flt_i:
+        case Opcode::local_jump_ilte_i: case Opcode::local_jump_flte_i:
+        case Opcode::local_jump_igt_i:  case Opcode::local_jump_fgt_i:
+        case Opcode::local_jump_igte_i: case Opcode::local_jump_fgte_i:
+        case Opcode::idup_local_jump_ieq_i: case Opcode::idup_local_jump_ineq_i:
+        case Opcode::idup_local_jump_ilt_i: case Opcode::idup_local_jump_ilte_i:
+        case Opcode::idup_local_jump_igt_i: case Opcode::idup_local_jump_igte_i:
+            return { Jump_encoding::Kind::local, 0, sizeof(vm::Local_offset_type) };
+
+        default:
+            return {};
+        }
+    }
+
+    // Whether execution can never continue directly to the next instruction
+    auto is_unconditional_transfer(Opcode const opcode) noexcept -> bool {
+        return opcode == Opcode::jump
+            || opcode == Opcode::local_jump
+            || opcode == Opcode::local_jump_8
+            || opcode == Opcode::local_jump_32
+            || opcode == Opcode::tail_call
+            || opcode == Opcode::ret
+            || opcode == Opcode::halt;
+    }
+
+
+    struct Instruction {
+        bu::Usize offset;
+        Opcode    opcode;
+
+        auto size() const noexcept -> bu::Usize {
+            return 1 + vm::argument_bytes(opcode);
+        }
+    };
+
+    auto decode(std::span<std::byte const> const code) -> std::vector<Instruction> {
+        std::vector<Instruction> instructions;
+        for (bu::Usize offset = 0; offset < code.size(); offset += instructions.back().size()) {
+            instructions.push_back({ offset, static_cast<Opcode>(code[offset]) });
+        }
+        return instructions;
+    }
+
+    // Reads a jump target or offset of the given width, sign-extending local offsets
+    auto read_encoded(std::byte const* const argument, Jump_encoding::Kind const kind, bu::Usize const width) -> bu::Isize {
+        auto const read = [=]<class T>(bu::Type<T>) {
+            T value;
+            std::memcpy(&value, argument, sizeof value);
+            return static_cast<bu::Isize>(value);
+        };
+        bool const is_local = kind == Jump_encoding::Kind::local;
+
+        switch (width) {
+        case 1:  return read(bu::type<vm::Local_offset_8_type>);
+        case 2:  return read(bu::type<vm::Local_offset_type>);
+        case 4:  return is_local ? read(bu::type<vm::Local_offset_32_type>) : read(bu::type<vm::Jump_offset_32_type>);
+        case 8:  return read(bu::type<bu::Isize>);
+        default: std::unreachable();
+        }
+    }
+
+    auto write_encoded(std::byte* const argument, bu::Isize const value, bu::Usize const width) -> void {
+        auto const write = [=]<class T>(bu::Type<T>) {
+            auto const narrowed = static_cast<T>(value);
+            std::memcpy(argument, &narrowed, sizeof narrowed);
+        };
+
+        switch (width) {
+        case 1:  return write(bu::type<bu::I8>);
+        case 2:  return write(bu::type<bu::I16>);
+        case 4:  return write(bu::type<bu::I32>);
+        case 8:  return write(bu::type<bu::Isize>);
+        default: std::unreachable();
+        }
+    }
+
+    auto jump_target(std::span<std::byte const> const code, Instruction const instruction)
+        -> std::optional<bu::Usize>
+    {
+        auto const [kind, argument_offset, width] = jump_encoding(instruction.opcode);
+        auto const argument = code.data() + instruction.offset + 1 + argument_offset;
+
+        switch (kind) {
+        case Jump_encoding::Kind::absolute:
+            return static_cast<bu::Usize>(read_encoded(argument, kind, width));
+        case Jump_encoding::Kind::local:
+            return static_cast<bu::Usize>(static_cast<bu::Isize>(instruction.offset + instruction.size()) + read_encoded(argument, kind, width));
+        default:
+            return std::nullopt;
+        }
+    }
+
+    auto find_jump_targets(std::span<std::byte const> const code, std::span<Instruction const> const instructions)
+        -> std::vector<bool>
+    {
+        std::vector<bool> is_jump_target(code.size() + 1);
+        for (Instruction const instruction : instructions) {
+            if (auto const target = jump_target(code, instruction)) {
+                is_jump_target.at(*target) = true;
+            }
+        }
+        return is_jump_target;
+    }
+
+
+    auto read_file(std::filesystem::path const& path) -> std::vector<std::byte> {
+        std::ifstream file { path, std::ios::binary };
+        if (!file) {
+            throw bu::exception("Could not open '{}'", path.string());
+        }
+
+        std::vector<std::byte> bytes(std::filesystem::file_size(path));
+        file.read(reinterpret_cast<char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+        return bytes;
+    }
+
+}
+
+
+namespace {
+
+    struct Fused_bytecode {
+        vm::Bytecode           bytecode;
+        std::vector<bu::Usize> relocated_offsets; // The offset in the fused bytecode of each original instruction, and of the end
+    };
+
+    auto fuse(vm::Bytecode const& bytecode) -> Fused_bytecode {
+        std::span<std::byte const> const code = bytecode.bytes;
+
+        auto const instructions   = decode(code);
+        auto const is_jump_target = find_jump_targets(code, instructions);
+
+        vm::Bytecode fused;
+        std::vector<bu::Usize>           relocated_offsets(code.size() + 1);
+        std::vector<bu::Pair<bu::Usize>> jumps; // Offsets of jumps in the fused code, paired with their original targets
+
+        auto const write_arguments = [&](Instruction const instruction) {
+            auto const arguments = code.subspan(instruction.offset + 1, instruction.size() - 1);
+            fused.bytes.insert(fused.bytes.end(), arguments.begin(), arguments.end());
+        };
+
+        auto const read_argument = [&]<class T>(bu::Type<T>, Instruction const instruction, bu::Usize const argument_offset) {
+            T argument;
+            std::memcpy(&argument, code.data() + instruction.offset + 1 + argument_offset, sizeof argument);
+            return argument;
+        };
+
+        for (bu::Usize i = 0; i != instructions.size(); ++i) {
+            Instruction const first = instructions[i];
+            relocated_offsets[first.offset] = fused.current_offset();
+
+            if (i + 1 != instructions.size() && !is_jump_target[instructions[i + 1].offset]) {
+                Instruction const second = instructions[i + 1];
+
+                if (auto const fused_opcode = find_fusion(first.opcode, second.opcode)) {
+                    if (auto const target = jump_target(code, second)) {
+                        jumps.emplace_back(fused.current_offset(), *target);
+                    }
+                    relocated_offsets[second.offset] = fused.current_offset();
+
+                    if (*fused_opcode == Opcode::load_local || *fused_opcode == Opcode::store_local) {
+                        write_local_access(
+                            fused,
+                            *fused_opcode,
+                            read_argument(bu::type<vm::Local_offset_type>, first, 0),
+                            read_argument(bu::type<vm::Local_size_type>, second, 0)
+                        );
+                    }
+                    else {
+                        fused.write(*fused_opcode);
+                        write_arguments(first);
+                        write_arguments(second);
+                    }
+                    ++i;
+                    continue;
+                }
+            }
+
+            if (first.opcode == Opcode::load_local || first.opcode == Opcode::store_local) {
+                write_local_access(
+                    fused,
+                    first.opcode,
+                    read_argument(bu::type<vm::Local_offset_type>, first, 0),
+                    read_argument(bu::type<vm::Local_size_type>, first, sizeof(vm::Local_offset_type))
+                );
+                continue;
+            }
+
+            if (auto const target = jump_target(code, first)) {
+                jumps.emplace_back(fused.current_offset(), *target);
+            }
+            fused.write(first.opcode);
+            write_arguments(first);
+        }
+
+        relocated_offsets[code.size()] = fused.current_offset();
+
+        for (auto const [offset, original_target] : jumps) {
+            auto const opcode = static_cast<Opcode>(fused.bytes[offset]);
+            auto const [kind, argument_offset, width] = jump_encoding(opcode);
+            auto const argument = fused.bytes.data() + offset + 1 + argument_offset;
+            auto const target   = relocated_offsets[original_target];
+
+            // Fusion only ever shrinks targets and the distances between jumps and
+            // their targets, so every relocated value fits in its original width
+            if (kind == Jump_encoding::Kind::absolute) {
+                write_encoded(argument, static_cast<bu::Isize>(target), width);
+            }
+            else {
+                auto const next = offset + 1 + vm::argument_bytes(opcode);
+                write_encoded(argument, static_cast<bu::Isize>(target) - static_cast<bu::Isize>(next), width);
+            }
+        }
+
+        return { std::move(fused), std::move(relocated_offsets) };
+    }
+
+}
+
+
+auto vm::fuse_superinstructions(Bytecode const& bytecode) -> Bytecode {
+    return fuse(bytecode).bytecode;
+}
+
+auto vm::fuse_superinstructions(Executable_program const& program) -> Executable_program {
+    auto [bytecode, relocated_offsets] = fuse(program.bytecode);
+
+    // Stack maps are keyed by return addresses, which are never the second instruction of a fused pair
+    Stack_maps stack_maps;
+    for (auto const& [offset, slots] : program.stack_maps.span()) {
+        stack_maps.add(Jump_offset_type { relocated_offsets.at(offset) }, std::vector<Local_offset_type>(slots));
+    }
+
+    return Executable_program {
+        .bytecode       = std::move(bytecode),
+        .constants      = program.constants,
+        .stack_capacity = program.stack_capacity,
+        .stack_maps     = std::move(stack_maps),
+        .debug_table    = program.debug_table.relocated(relocated_offsets),
+    };
+}
+
+
+auto vm::opcode_pair_histogram(std::span<Bytecode const> const corpus) -> std::vector<Opcode_pair_count> {
+    constexpr auto opcode_count = static_cast<bu::Usize>(Opcode::_opcode_count);
+
+    std::vector<bu::Usize> counts(opcode_count * opcode_count);
+
+    for (Bytecode const& bytecode : corpus) {
+        std::span<std::byte const> const code = bytecode.bytes;
+
+        auto const instructions   = decode(code);
+        auto const is_jump_target = find_jump_targets(code, instructions);
+
+        for (bu::Usize i = 0; i + 1 < instructions.size(); ++i) {
+            auto const [first, second] = std::tie(instructions[i], instructions[i + 1]);
+
+            if (!is_unconditional_transfer(first.opcode) && !is_jump_target[second.offset]) {
+                ++counts[static_cast<bu::Usize>(first.opcode) * opcode_count + static_cast<bu::Usize>(second.opcode)];
+            }
+        }
+    }
+
+    std::vector<Opcode_pair_count> histogram;
+    for (bu::Usize i = 0; i != counts.size(); ++i) {
+        if (counts[i] != 0) {
+            histogram.push_back({
+                .first  = static_cast<Opcode>(i / opcode_count),
+                .second = static_cast<Opcode>(i % opcode_count),
+                .count  = counts[i],
+            });
+        }
+    }
+
+    std::ranges::stable_sort(histogram, std::greater {}, &Opcode_pair_count::count);
+    return histogram;
+}
+
+
+auto vm::print_superinstruction_candidates(std::filesystem::path const& corpus_directory) -> void {
+    constexpr bu::Usize shown_pair_count = 30;
+
+    std::vector<Bytecode> corpus;
+    for (auto const& entry : std::filesystem::directory_iterator { corpus_directory }) {
+        if (entry.is_regular_file()) {
+            corpus.push_back(Executable_program::deserialize(read_file(entry.path())).bytecode);
+        }
+    }
+
+    auto const histogram = opcode_pair_histogram(corpus);
+
+    bu::print("The most common opcode pairs in {} programs:\n", corpus.size());
+
+    for (auto const [first, second, count] : histogram | std::views::take(shown_pair_count)) {
+        bu::print("{:>10} {} {}", count, first, second);
+
+        if (auto const fused = find_fusion(first, second)) {
+            bu::print(" (fused into {})", *fused);
+        }
+
+        bu::print("\n");
+    }
+}
\ No newline at end of file
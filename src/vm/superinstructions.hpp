@@ -0,0 +1,40 @@
+#pragma once
+
+#include "bu/utilities.hpp"
+#include "bytecode.hpp"
+#include "opcode.hpp"
+#include "virtual_machine.hpp"
+
+
+namespace vm {
+
+    // Replaces common sequences of two instructions with equivalent superinstructions,
+    // rewrites every load_local and store_local in its smallest form, and relocates
+    // every jump and call target accordingly. A sequence is left alone if its second
+    // instruction is the target of a jump. The bytecode must be valid. Stack maps and
+    // debug tables are keyed by offsets in the original bytecode, so they do not apply
+    // to the result; fuse the whole program to relocate them as well.
+    auto fuse_superinstructions(Bytecode const&) -> Bytecode;
+
+    // Fuses the bytecode of the program, and relocates its stack maps and debug table
+    // to match. A fused instruction takes the location of the second instruction of
+    // its pair.
+    auto fuse_superinstructions(Executable_program const&) -> Executable_program;
+
+
+    struct Opcode_pair_count {
+        Opcode    first;
+        Opcode    second;
+        bu::Usize count;
+    };
+
+    // Counts how often each pair of opcodes occurs in sequence across the corpus, ignoring
+    // pairs that can not be fused because control may enter between them. The result is
+    // sorted from the most common pair to the least common one.
+    auto opcode_pair_histogram(std::span<Bytecode const> corpus) -> std::vector<Opcode_pair_count>;
+
+    // Deserializes every program in the given directory, and prints the most common
+    // opcode pairs along with the superinstructions they are already fused into
+    auto print_superinstruction_candidates(std::filesystem::path const& corpus_directory) -> void;
+
+}
\ No newline at end of file
@@ -0,0 +1,461 @@
+#include "bu/utilities.hpp"
+#include "bu/safe_integer.hpp"
+#include "vector_kernels.hpp"
+
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define VMT22A_X86_64 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#else
+#define VMT22A_X86_64 0
+#endif
+
+// MSVC allows intrinsics in every function, while GCC and Clang
+// allow them only in functions compiled for the instruction set
+#ifdef _MSC_VER
+#define VMT22A_AVX2
+#else
+#define VMT22A_AVX2 [[gnu::target("avx2")]]
+#endif
+
+
+namespace {
+
+    using bu::Isize;
+    using bu::Usize;
+    using bu::Float;
+
+
+    namespace scalar {
+
+        template <class T, class F>
+        auto binary(T* const destination, T const* const left, T const* const right, Usize const count) noexcept -> void {
+            for (Usize i = 0; i != count; ++i) {
+                destination[i] = F {}(left[i], right[i]);
+            }
+        }
+
+        template <class T, class F>
+        auto comparison(bool* const destination, T const* const left, T const* const right, Usize const count) noexcept -> void {
+            for (Usize i = 0; i != count; ++i) {
+                destination[i] = F {}(left[i], right[i]);
+            }
+        }
+
+        template <class T, class F = std::plus<>>
+        auto sum(T const* const source, Usize const count) noexcept -> T {
+            T result {};
+            for (Usize i = 0; i != count; ++i) {
+                result = F {}(result, source[i]);
+            }
+            return result;
+        }
+
+        template <class T>
+        auto min(T const* const source, Usize const count) noexcept -> T {
+            auto result = std::numeric_limits<T>::has_infinity ? std::numeric_limits<T>::infinity() : std::numeric_limits<T>::max();
+            for (Usize i = 0; i != count; ++i) {
+                result = std::min(result, source[i]);
+            }
+            return result;
+        }
+
+        template <class T>
+        auto max(T const* const source, Usize const count) noexcept -> T {
+            auto result = std::numeric_limits<T>::has_infinity ? -std::numeric_limits<T>::infinity() : std::numeric_limits<T>::lowest();
+            for (Usize i = 0; i != count; ++i) {
+                result = std::max(result, source[i]);
+            }
+            return result;
+        }
+
+
+        constexpr vm::Vector_kernels kernels {
+            .instruction_set = vm::Vector_instruction_set::scalar,
+            .iadd            = binary<Isize, bu::wrapping_plus<Isize>>, // Wraps around like the lanes of the vector kernels
+            .imul            = binary<Isize, bu::wrapping_multiplies<Isize>>,
+            .fadd            = binary<Float, std::plus<>>,
+            .fmul            = binary<Float, std::multiplies<>>,
+            .ieq             = comparison<Isize, std::equal_to<>>,
+            .ilt             = comparison<Isize, std::less<>>,
+            .feq             = comparison<Float, std::equal_to<>>,
+            .flt             = comparison<Float, std::less<>>,
+            .isum            = sum<Isize, bu::wrapping_plus<Isize>>,
+            .imin            = min<Isize>,
+            .imax            = max<Isize>,
+            .fsum            = sum<Float>,
+            .fmin            = min<Float>,
+            .fmax            = max<Float>,
+        };
+
+    }
+
+
+#if VMT22A_X86_64
+
+    // The vector kernels process as many whole vectors as fit in the
+    // arrays, and leave the remaining elements to the scalar kernels.
+    // Every load and store is unaligned, since the arrays may be anywhere.
+
+    // Writes the bools selected by the low bits of the mask
+    auto write_mask(bool* const destination, int const mask, Usize const lanes) noexcept -> void {
+        for (Usize lane = 0; lane != lanes; ++lane) {
+            destination[lane] = ((mask >> lane) & 1) != 0;
+        }
+    }
+
+
+    namespace sse2 {
+
+        // SSE2 has no 64-bit integer comparisons, so ieq, ilt, imin, and imax are scalar
+
+        struct Isize_add {
+            auto operator()(__m128i const a, __m128i const b) const noexcept -> __m128i {
+                return _mm_add_epi64(a, b);
+            }
+        };
+
+        // The low 64 bits of the product, assembled from 32-bit multiplications
+        struct Isize_mul {
+            auto operator()(__m128i const a, __m128i const b) const noexcept -> __m128i {
+                auto const low   = _mm_mul_epu32(a, b);
+                auto const cross = _mm_add_epi64(_mm_mul_epu32(_mm_srli_epi64(a, 32), b), _mm_mul_epu32(a, _mm_srli_epi64(b, 32)));
+                return _mm_add_epi64(low, _mm_slli_epi64(cross, 32));
+            }
+        };
+
+        struct Float_add {
+            auto operator()(__m128d const a, __m128d const b) const noexcept -> __m128d {
+                return _mm_add_pd(a, b);
+            }
+        };
+
+        struct Float_mul {
+            auto operator()(__m128d const a, __m128d const b) const noexcept -> __m128d {
+                return _mm_mul_pd(a, b);
+            }
+        };
+
+        struct Float_eq {
+            auto operator()(__m128d const a, __m128d const b) const noexcept -> __m128d {
+                return _mm_cmpeq_pd(a, b);
+            }
+        };
+
+        struct Float_lt {
+            auto operator()(__m128d const a, __m128d const b) const noexcept -> __m128d {
+                return _mm_cmplt_pd(a, b);
+            }
+        };
+
+        // minpd and maxpd return their second operand when either is NaN,
+        // so with the accumulator second they agree with std::min and std::max
+        struct Float_min {
+            auto operator()(__m128d const accumulator, __m128d const value) const noexcept -> __m128d {
+                return _mm_min_pd(value, accumulator);
+            }
+        };
+
+        struct Float_max {
+            auto operator()(__m128d const accumulator, __m128d const value) const noexcept -> __m128d {
+                return _mm_max_pd(value, accumulator);
+            }
+        };
+
+
+        template <class Op, auto tail>
+        auto ibinary(Isize* const destination, Isize const* const left, Isize const* const right, Usize const count) noexcept -> void {
+            Usize i = 0;
+            for (; count - i >= 2; i += 2) {
+                auto const a = _mm_loadu_si128(reinterpret_cast<__m128i const*>(left + i));
+                auto const b = _mm_loadu_si128(reinterpret_cast<__m128i const*>(right + i));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i), Op {}(a, b));
+            }
+            tail(destination + i, left + i, right + i, count - i);
+        }
+
+        template <class Op, auto tail>
+        auto fbinary(Float* const destination, Float const* const left, Float const* const right, Usize const count) noexcept -> void {
+            Usize i = 0;
+            for (; count - i >= 2; i += 2) {
+                _mm_storeu_pd(destination + i, Op {}(_mm_loadu_pd(left + i), _mm_loadu_pd(right + i)));
+            }
+            tail(destination + i, left + i, right + i, count - i);
+        }
+
+        template <class Op, auto tail>
+        auto fcomparison(bool* const destination, Float const* const left, Float const* const right, Usize const count) noexcept -> void {
+            Usize i = 0;
+            for (; count - i >= 2; i += 2) {
+                write_mask(destination + i, _mm_movemask_pd(Op {}(_mm_loadu_pd(left + i), _mm_loadu_pd(right + i))), 2);
+            }
+            tail(destination + i, left + i, right + i, count - i);
+        }
+
+        auto isum(Isize const* const source, Usize const count) noexcept -> Isize {
+            auto  accumulator = _mm_setzero_si128();
+            Usize i           = 0;
+            for (; count - i >= 2; i += 2) {
+                accumulator = _mm_add_epi64(accumulator, _mm_loadu_si128(reinterpret_cast<__m128i const*>(source + i)));
+            }
+            std::array<Isize, 3> lanes;
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes.data()), accumulator);
+            lanes[2] = scalar::kernels.isum(source + i, count - i);
+            return scalar::kernels.isum(lanes.data(), lanes.size());
+        }
+
+        template <class Op, auto tail>
+        auto freduction(Float const* const source, Usize const count) noexcept -> Float {
+            auto  accumulator = _mm_set1_pd(tail(nullptr, 0));
+            Usize i           = 0;
+            for (; count - i >= 2; i += 2) {
+                accumulator = Op {}(accumulator, _mm_loadu_pd(source + i));
+            }
+            std::array<Float, 3> lanes;
+            _mm_storeu_pd(lanes.data(), accumulator);
+            lanes[2] = tail(source + i, count - i);
+            return tail(lanes.data(), lanes.size());
+        }
+
+
+        constexpr vm::Vector_kernels kernels {
+            .instruction_set = vm::Vector_instruction_set::sse2,
+            .iadd            = ibinary<Isize_add, scalar::kernels.iadd>,
+            .imul            = ibinary<Isize_mul, scalar::kernels.imul>,
+            .fadd            = fbinary<Float_add, scalar::kernels.fadd>,
+            .fmul            = fbinary<Float_mul, scalar::kernels.fmul>,
+            .ieq             = scalar::kernels.ieq,
+            .ilt             = scalar::kernels.ilt,
+            .feq             = fcomparison<Float_eq, scalar::kernels.feq>,
+            .flt             = fcomparison<Float_lt, scalar::kernels.flt>,
+            .isum            = isum,
+            .imin            = scalar::kernels.imin,
+            .imax            = scalar::kernels.imax,
+            .fsum            = freduction<Float_add, scalar::kernels.fsum>,
+            .fmin            = freduction<Float_min, scalar::kernels.fmin>,
+            .fmax            = freduction<Float_max, scalar::kernels.fmax>,
+        };
+
+    }
+
+
+    namespace avx2 {
+
+        struct Isize_add {
+            VMT22A_AVX2 auto operator()(__m256i const a, __m256i const b) const noexcept -> __m256i {
+                return _mm256_add_epi64(a, b);
+            }
+        };
+
+        // The low 64 bits of the product, assembled from 32-bit multiplications
+        struct Isize_mul {
+            VMT22A_AVX2 auto operator()(__m256i const a, __m256i const b) const noexcept -> __m256i {
+                auto const low   = _mm256_mul_epu32(a, b);
+                auto const cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b), _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+                return _mm256_add_epi64(low, _mm256_slli_epi64(cross, 32));
+            }
+        };
+
+        struct Isize_eq {
+            VMT22A_AVX2 auto operator()(__m256i const a, __m256i const b) const noexcept -> __m256i {
+                return _mm256_cmpeq_epi64(a, b);
+            }
+        };
+
+        struct Isize_lt {
+            VMT22A_AVX2 auto operator()(__m256i const a, __m256i const b) const noexcept -> __m256i {
+                return _mm256_cmpgt_epi64(b, a);
+            }
+        };
+
+        struct Isize_min {
+            VMT22A_AVX2 auto operator()(__m256i const accumulator, __m256i const value) const noexcept -> __m256i {
+                return _mm256_blendv_epi8(accumulator, value, _mm256_cmpgt_epi64(accumulator, value));
+            }
+        };
+
+        struct Isize_max {
+            VMT22A_AVX2 auto operator()(__m256i const accumulator, __m256i const value) const noexcept -> __m256i {
+                return _mm256_blendv_epi8(accumulator, value, _mm256_cmpgt_epi64(value, accumulator));
+            }
+        };
+
+        struct Float_add {
+            VMT22A_AVX2 auto operator()(__m256d const a, __m256d const b) const noexcept -> __m256d {
+                return _mm256_add_pd(a, b);
+            }
+        };
+
+        struct Float_mul {
+            VMT22A_AVX2 auto operator()(__m256d const a, __m256d const b) const noexcept -> __m256d {
+                return _mm256_mul_pd(a, b);
+            }
+        };
+
+        struct Float_eq {
+            VMT22A_AVX2 auto operator()(__m256d const a, __m256d const b) const noexcept -> __m256d {
+                return _mm256_cmp_pd(a, b, _CMP_EQ_OQ);
+            }
+        };
+
+        struct Float_lt {
+            VMT22A_AVX2 auto operator()(__m256d const a, __m256d const b) const noexcept -> __m256d {
+                return _mm256_cmp_pd(a, b, _CMP_LT_OQ);
+            }
+        };
+
+        // See sse2::Float_min
+        struct Float_min {
+            VMT22A_AVX2 auto operator()(__m256d const accumulator, __m256d const value) const noexcept -> __m256d {
+                return _mm256_min_pd(value, accumulator);
+            }
+        };
+
+        struct Float_max {
+            VMT22A_AVX2 auto operator()(__m256d const accumulator, __m256d const value) const noexcept -> __m256d {
+                return _mm256_max_pd(value, accumulator);
+            }
+        };
+
+
+        VMT22A_AVX2 auto load(Isize const* const source) noexcept -> __m256i {
+            return _mm256_loadu_si256(reinterpret_cast<__m256i const*>(source));
+        }
+
+        template <class Op, auto tail>
+        VMT22A_AVX2 auto ibinary(Isize* const destination, Isize const* const left, Isize const* const right, Usize const count) noexcept -> void {
+            Usize i = 0;
+            for (; count - i >= 4; i += 4) {
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + i), Op {}(load(left + i), load(right + i)));
+            }
+            tail(destination + i, left + i, right + i, count - i);
+        }
+
+        template <class Op, auto tail>
+        VMT22A_AVX2 auto fbinary(Float* const destination, Float const* const left, Float const* const right, Usize const count) noexcept -> void {
+            Usize i = 0;
+            for (; count - i >= 4; i += 4) {
+                _mm256_storeu_pd(destination + i, Op {}(_mm256_loadu_pd(left + i), _mm256_loadu_pd(right + i)));
+            }
+            tail(destination + i, left + i, right + i, count - i);
+        }
+
+        template <class Op, auto tail>
+        VMT22A_AVX2 auto icomparison(bool* const destination, Isize const* const left, Isize const* const right, Usize const count) noexcept -> void {
+            Usize i = 0;
+            for (; count - i >= 4; i += 4) {
+                write_mask(destination + i, _mm256_movemask_pd(_mm256_castsi256_pd(Op {}(load(left + i), load(right + i)))), 4);
+            }
+            tail(destination + i, left + i, right + i, count - i);
+        }
+
+        template <class Op, auto tail>
+        VMT22A_AVX2 auto fcomparison(bool* const destination, Float const* const left, Float const* const right, Usize const count) noexcept -> void {
+            Usize i = 0;
+            for (; count - i >= 4; i += 4) {
+                write_mask(destination + i, _mm256_movemask_pd(Op {}(_mm256_loadu_pd(left + i), _mm256_loadu_pd(right + i))), 4);
+            }
+            tail(destination + i, left + i, right + i, count - i);
+        }
+
+        // The identity of the reduction is the result of the scalar kernel on an empty array.
+        // The lanes are combined with the scalar kernel, together with the remaining elements.
+
+        template <class Op, auto tail>
+        VMT22A_AVX2 auto ireduction(Isize const* const source, Usize const count) noexcept -> Isize {
+            auto  accumulator = _mm256_set1_epi64x(tail(nullptr, 0));
+            Usize i           = 0;
+            for (; count - i >= 4; i += 4) {
+                accumulator = Op {}(accumulator, load(source + i));
+            }
+            std::array<Isize, 5> lanes;
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes.data()), accumulator);
+            lanes[4] = tail(source + i, count - i);
+            return tail(lanes.data(), lanes.size());
+        }
+
+        template <class Op, auto tail>
+        VMT22A_AVX2 auto freduction(Float const* const source, Usize const count) noexcept -> Float {
+            auto  accumulator = _mm256_set1_pd(tail(nullptr, 0));
+            Usize i           = 0;
+            for (; count - i >= 4; i += 4) {
+                accumulator = Op {}(accumulator, _mm256_loadu_pd(source + i));
+            }
+            std::array<Float, 5> lanes;
+            _mm256_storeu_pd(lanes.data(), accumulator);
+            lanes[4] = tail(source + i, count - i);
+            return tail(lanes.data(), lanes.size());
+        }
+
+
+        constexpr vm::Vector_kernels kernels {
+            .instruction_set = vm::Vector_instruction_set::avx2,
+            .iadd            = ibinary<Isize_add, scalar::kernels.iadd>,
+            .imul            = ibinary<Isize_mul, scalar::kernels.imul>,
+            .fadd            = fbinary<Float_add, scalar::kernels.fadd>,
+            .fmul            = fbinary<Float_mul, scalar::kernels.fmul>,
+            .ieq             = icomparison<Isize_eq, scalar::kernels.ieq>,
+            .ilt             = icomparison<Isize_lt, scalar::kernels.ilt>,
+            .feq             = fcomparison<Float_eq, scalar::kernels.feq>,
+            .flt             = fcomparison<Float_lt, scalar::kernels.flt>,
+            .isum            = ireduction<Isize_add, scalar::kernels.isum>,
+            .imin            = ireduction<Isize_min, scalar::kernels.imin>,
+            .imax            = ireduction<Isize_max, scalar::kernels.imax>,
+            .fsum            = freduction<Float_add, scalar::kernels.fsum>,
+            .fmin            = freduction<Float_min, scalar::kernels.fmin>,
+            .fmax            = freduction<Float_max, scalar::kernels.fmax>,
+        };
+
+    }
+
+
+    auto processor_supports_avx2() noexcept -> bool {
+#ifdef _MSC_VER
+        std::array<int, 4> registers {};
+
+        // The processor must support AVX2, and the operating system must save the ymm registers
+        __cpuid(registers.data(), 1);
+        bool const osxsave = (registers[2] & (1 << 27)) != 0;
+        bool const avx     = (registers[2] & (1 << 28)) != 0;
+        if (!osxsave || !avx || (_xgetbv(0) & 0b110) != 0b110) {
+            return false;
+        }
+        __cpuidex(registers.data(), 7, 0);
+        return (registers[1] & (1 << 5)) != 0;
+#else
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+#endif
+    }
+
+#endif
+
+}
+
+
+auto vm::supported_vector_instruction_set() noexcept -> Vector_instruction_set {
+#if VMT22A_X86_64
+    // SSE2 is part of every x86-64 processor
+    return processor_supports_avx2() ? Vector_instruction_set::avx2 : Vector_instruction_set::sse2;
+#else
+    return Vector_instruction_set::scalar;
+#endif
+}
+
+auto vm::vector_kernels_for(Vector_instruction_set const instruction_set) noexcept -> Vector_kernels {
+    switch (instruction_set) {
+#if VMT22A_X86_64
+    case Vector_instruction_set::avx2: return avx2::kernels;
+    case Vector_instruction_set::sse2: return sse2::kernels;
+#endif
+    default:                           return scalar::kernels;
+    }
+}
+
+auto vm::vector_kernels() noexcept -> Vector_kernels const& {
+    static Vector_kernels const kernels = vector_kernels_for(supported_vector_instruction_set());
+    return kernels;
+}
\ No newline at end of file
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "bu/utilities.hpp"
+
+
+namespace vm {
+
+    enum class Vector_instruction_set { scalar, sse2, avx2 };
+
+
+    // The kernels of the vector opcodes, which operate on contiguous arrays of count
+    // elements. Element-wise kernels write their results to the destination, which may
+    // be one of the operands, and comparisons write one bool per element. The minimum
+    // and maximum of an empty array are the largest and smallest values of the type.
+    //
+    // Sums of floats are computed in several lanes at once, so the additions happen
+    // in a different order than in the scalar kernel, and may round differently.
+    struct Vector_kernels {
+        template <class T> using Binary     = void(*)(T* destination, T const* left, T const* right, bu::Usize count);
+        template <class T> using Comparison = void(*)(bool* destination, T const* left, T const* right, bu::Usize count);
+        template <class T> using Reduction  = T(*)(T const* source, bu::Usize count);
+
+        Vector_instruction_set instruction_set;
+
+        Binary<bu::Isize>     iadd, imul;
+        Binary<bu::Float>     fadd, fmul;
+        Comparison<bu::Isize> ieq, ilt;
+        Comparison<bu::Float> feq, flt;
+        Reduction<bu::Isize>  isum, imin, imax;
+        Reduction<bu::Float>  fsum, fmin, fmax;
+    };
+
+    // The best instruction set that both the processor and the build support
+    auto supported_vector_instruction_set() noexcept -> Vector_instruction_set;
+
+    // The kernels for the given instruction set, which must be supported. Operations
+    // that the instruction set has no instructions for use the scalar kernels.
+    auto vector_kernels_for(Vector_instruction_set) noexcept -> Vector_kernels;
+
+    // The kernels for the supported instruction set, which is detected on the first call
+    auto vector_kernels() noexcept -> Vector_kernels const&;
+
+}
\ No newline at end of file
@@ -0,0 +1,734 @@
+#include "bu/utilities.hpp"
+#include "bu/flatmap.hpp"
+#include "verifier.hpp"
+#include "opcode.hpp"
+#include "vm_formatting.hpp"
+
+#include <unordered_map>
+
+
+namespace {
+
+    using Opcode = vm::Opcode;
+
+
+    // The abstract value of one stack entry. Values read from memory with
+    // bitcopy_to_stack or load_local have no known type, so they are represented
+    // as raw bytes which any operand of the same size may consume.
+    struct Slot {
+        enum class Type : bu::U8 { integer, floating, character, string, boolean, pointer, bytes };
+
+        Type      type;
+        bu::Usize size;
+
+        [[nodiscard]] auto operator==(Slot const&) const noexcept -> bool = default;
+    };
+
+    constexpr Slot integer   { Slot::Type::integer,   sizeof(bu::Isize)              };
+    constexpr Slot floating  { Slot::Type::floating,  sizeof(bu::Float)              };
+    constexpr Slot character { Slot::Type::character, sizeof(bu::Char)               };
+    constexpr Slot string    { Slot::Type::string,    sizeof(vm::Constants::String)  };
+    constexpr Slot boolean   { Slot::Type::boolean,   sizeof(bool)                   };
+    constexpr Slot pointer   { Slot::Type::pointer,   sizeof(std::byte*)             };
+
+    constexpr auto bytes(bu::Usize const size) noexcept -> Slot {
+        return { Slot::Type::bytes, size };
+    }
+
+    auto describe(Slot const slot) -> std::string {
+        switch (slot.type) {
+        case Slot::Type::integer:   return "an integer";
+        case Slot::Type::floating:  return "a float";
+        case Slot::Type::character: return "a character";
+        case Slot::Type::string:    return "a string";
+        case Slot::Type::boolean:   return "a boolean";
+        case Slot::Type::pointer:   return "a pointer";
+        case Slot::Type::bytes:     return std::format("{} untyped bytes", slot.size);
+        default:
+            std::unreachable();
+        }
+    }
+
+
+    struct Abstract_stack {
+        std::vector<Slot> slots;
+        bu::Usize         depth   = 0; // Bytes above the base of the current frame
+        bu::Usize         regions = 0; // Heap regions entered by the current function and not yet exited
+
+        [[nodiscard]] auto operator==(Abstract_stack const&) const noexcept -> bool = default;
+    };
+
+    auto describe(Abstract_stack const& stack) -> std::string {
+        if (stack.slots.empty()) {
+            return "an empty stack";
+        }
+        std::string description;
+        for (Slot const slot : stack.slots) {
+            std::format_to(std::back_inserter(description), "{}{}", description.empty() ? "[" : ", ", describe(slot));
+        }
+        return description + "]";
+    }
+
+
+    struct Function {
+        bu::Usize stack_requirement = 0; // Including the frames of every function this one calls
+        bu::Usize peak_offset       = 0; // The offset at which stack_requirement is reached
+        bool      is_being_verified = false;
+    };
+
+
+    class Verifier {
+        std::span<std::byte const> code;
+        bu::Usize                  string_count;
+        std::vector<bool>          is_instruction_start;
+        bu::Flatmap<bu::Usize, Function> functions;
+
+        // State of the instruction currently being verified
+        bu::Usize      offset = 0;
+        Abstract_stack stack;
+        Function       function;
+        bu::Usize      function_entry = 0;
+        bu::Usize      lowest_depth   = 0; // The lowest depth the instruction has popped the stack to
+
+        std::vector<std::optional<vm::Control_flow_node>>* graph = nullptr; // Recorded only when requested
+
+        [[noreturn]]
+        auto fail(std::string_view const fmt, auto const&... args) const -> void {
+            throw vm::Verification_error { offset, std::vformat(fmt, std::make_format_args(args...)) };
+        }
+
+        template <bu::trivial T>
+        auto argument(bu::Usize const argument_offset = 0) const noexcept -> T {
+            T argument;
+            std::memcpy(&argument, code.data() + offset + 1 + argument_offset, sizeof argument);
+            return argument;
+        }
+
+        auto push(Slot const slot) -> void {
+            stack.slots.push_back(slot);
+            stack.depth += slot.size;
+            update_requirement(stack.depth);
+        }
+
+        auto pop(Slot const expected) -> void {
+            if (stack.slots.empty()) {
+                fail("stack underflow: expected {}, but the stack is empty", describe(expected));
+            }
+
+            Slot& top = stack.slots.back();
+
+            if (top.type == Slot::Type::bytes && top.size > expected.size) {
+                top.size -= expected.size;
+            }
+            else if (top == expected || top == bytes(expected.size)) {
+                stack.slots.pop_back();
+            }
+            else {
+                fail("expected {}, but found {}", describe(expected), describe(top));
+            }
+
+            stack.depth -= expected.size;
+            lowest_depth = std::min(lowest_depth, stack.depth);
+        }
+
+        auto pop_bytes(bu::Usize size) -> void {
+            while (size != 0) {
+                if (stack.slots.empty()) {
+                    fail("stack underflow: {} more bytes were expected, but the stack is empty", size);
+                }
+
+                Slot& top = stack.slots.back();
+
+                if (top.size <= size) {
+                    size        -= top.size;
+                    stack.depth -= top.size;
+                    stack.slots.pop_back();
+                }
+                else if (top.type == Slot::Type::bytes) {
+                    top.size    -= size;
+                    stack.depth -= size;
+                    size         = 0;
+                }
+                else {
+                    fail("the copy of {} more bytes would split {}", size, describe(top));
+                }
+            }
+            lowest_depth = std::min(lowest_depth, stack.depth);
+        }
+
+        auto replace(Slot const operand, Slot const result) -> void {
+            pop(operand);
+            push(result);
+        }
+
+        auto binary(Slot const operand, Slot const result) -> void {
+            pop(operand);
+            pop(operand);
+            push(result);
+        }
+
+        auto update_requirement(bu::Usize const requirement) noexcept -> void {
+            if (requirement > function.stack_requirement) {
+                function.stack_requirement = requirement;
+                function.peak_offset       = offset;
+            }
+        }
+
+        auto check_jump_target(bu::Usize const target) const -> void {
+            if (target >= code.size() || !is_instruction_start[target]) {
+                fail("the jump target {} is not the start of an instruction", target);
+            }
+        }
+
+        auto local_jump_target(bu::Usize const next, bu::Isize const jump_offset) const -> bu::Usize {
+            auto const target = static_cast<bu::Isize>(next) + jump_offset;
+            if (target < 0) {
+                fail("the local jump target {} is before the start of the bytecode", target);
+            }
+            check_jump_target(static_cast<bu::Usize>(target));
+            return static_cast<bu::Usize>(target);
+        }
+
+        // Instructions shared by several functions keep the lowest preserved depth of any of them
+        auto record_node(
+            std::array<bu::Usize, 2> const& successors,
+            bu::Usize                const  successor_count,
+            bool                     const  is_function_entry) -> void
+        {
+            auto& node = (*graph)[offset];
+            if (node) {
+                node->preserved_depth    = std::min(node->preserved_depth, lowest_depth);
+                node->is_function_entry |= is_function_entry;
+            }
+            else {
+                node = vm::Control_flow_node {
+                    .successors        = successors,
+                    .successor_count   = successor_count,
+                    .preserved_depth   = lowest_depth,
+                    .is_function_entry = is_function_entry,
+                };
+            }
+        }
+
+        auto find_instruction_starts() -> void {
+            is_instruction_start.assign(code.size(), false);
+
+            for (offset = 0; offset != code.size(); ) {
+                auto const opcode = static_cast<Opcode>(code[offset]);
+
+                if (opcode >= Opcode::_opcode_count) {
+                    fail("invalid opcode {}", static_cast<bu::U8>(opcode));
+                }
+                if (code.size() - offset < 1 + vm::argument_bytes(opcode)) {
+                    fail("the arguments of {} are truncated by the end of the bytecode", opcode);
+                }
+
+                is_instruction_start[offset] = true;
+                offset += 1 + vm::argument_bytes(opcode);
+            }
+        }
+
+        // Returns the number of bytes the function at entry needs on top of its
+        // activation record, including the frames of the functions it calls.
+        auto verify_function(bu::Usize const entry, bool const is_entry_point) -> Function {
+            if (Function const* const existing = functions.find(entry)) {
+                if (existing->is_being_verified) {
+                    fail("recursive call to the function at offset {}; the depth of the stack can not be bounded", entry);
+                }
+                return *existing;
+            }
+            check_jump_target(entry);
+            functions.add(bu::Usize { entry }, Function { .is_being_verified = true });
+
+            // Save the state of the caller, which is resumed afterwards
+            auto const     caller_offset   = offset;
+            Abstract_stack caller_stack    = std::move(stack);
+            Function const caller_function = function;
+            auto const     caller_entry    = function_entry;
+            auto const     caller_lowest   = lowest_depth;
+
+            function       = Function { .peak_offset = entry };
+            function_entry = entry;
+
+            // The states are keyed by offset rather than held in a vector as long as the
+            // bytecode, so verifying a function takes time and memory in proportion to
+            // the function, not to the bytecode, and so does every caller on the way to it
+            std::unordered_map<bu::Usize, Abstract_stack> states { { entry, Abstract_stack {} } };
+            std::vector<bu::Usize>                        worklist { entry };
+
+            while (!worklist.empty()) {
+                offset = worklist.back();
+                worklist.pop_back();
+                stack        = states.find(offset)->second;
+                lowest_depth = stack.depth;
+
+                auto const [successors, successor_count] = verify_instruction(is_entry_point);
+
+                if (graph) {
+                    record_node(successors, successor_count, offset == entry);
+                }
+
+                for (bu::Usize const successor : std::span { successors }.first(successor_count)) {
+                    if (successor == code.size()) {
+                        fail("control flow reaches the end of the bytecode");
+                    }
+                    auto const [state, is_new] = states.try_emplace(successor, stack);
+                    if (is_new) {
+                        worklist.push_back(successor);
+                    }
+                    else if (state->second.regions != stack.regions) {
+                        fail(
+                            "inconsistent heap regions at offset {}: {} are open along one path, and {} along another",
+                            successor,
+                            state->second.regions,
+                            stack.regions
+                        );
+                    }
+                    else if (state->second != stack) {
+                        fail(
+                            "inconsistent stacks at offset {}: {} along one path, and {} along another",
+                            successor,
+                            describe(state->second),
+                            describe(stack)
+                        );
+                    }
+                }
+            }
+
+            Function const verified = function;
+
+            offset         = caller_offset;
+            stack          = std::move(caller_stack);
+            function       = caller_function;
+            function_entry = caller_entry;
+            lowest_depth   = caller_lowest;
+
+            *functions.find(entry) = verified;
+            return verified;
+        }
+
+        // Applies the effect of the instruction at offset to the abstract stack, and
+        // returns the offsets at which execution may continue. The successors are
+        // returned in a fixed-size buffer to avoid an allocation per instruction.
+        auto verify_instruction(bool const is_entry_point) -> bu::Pair<std::array<bu::Usize, 2>, bu::Usize> {
+            auto const opcode = static_cast<Opcode>(code[offset]);
+            auto const next   = offset + 1 + vm::argument_bytes(opcode);
+
+            auto const outside_of_function = [&] {
+                if (is_entry_point) {
+                    fail("{} is only valid within a function", opcode);
+                }
+            };
+
+            // Regions are tied to the function that enters them, so it must exit them before it returns
+            auto const leave_function = [&] {
+                if (stack.regions != 0) {
+                    fail("{} leaves {} heap regions open", opcode, stack.regions);
+                }
+            };
+
+            auto const call_function = [&](bu::Usize const return_value_size, bu::Usize const target) {
+                auto const callee = verify_function(target, false);
+                update_requirement(stack.depth + return_value_size + sizeof(vm::Activation_record) + callee.stack_requirement);
+                if (return_value_size != 0) {
+                    push(bytes(return_value_size));
+                }
+            };
+
+            switch (opcode) {
+            case Opcode::ipush: push(integer);   break;
+            case Opcode::fpush: push(floating);  break;
+            case Opcode::cpush: push(character); break;
+            case Opcode::spush:
+                if (auto const index = argument<bu::Usize>(); index >= string_count) {
+                    fail("the string constant index {} is out of range, as there are only {} string constants", index, string_count);
+                }
+                push(string);
+                break;
+            case Opcode::push_true:
+            case Opcode::push_false:
+                push(boolean);
+                break;
+
+            case Opcode::idup: pop(integer);   push(integer);   push(integer);   break;
+            case Opcode::fdup: pop(floating);  push(floating);  push(floating);  break;
+            case Opcode::cdup: pop(character); push(character); push(character); break;
+            case Opcode::sdup: pop(string);    push(string);    push(string);    break;
+            case Opcode::bdup: pop(boolean);   push(boolean);   push(boolean);   break;
+
+            case Opcode::iprint: pop(integer);   break;
+            case Opcode::fprint: pop(floating);  break;
+            case Opcode::cprint: pop(character); break;
+            case Opcode::sprint: pop(string);    break;
+            case Opcode::bprint: pop(boolean);   break;
+            case Opcode::flush:                  break;
+
+            case Opcode::yield: break;
+
+            case Opcode::iadd:
+            case Opcode::isub:
+            case Opcode::imul:
+            case Opcode::idiv:
+            case Opcode::iadd_checked:
+            case Opcode::isub_checked:
+            case Opcode::imul_checked:
+                binary(integer, integer);
+                break;
+            case Opcode::fadd:
+            case Opcode::fsub:
+            case Opcode::fmul:
+            case Opcode::fdiv:
+                binary(floating, floating);
+                break;
+
+            case Opcode::iinc_top:
+                replace(integer, integer);
+                break;
+
+            case Opcode::ieq: case Opcode::ineq: case Opcode::ilt: case Opcode::ilte: case Opcode::igt: case Opcode::igte:
+                binary(integer, boolean);
+                break;
+            case Opcode::feq: case Opcode::fneq: case Opcode::flt: case Opcode::flte: case Opcode::fgt: case Opcode::fgte:
+                binary(floating, boolean);
+                break;
+            case Opcode::ceq: case Opcode::cneq:
+                binary(character, boolean);
+                break;
+            case Opcode::beq: case Opcode::bneq:
+                binary(boolean, boolean);
+                break;
+
+            case Opcode::ieq_i: case Opcode::ineq_i: case Opcode::ilt_i: case Opcode::ilte_i: case Opcode::igt_i: case Opcode::igte_i:
+                replace(integer, boolean);
+                break;
+            case Opcode::feq_i: case Opcode::fneq_i: case Opcode::flt_i: case Opcode::flte_i: case Opcode::fgt_i: case Opcode::fgte_i:
+                replace(floating, boolean);
+                break;
+            case Opcode::ceq_i: case Opcode::cneq_i:
+                replace(character, boolean);
+                break;
+            case Opcode::beq_i: case Opcode::bneq_i:
+                replace(boolean, boolean);
+                break;
+
+            case Opcode::land:
+            case Opcode::lnand:
+            case Opcode::lor:
+            case Opcode::lnor:
+                binary(boolean, boolean);
+                break;
+            case Opcode::lnot:
+                replace(boolean, boolean);
+                break;
+
+            case Opcode::cast_itof: replace(integer,   floating);  break;
+            case Opcode::cast_ftoi: replace(floating,  integer);   break;
+            case Opcode::cast_itoc: replace(integer,   character); break;
+            case Opcode::cast_ctoi: replace(character, integer);   break;
+            case Opcode::cast_itob: replace(integer,   boolean);   break;
+            case Opcode::cast_btoi: replace(boolean,   integer);   break;
+            case Opcode::cast_ftob: replace(floating,  boolean);   break;
+            case Opcode::cast_ctob: replace(character, boolean);   break;
+
+            case Opcode::ext_i8: case Opcode::ext_i16: case Opcode::ext_i32:
+            case Opcode::ext_u8: case Opcode::ext_u16: case Opcode::ext_u32:
+                replace(integer, integer);
+                break;
+            case Opcode::load_i8: case Opcode::load_i16: case Opcode::load_i32:
+            case Opcode::load_u8: case Opcode::load_u16: case Opcode::load_u32:
+                replace(pointer, integer);
+                break;
+            case Opcode::store_8: case Opcode::store_16: case Opcode::store_32:
+                pop(pointer);
+                pop(integer);
+                break;
+            case Opcode::udiv:
+                binary(integer, integer);
+                break;
+            case Opcode::ult: case Opcode::ulte: case Opcode::ugt: case Opcode::ugte:
+                binary(integer, boolean);
+                break;
+
+            case Opcode::bitcopy_from_stack:
+                pop(pointer);
+                pop_bytes(argument<vm::Local_size_type>());
+                break;
+            case Opcode::bitcopy_to_stack:
+                pop(pointer);
+                if (auto const size = argument<vm::Local_size_type>(); size != 0) {
+                    push(bytes(size));
+                }
+                break;
+            case Opcode::push_address:
+            case Opcode::push_return_value_address:
+                outside_of_function();
+                push(pointer);
+                break;
+
+            case Opcode::alloc:
+                replace(integer, pointer);
+                break;
+            case Opcode::alloc_object:
+                replace(integer, pointer);
+                break;
+            case Opcode::ivec_add:
+            case Opcode::fvec_add:
+            case Opcode::ivec_mul:
+            case Opcode::fvec_mul:
+            case Opcode::ivec_eq:
+            case Opcode::fvec_eq:
+            case Opcode::ivec_lt:
+            case Opcode::fvec_lt:
+                pop(integer);
+                pop(pointer);
+                pop(pointer);
+                pop(pointer);
+                break;
+            case Opcode::ivec_sum:
+            case Opcode::ivec_min:
+            case Opcode::ivec_max:
+                pop(integer);
+                replace(pointer, integer);
+                break;
+            case Opcode::fvec_sum:
+            case Opcode::fvec_min:
+            case Opcode::fvec_max:
+                pop(integer);
+                replace(pointer, floating);
+                break;
+            case Opcode::index_load:
+            case Opcode::index_load_unchecked:
+                pop(integer); // The index
+                pop(integer); // The length of the slice
+                pop(pointer);
+                if (auto const size = argument<vm::Local_size_type>(); size != 0) {
+                    push(bytes(size));
+                }
+                break;
+            case Opcode::index_store:
+            case Opcode::index_store_unchecked:
+                pop(integer);
+                pop(integer);
+                pop(pointer);
+                pop_bytes(argument<vm::Local_size_type>());
+                break;
+            case Opcode::check_bounds:
+                pop(integer);
+                pop(integer);
+                break;
+            case Opcode::region_enter:
+                ++stack.regions;
+                break;
+            case Opcode::region_exit:
+                if (stack.regions == 0) {
+                    fail("region_exit without a matching region_enter");
+                }
+                --stack.regions;
+                break;
+
+            case Opcode::load_local:
+                outside_of_function();
+                if (auto const size = argument<vm::Local_size_type>(sizeof(vm::Local_offset_type)); size != 0) {
+                    push(bytes(size));
+                }
+                break;
+            case Opcode::load_local_1:  case Opcode::load_local_1_short:  outside_of_function(); push(bytes(1));  break;
+            case Opcode::load_local_8:  case Opcode::load_local_8_short:  outside_of_function(); push(bytes(8));  break;
+            case Opcode::load_local_16: case Opcode::load_local_16_short: outside_of_function(); push(bytes(16)); break;
+
+            case Opcode::store_local:
+                outside_of_function();
+                pop_bytes(argument<vm::Local_size_type>(sizeof(vm::Local_offset_type)));
+                break;
+            case Opcode::store_local_1:  case Opcode::store_local_1_short:  outside_of_function(); pop_bytes(1);  break;
+            case Opcode::store_local_8:  case Opcode::store_local_8_short:  outside_of_function(); pop_bytes(8);  break;
+            case Opcode::store_local_16: case Opcode::store_local_16_short: outside_of_function(); pop_bytes(16); break;
+
+            case Opcode::jump:
+                check_jump_target(argument<vm::Jump_offset_type>());
+                return { { argument<vm::Jump_offset_type>() }, 1 };
+            case Opcode::jump_true:
+            case Opcode::jump_false:
+                pop(boolean);
+                check_jump_target(argument<vm::Jump_offset_type>());
+                return { { next, argument<vm::Jump_offset_type>() }, 2 };
+
+            case Opcode::local_jump:
+                return { { local_jump_target(next, argument<vm::Local_offset_type>()) }, 1 };
+            case Opcode::local_jump_8:
+                return { { local_jump_target(next, argument<vm::Local_offset_8_type>()) }, 1 };
+            case Opcode::local_jump_32:
+                return { { local_jump_target(next, argument<vm::Local_offset_32_type>()) }, 1 };
+            case Opcode::local_jump_true:
+            case Opcode::local_jump_false:
+                pop(boolean);
+                return { { next, local_jump_target(next, argument<vm::Local_offset_type>()) }, 2 };
+            case Opcode::local_jump_true_8:
+            case Opcode::local_jump_false_8:
+                pop(boolean);
+                return { { next, local_jump_target(next, argument<vm::Local_offset_8_type>()) }, 2 };
+            case Opcode::local_jump_true_32:
+            case Opcode::local_jump_false_32:
+                pop(boolean);
+                return { { next, local_jump_target(next, argument<vm::Local_offset_32_type>()) }, 2 };
+
+            case Opcode::local_jump_ieq_i: case Opcode::local_jump_ineq_i:
+            case Opcode::local_jump_ilt_i: case Opcode::local_jump_ilte_i:
+            case Opcode::local_jump_igt_i: case Opcode::local_jump_igte_i:
+                pop(integer);
+                return { { next, local_jump_target(next, argument<vm::Local_offset_type>()) }, 2 };
+            case Opcode::local_jump_feq_i: case Opcode::local_jump_fneq_i:
+            case Opcode::local_jump_flt_i: case Opcode::local_jump_flte_i:
+            case Opcode::local_jump_fgt_i: case Opcode::local_jump_fgte_i:
+                pop(floating);
+                return { { next, local_jump_target(next, argument<vm::Local_offset_type>()) }, 2 };
+            case Opcode::local_jump_ceq_i: case Opcode::local_jump_cneq_i:
+                pop(character);
+                return { { next, local_jump_target(next, argument<vm::Local_offset_type>()) }, 2 };
+            case Opcode::local_jump_beq_i: case Opcode::local_jump_bneq_i:
+                pop(boolean);
+                return { { next, local_jump_target(next, argument<vm::Local_offset_type>()) }, 2 };
+
+            case Opcode::call:
+                call_function(
+                    argument<vm::Local_size_type>(),
+                    argument<vm::Jump_offset_type>(sizeof(vm::Local_size_type))
+                );
+                break;
+            case Opcode::call_0:
+                call_function(0, argument<vm::Jump_offset_type>());
+                break;
+            case Opcode::call_32:
+                call_function(
+                    argument<vm::Local_size_type>(),
+                    argument<vm::Jump_offset_32_type>(sizeof(vm::Local_size_type))
+                );
+                break;
+            case Opcode::call_0_32:
+                call_function(0, argument<vm::Jump_offset_32_type>());
+                break;
+            case Opcode::tail_call:
+            {
+                outside_of_function();
+                leave_function();
+                pop_bytes(argument<vm::Local_size_type>(sizeof(vm::Local_size_type)));
+
+                // The callee reuses the current frame, so a tail call of the current function
+                // is a loop. Any other callee must not be recursive, and needs its own
+                // requirement on top of the activation record.
+                auto const target = argument<vm::Jump_offset_type>(2 * sizeof(vm::Local_size_type));
+                if (target != function_entry) {
+                    update_requirement(verify_function(target, false).stack_requirement);
+                }
+                return { {}, 0 };
+            }
+            case Opcode::ret:
+                outside_of_function();
+                leave_function();
+                return { {}, 0 };
+
+            case Opcode::ipush_iadd:
+            case Opcode::ipush_isub:
+            case Opcode::ipush_imul:
+            case Opcode::ipush_idiv:
+                replace(integer, integer);
+                break;
+
+            case Opcode::idup_local_jump_ieq_i: case Opcode::idup_local_jump_ineq_i:
+            case Opcode::idup_local_jump_ilt_i: case Opcode::idup_local_jump_ilte_i:
+            case Opcode::idup_local_jump_igt_i: case Opcode::idup_local_jump_igte_i:
+                replace(integer, integer);
+                return { { next, local_jump_target(next, argument<vm::Local_offset_type>()) }, 2 };
+
+            case Opcode::halt:
+                pop(integer); // The exit code
+                return { {}, 0 };
+
+            default:
+                std::unreachable();
+            }
+
+            return { { next }, 1 };
+        }
+
+    public:
+
+        Verifier(std::span<std::byte const> const code, bu::Usize const string_count) noexcept
+            : code         { code }
+            , string_count { string_count } {}
+
+        auto verify(bu::Usize const stack_capacity) -> bu::Usize {
+            if (code.empty()) {
+                fail("the bytecode is empty");
+            }
+
+            find_instruction_starts();
+
+            auto const [stack_requirement, peak_offset, _] = verify_function(0, true);
+
+            if (stack_requirement > stack_capacity) {
+                offset = peak_offset;
+                fail(
+                    "the stack may grow to {} bytes here, which exceeds its capacity of {} bytes",
+                    stack_requirement,
+                    stack_capacity
+                );
+            }
+
+            return stack_requirement;
+        }
+
+        auto control_flow_graph() -> std::vector<std::optional<vm::Control_flow_node>> {
+            std::vector<std::optional<vm::Control_flow_node>> nodes(code.size());
+            graph = &nodes;
+            verify(std::numeric_limits<bu::Usize>::max());
+            graph = nullptr;
+            return nodes;
+        }
+    };
+
+}
+
+
+vm::Verification_error::Verification_error(bu::Usize const offset, std::string&& reason)
+    : bu::Exception { std::format("Bytecode verification failed at offset {}: {}", offset, reason) }
+    , offset        { offset }
+    , reason        { std::move(reason) } {}
+
+
+auto vm::verify(Executable_program const& program, bu::Usize const stack_capacity)
+    -> std::expected<bu::Usize, Verification_error>
+{
+    return verify(
+        program.bytecode.bytes,
+        std::max(program.constants.string_pool.size(), program.constants.string_buffer_views.size()),
+        stack_capacity
+    );
+}
+
+
+auto vm::verify(std::span<std::byte const> const bytecode, bu::Usize const string_count, bu::Usize const stack_capacity)
+    -> std::expected<bu::Usize, Verification_error>
+{
+    try {
+        return Verifier { bytecode, string_count }.verify(stack_capacity);
+    }
+    catch (Verification_error& error) {
+        return std::unexpected { std::move(error) };
+    }
+}
+
+
+auto vm::control_flow_graph(Executable_program const& program)
+    -> std::expected<std::vector<std::optional<Control_flow_node>>, Verification_error>
+{
+    try {
+        return Verifier {
+            program.bytecode.bytes,
+            std::max(program.constants.string_pool.size(), program.constants.string_buffer_views.size())
+        }.control_flow_graph();
+    }
+    catch (Verification_error& error) {
+        return std::unexpected { std::move(error) };
+    }
+}
\ No newline at end of file
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "bu/utilities.hpp"
+#include "virtual_machine.hpp"
+
+
+namespace vm {
+
+    struct [[nodiscard]] Verification_error : bu::Exception {
+        bu::Usize   offset;
+        std::string reason;
+
+        Verification_error(bu::Usize offset, std::string&& reason);
+    };
+
+
+    // Proves through abstract interpretation that every instruction reachable from
+    // the start of the bytecode finds the operands it expects on the stack, that
+    // every jump lands on an instruction, and that the stack never grows beyond
+    // stack_capacity. On success, returns the largest number of bytes the program
+    // can occupy on the stack. Recursive calls are rejected, because the depth of
+    // the stack can not be bounded in their presence.
+    auto verify(Executable_program const&, bu::Usize stack_capacity)
+        -> std::expected<bu::Usize, Verification_error>;
+
+    // Verifies bytecode that is not owned by an Executable_program, such as that of a Mapped_program
+    auto verify(std::span<std::byte const> bytecode, bu::Usize string_count, bu::Usize stack_capacity)
+        -> std::expected<bu::Usize, Verification_error>;
+
+
+    // What verification established about an instruction, for analyses of the bytecode
+    struct Control_flow_node {
+        std::array<bu::Usize, 2> successors;        // The next instruction comes first. Called functions are not successors.
+        bu::Usize                successor_count   = 0;
+        bu::Usize                preserved_depth   = 0; // Apart from store_local, the instruction leaves the stack of its frame below this depth unchanged
+        bool                     is_function_entry = false;
+    };
+
+    // Verifies the program without a limit on the size of the stack, and returns a node for
+    // every offset in its bytecode at which an instruction that can be reached begins
+    auto control_flow_graph(Executable_program const&)
+        -> std::expected<std::vector<std::optional<Control_flow_node>>, Verification_error>;
+
+}
\ No newline at end of file
@@ -1,7 +1,12 @@
 #include "bu/utilities.hpp"
+#include "bu/safe_integer.hpp"
 #include "virtual_machine.hpp"
 #include "opcode.hpp"
 #include "vm_formatting.hpp"
+#include "verifier.hpp"
+#include "stack_guard.hpp"
+#include "jit.hpp"
+#include "vector_kernels.hpp"
 
 
 namespace {
@@ -12,179 +17,507 @@ namespace {
 
 
     template <bu::trivial T>
-    auto push(VM& vm) -> void {
+    ALWAYS_INLINE auto extract(std::byte*& pointer) noexcept -> T {
+        if constexpr (sizeof(T) == 1) {
+            return static_cast<T>(*pointer++);
+        }
+        else {
+            T argument;
+            std::memcpy(&argument, pointer, sizeof(T));
+            pointer += sizeof(T);
+            return argument;
+        }
+    }
+
+
+    // Every engine runs on a copy of the registers of the fiber. In the threaded
+    // engine the copy lives in the engine's stack frame and its address never escapes,
+    // because every handler is inlined. This lets the compiler keep the registers in
+    // hardware registers instead of reloading them after every store to the stack.
+    // Stack is either bu::Bytestack_cursor, bu::Unchecked_bytestack_cursor when the
+    // program has been verified, or bu::Guarded_bytestack_cursor when the stack is
+    // watched by a vm::Stack_guard. Without a budget, every budget operation compiles
+    // to nothing, so an unbudgeted resume runs exactly the code it ran before budgets
+    // existed, and the same goes for the instruction addresses published to a guard
+    // and for the entries recorded in the execution trace.
+    template <class Stack, bool budgeted, bool traced = false>
+    struct Registers {
+        static constexpr bool is_budgeted = budgeted;
+        static constexpr bool is_guarded  = std::same_as<Stack, bu::Guarded_bytestack_cursor>;
+        static constexpr bool is_verified = std::same_as<Stack, bu::Unchecked_bytestack_cursor>;
+        static constexpr bool is_traced   = traced;
+
+        using Traced = Registers<Stack, budgeted, true>;
+
+        vm::Fiber&              fiber;
+        Stack                   stack;
+        std::byte*              instruction_pointer;
+        std::byte*              instruction_anchor;
+        vm::Activation_record*  activation_record;
+        String const*           string_pool;
+        vm::Stack_maps const&   stack_maps;
+        vm::Output_buffer&      output;
+        vm::Collection_profile& collection_profile;
+        bu::Usize               budget;               // Only used when is_budgeted
+        vm::Stack_guard*        guard;                // Only used when is_guarded
+        vm::Execution_trace*    trace;                // Only used when is_traced
+        std::byte*              stack_bottom;         // Only used when is_traced
+        bool                    keep_running = true;
+        bool                    has_halted   = false; // Otherwise the fiber stopped at a yield or ran out of budget
+
+        Registers(VM& machine, vm::Fiber& fiber) noexcept
+            : fiber               { fiber }
+            , stack               { fiber.stack }
+            , instruction_pointer { fiber.instruction_pointer }
+            , instruction_anchor  { machine.code().data() }
+            , activation_record   { fiber.activation_record }
+            , string_pool         { machine.string_pool().data() }
+            , stack_maps          { machine.image->stack_maps() }
+            , output              { machine.output }
+            , collection_profile  { machine.collection_profile }
+            , budget              { machine.budget }
+            , guard               { is_guarded ? vm::Stack_guard::current() : nullptr }
+            , trace               { is_traced ? &machine.trace : nullptr }
+            , stack_bottom        { is_traced ? fiber.stack.base() : nullptr } {}
+
+        auto write_back() noexcept -> vm::Stop_reason {
+            if (has_halted) {
+                fiber.exit_code = static_cast<int>(stack.template pop<bu::Isize>());
+            }
+            fiber.stack.pointer       = stack.pointer;
+            fiber.instruction_pointer = instruction_pointer;
+            fiber.activation_record   = activation_record;
+
+            if (has_halted) {
+                return vm::Stop_reason::halt;
+            }
+            if (is_budgeted && budget == 0) {
+                return vm::Stop_reason::budget;
+            }
+            return vm::Stop_reason::yield;
+        }
+
+        template <bu::trivial T>
+        ALWAYS_INLINE auto extract_argument() noexcept -> T {
+            return extract<T>(instruction_pointer);
+        }
+
+        // Reads the opcode of the next instruction. With a guard, the address of the
+        // instruction is published first, and the fence keeps the compiler from moving
+        // the stack accesses of the instruction above the store. When traced, the
+        // instruction is recorded before it executes.
+        ALWAYS_INLINE auto fetch_opcode() noexcept -> vm::Opcode {
+            if constexpr (is_guarded) {
+                guard->instruction = instruction_pointer;
+                std::atomic_signal_fence(std::memory_order_seq_cst);
+            }
+            if constexpr (is_traced) {
+                trace->record(
+                    static_cast<vm::Opcode>(*instruction_pointer),
+                    static_cast<bu::Usize>(instruction_pointer - instruction_anchor),
+                    static_cast<bu::Usize>(stack.pointer - stack_bottom)
+                );
+            }
+            return extract_argument<vm::Opcode>();
+        }
+
+        ALWAYS_INLINE auto jump_to(vm::Jump_offset_type const offset) noexcept -> void {
+            instruction_pointer = instruction_anchor + offset;
+        }
+
+        // Called at every backward jump and every call, which together bound the
+        // number of instructions that can run before the next check
+        ALWAYS_INLINE auto charge_budget() noexcept -> void {
+            if constexpr (is_budgeted) {
+                if (--budget == 0) [[unlikely]] {
+                    keep_running = false;
+                }
+            }
+        }
+
+        // Jumps to the target, which is backward if it is not past the jump itself
+        ALWAYS_INLINE auto branch_to(std::byte* const target) noexcept -> void {
+            if constexpr (is_budgeted) {
+                if (target < instruction_pointer) {
+                    charge_budget();
+                }
+            }
+            instruction_pointer = target;
+        }
+    };
+
+
+    template <bu::trivial T>
+    ALWAYS_INLINE auto push(auto& vm) -> void {
         if constexpr (std::same_as<T, String>) {
-            vm.stack.push(vm.program.constants.string_pool[vm.extract_argument<bu::Usize>()]);
+            vm.stack.push(vm.string_pool[vm.template extract_argument<bu::Usize>()]);
         }
         else {
-            vm.stack.push(vm.extract_argument<T>());
+            vm.stack.push(vm.template extract_argument<T>());
         }
     }
 
     template <bool value>
-    auto push_bool(VM& vm) -> void {
+    ALWAYS_INLINE auto push_bool(auto& vm) -> void {
         vm.stack.push(value);
     }
 
     template <bu::trivial T>
-    auto dup(VM& vm) -> void {
-        vm.stack.push(vm.stack.top<T>());
+    ALWAYS_INLINE auto dup(auto& vm) -> void {
+        vm.stack.push(vm.stack.template top<T>());
     }
 
     template <bu::trivial T>
-    auto print(VM& vm) -> void {
-        auto const popped = vm.stack.pop<T>();
+    ALWAYS_INLINE auto print(auto& vm) -> void {
+        auto const popped = vm.stack.template pop<T>();
 
         if constexpr (std::same_as<T, String>) {
-            vm.output_buffer.insert(
-                vm.output_buffer.end(),
-                popped.pointer,
-                popped.pointer + popped.length
-            );
+            vm.output.print(std::string_view { popped.pointer, popped.length });
         }
         else {
-            std::format_to(std::back_inserter(vm.output_buffer), "{}\n", popped);
+            vm.output.print(popped);
         }
+    }
 
-        vm.flush_output(); // Adjust flush frequency later
+    ALWAYS_INLINE auto flush(auto& vm) -> void {
+        vm.output.flush();
     }
 
     template <class T, template <class> class F>
-    auto binary_op(VM& vm) -> void {
-        auto const right = vm.stack.pop<T>();
-        auto const left  = vm.stack.pop<T>();
+    ALWAYS_INLINE auto binary_op(auto& vm) -> void {
+        auto const right = vm.stack.template pop<T>();
+        auto const left  = vm.stack.template pop<T>();
         vm.stack.push(F<T>{}(left, right));
     }
 
     template <class T, template <class> class F>
-    auto immediate_binary_op(VM& vm) -> void {
-        auto const right = vm.stack.pop<T>();
-        auto const left  = vm.extract_argument<T>();
+    ALWAYS_INLINE auto immediate_binary_op(auto& vm) -> void {
+        auto const right = vm.stack.template pop<T>();
+        auto const left  = vm.template extract_argument<T>();
         vm.stack.push(F<T>{}(left, right));
     }
 
-    template <class T> constexpr auto add = binary_op<T, std::plus>;
-    template <class T> constexpr auto sub = binary_op<T, std::minus>;
-    template <class T> constexpr auto mul = binary_op<T, std::multiplies>;
-    template <class T> constexpr auto div = binary_op<T, std::divides>;
+    using bu::wrapping_plus;
+    using bu::wrapping_minus;
+    using bu::wrapping_multiplies;
+
+    template <class T> ALWAYS_INLINE auto add(auto& vm) -> void { binary_op<T, wrapping_plus>(vm); }
+    template <class T> ALWAYS_INLINE auto sub(auto& vm) -> void { binary_op<T, wrapping_minus>(vm); }
+    template <class T> ALWAYS_INLINE auto mul(auto& vm) -> void { binary_op<T, wrapping_multiplies>(vm); }
+    template <class T> ALWAYS_INLINE auto div(auto& vm) -> void { binary_op<T, std::divides>(vm); }
+
+    template <class T> ALWAYS_INLINE auto eq(auto& vm)  -> void { binary_op<T, std::equal_to>(vm); }
+    template <class T> ALWAYS_INLINE auto neq(auto& vm) -> void { binary_op<T, std::not_equal_to>(vm); }
+    template <class T> ALWAYS_INLINE auto lt(auto& vm)  -> void { binary_op<T, std::less>(vm); }
+    template <class T> ALWAYS_INLINE auto lte(auto& vm) -> void { binary_op<T, std::less_equal>(vm); }
+    template <class T> ALWAYS_INLINE auto gt(auto& vm)  -> void { binary_op<T, std::greater>(vm); }
+    template <class T> ALWAYS_INLINE auto gte(auto& vm) -> void { binary_op<T, std::greater_equal>(vm); }
+
+    template <class T> ALWAYS_INLINE auto add_i(auto& vm) -> void { immediate_binary_op<T, std::equal_to>(vm); }
+    template <class T> ALWAYS_INLINE auto sub_i(auto& vm) -> void { immediate_binary_op<T, std::minus>(vm); }
+    template <class T> ALWAYS_INLINE auto mul_i(auto& vm) -> void { immediate_binary_op<T, std::multiplies>(vm); }
+    template <class T> ALWAYS_INLINE auto div_i(auto& vm) -> void { immediate_binary_op<T, std::divides>(vm); }
+
+    template <class T> ALWAYS_INLINE auto eq_i(auto& vm)  -> void { immediate_binary_op<T, std::equal_to>(vm); }
+    template <class T> ALWAYS_INLINE auto neq_i(auto& vm) -> void { immediate_binary_op<T, std::not_equal_to>(vm); }
+    template <class T> ALWAYS_INLINE auto lt_i(auto& vm)  -> void { immediate_binary_op<T, std::less>(vm); }
+    template <class T> ALWAYS_INLINE auto lte_i(auto& vm) -> void { immediate_binary_op<T, std::less_equal>(vm); }
+    template <class T> ALWAYS_INLINE auto gt_i(auto& vm)  -> void { immediate_binary_op<T, std::greater>(vm); }
+    template <class T> ALWAYS_INLINE auto gte_i(auto& vm) -> void { immediate_binary_op<T, std::greater_equal>(vm); }
+
+    ALWAYS_INLINE auto land(auto& vm) -> void { binary_op<bool, std::logical_and>(vm); }
+    ALWAYS_INLINE auto lor(auto& vm)  -> void { binary_op<bool, std::logical_or>(vm); }
+
+    ALWAYS_INLINE auto lnand(auto& vm) -> void {
+        vm.stack.push(!(vm.stack.template pop<bool>() && vm.stack.template pop<bool>()));
+    }
 
-    template <class T> constexpr auto eq  = binary_op<T, std::equal_to>;
-    template <class T> constexpr auto neq = binary_op<T, std::not_equal_to>;
-    template <class T> constexpr auto lt  = binary_op<T, std::less>;
-    template <class T> constexpr auto lte = binary_op<T, std::less_equal>;
-    template <class T> constexpr auto gt  = binary_op<T, std::greater>;
-    template <class T> constexpr auto gte = binary_op<T, std::greater_equal>;
+    ALWAYS_INLINE auto lnor(auto& vm) -> void {
+        vm.stack.push(!(vm.stack.template pop<bool>() || vm.stack.template pop<bool>()));
+    }
 
-    template <class T> constexpr auto add_i = immediate_binary_op<T, std::equal_to>;
-    template <class T> constexpr auto sub_i = immediate_binary_op<T, std::minus>;
-    template <class T> constexpr auto mul_i = immediate_binary_op<T, std::multiplies>;
-    template <class T> constexpr auto div_i = immediate_binary_op<T, std::divides>;
+    ALWAYS_INLINE auto lnot(auto& vm) -> void {
+        vm.stack.push(!vm.stack.template pop<bool>());
+    }
 
-    template <class T> constexpr auto eq_i  = immediate_binary_op<T, std::equal_to>;
-    template <class T> constexpr auto neq_i = immediate_binary_op<T, std::not_equal_to>;
-    template <class T> constexpr auto lt_i  = immediate_binary_op<T, std::less>;
-    template <class T> constexpr auto lte_i = immediate_binary_op<T, std::less_equal>;
-    template <class T> constexpr auto gt_i  = immediate_binary_op<T, std::greater>;
-    template <class T> constexpr auto gte_i = immediate_binary_op<T, std::greater_equal>;
+    template <bu::trivial From, bu::trivial To>
+    ALWAYS_INLINE auto cast(auto& vm) -> void {
+        vm.stack.push(static_cast<To>(vm.stack.template pop<From>()));
+    }
 
-    constexpr auto land = binary_op<bool, std::logical_and>;
-    constexpr auto lor  = binary_op<bool, std::logical_or>;
+    // Wraps the integer on top of the stack into the range of T
+    template <std::integral T>
+    ALWAYS_INLINE auto extend(auto& vm) -> void {
+        vm.stack.push(static_cast<bu::Isize>(static_cast<T>(vm.stack.template pop<bu::Isize>())));
+    }
 
-    auto lnand(VM& vm) -> void {
-        vm.stack.push(!(vm.stack.pop<bool>() && vm.stack.pop<bool>()));
+    template <std::integral T>
+    ALWAYS_INLINE auto load_narrow(auto& vm) -> void {
+        T value;
+        std::memcpy(&value, vm.stack.template pop<std::byte*>(), sizeof value);
+        vm.stack.push(static_cast<bu::Isize>(value));
     }
 
-    auto lnor(VM& vm) -> void {
-        vm.stack.push(!(vm.stack.pop<bool>() || vm.stack.pop<bool>()));
+    template <std::integral T>
+    ALWAYS_INLINE auto store_narrow(auto& vm) -> void {
+        auto const destination = vm.stack.template pop<std::byte*>();
+        auto const value       = static_cast<T>(vm.stack.template pop<bu::Isize>());
+        std::memcpy(destination, &value, sizeof value);
     }
 
-    auto lnot(VM& vm) -> void {
-        vm.stack.push(!vm.stack.pop<bool>());
+    ALWAYS_INLINE auto iinc_top(auto& vm) -> void {
+        vm.stack.push(wrapping_plus<bu::Isize>{}(vm.stack.template pop<bu::Isize>(), 1));
     }
 
-    template <bu::trivial From, bu::trivial To>
-    auto cast(VM& vm) -> void {
-        vm.stack.push(static_cast<To>(vm.stack.pop<From>()));
+
+    // Kept out of line, so that the handlers that can trap stay small
+    [[noreturn]] auto trap_overflow(bu::Usize const offset, bu::Isize const left, char const symbol, bu::Isize const right) -> void {
+        throw vm::Trap { offset, std::format("{} {} {} overflows", left, symbol, right) };
     }
 
-    auto iinc_top(VM& vm) -> void {
-        vm.stack.push(vm.stack.pop<bu::Isize>() + 1);
+    // With GCC and Clang the check is a single test of the overflow flag
+    template <auto overflows, char symbol>
+    ALWAYS_INLINE auto checked_op(auto& vm) -> void {
+        auto const right = vm.stack.template pop<bu::Isize>();
+        auto const left  = vm.stack.template pop<bu::Isize>();
+
+        bu::Isize result;
+        if (overflows(left, right, result)) [[unlikely]] {
+            trap_overflow(static_cast<bu::Usize>(vm.instruction_pointer - 1 - vm.instruction_anchor), left, symbol, right);
+        }
+        vm.stack.push(result);
     }
 
+    ALWAYS_INLINE auto iadd_checked(auto& vm) -> void { checked_op<bu::add_overflow<bu::Isize>, '+'>(vm); }
+    ALWAYS_INLINE auto isub_checked(auto& vm) -> void { checked_op<bu::subtract_overflow<bu::Isize>, '-'>(vm); }
+    ALWAYS_INLINE auto imul_checked(auto& vm) -> void { checked_op<bu::multiply_overflow<bu::Isize>, '*'>(vm); }
+
 
-    auto jump(VM& vm) -> void {
-        vm.jump_to(vm.extract_argument<vm::Jump_offset_type>());
+    ALWAYS_INLINE auto jump(auto& vm) -> void {
+        auto const offset = vm.template extract_argument<vm::Jump_offset_type>();
+        vm.branch_to(vm.instruction_anchor + offset);
     }
 
     template <bool value>
-    auto jump_bool(VM& vm) -> void {
-        auto const offset = vm.extract_argument<vm::Jump_offset_type>();
-        if (vm.stack.pop<bool>() == value) {
-            vm.jump_to(offset);
+    ALWAYS_INLINE auto jump_bool(auto& vm) -> void {
+        auto const offset = vm.template extract_argument<vm::Jump_offset_type>();
+        if (vm.stack.template pop<bool>() == value) {
+            vm.branch_to(vm.instruction_anchor + offset);
         }
     }
 
-    auto local_jump(VM& vm) -> void {
-        vm.instruction_pointer += vm.extract_argument<vm::Local_offset_type>();
+    template <class Offset>
+    ALWAYS_INLINE auto local_jump(auto& vm) -> void {
+        auto const offset = vm.template extract_argument<Offset>();
+        vm.branch_to(vm.instruction_pointer + offset);
     }
 
-    template <bool value>
-    auto local_jump_bool(VM& vm) -> void {
-        auto const offset = vm.extract_argument<vm::Local_offset_type>();
-        if (vm.stack.pop<bool>() == value) {
-            vm.instruction_pointer += offset;
+    template <bool value, class Offset>
+    ALWAYS_INLINE auto local_jump_bool(auto& vm) -> void {
+        auto const offset = vm.template extract_argument<Offset>();
+        if (vm.stack.template pop<bool>() == value) {
+            vm.branch_to(vm.instruction_pointer + offset);
         }
     }
 
 
     template <class T, template <class> class F>
         requires std::is_same_v<std::invoke_result_t<F<T>, T, T>, bool>
-    auto local_jump_immediate(VM& vm) -> void {
-        auto const offset = vm.extract_argument<vm::Local_offset_type>();
-        auto const right  = vm.stack.pop<T>();
-        auto const left   = vm.extract_argument<T>();
+    ALWAYS_INLINE auto local_jump_immediate(auto& vm) -> void {
+        auto const offset = vm.template extract_argument<vm::Local_offset_type>();
+        auto const right  = vm.stack.template pop<T>();
+        auto const left   = vm.template extract_argument<T>();
 
         if (F<T>{}(left, right)) {
-            vm.instruction_pointer += offset;
+            vm.branch_to(vm.instruction_pointer + offset);
         }
     }
 
-    template <class T> constexpr auto local_jump_eq_i  = local_jump_immediate<T, std::equal_to>;
-    template <class T> constexpr auto local_jump_neq_i = local_jump_immediate<T, std::not_equal_to>;
-    template <class T> constexpr auto local_jump_lt_i  = local_jump_immediate<T, std::less>;
-    template <class T> constexpr auto local_jump_lte_i = local_jump_immediate<T, std::less_equal>;
-    template <class T> constexpr auto local_jump_gt_i  = local_jump_immediate<T, std::greater>;
-    template <class T> constexpr auto local_jump_gte_i = local_jump_immediate<T, std::greater_equal>;
+    template <class T> ALWAYS_INLINE auto local_jump_eq_i(auto& vm)  -> void { local_jump_immediate<T, std::equal_to>(vm); }
+    template <class T> ALWAYS_INLINE auto local_jump_neq_i(auto& vm) -> void { local_jump_immediate<T, std::not_equal_to>(vm); }
+    template <class T> ALWAYS_INLINE auto local_jump_lt_i(auto& vm)  -> void { local_jump_immediate<T, std::less>(vm); }
+    template <class T> ALWAYS_INLINE auto local_jump_lte_i(auto& vm) -> void { local_jump_immediate<T, std::less_equal>(vm); }
+    template <class T> ALWAYS_INLINE auto local_jump_gt_i(auto& vm)  -> void { local_jump_immediate<T, std::greater>(vm); }
+    template <class T> ALWAYS_INLINE auto local_jump_gte_i(auto& vm) -> void { local_jump_immediate<T, std::greater_equal>(vm); }
 
 
-    auto bitcopy_from_stack(VM& vm) -> void {
-        auto const size = vm.extract_argument<vm::Local_size_type>();
-        auto const destination = vm.stack.pop<std::byte*>();
+    ALWAYS_INLINE auto bitcopy_from_stack(auto& vm) -> void {
+        auto const size = vm.template extract_argument<vm::Local_size_type>();
+        auto const destination = vm.stack.template pop<std::byte*>();
 
         std::memcpy(destination, vm.stack.pointer -= size, size);
     }
 
-    auto bitcopy_to_stack(VM& vm) -> void {
-        auto const size = vm.extract_argument<vm::Local_size_type>();
-        auto const source = vm.stack.pop<std::byte*>();
+    ALWAYS_INLINE auto bitcopy_to_stack(auto& vm) -> void {
+        auto const size = vm.template extract_argument<vm::Local_size_type>();
+        auto const source = vm.stack.template pop<std::byte*>();
 
         std::memcpy(vm.stack.pointer, source, size);
         vm.stack.pointer += size;
     }
 
 
-    auto push_address(VM& vm) -> void {
-        auto const offset = vm.extract_argument<vm::Local_offset_type>();
+    ALWAYS_INLINE auto push_address(auto& vm) -> void {
+        auto const offset = vm.template extract_argument<vm::Local_offset_type>();
         vm.stack.push(vm.activation_record->pointer() + offset);
     }
 
-    auto push_return_value(VM& vm) -> void {
+    ALWAYS_INLINE auto push_return_value(auto& vm) -> void {
         vm.stack.push(vm.activation_record->return_value_address);
     }
 
 
-    auto call(VM& vm) -> void {
-        auto const return_value_size     = vm.extract_argument<vm::Local_size_type>();
+    ALWAYS_INLINE auto alloc(auto& vm) -> void {
+        auto const size = vm.stack.template pop<bu::Isize>();
+        if (size < 0) [[unlikely]] {
+            bu::abort(std::format("attempted to allocate {} bytes", size));
+        }
+        vm.stack.push(vm.fiber.heap.allocate(static_cast<bu::Usize>(size)));
+    }
+
+    // Collects the garbage of the fiber, with the slots named by the stack map of each frame as the roots
+    template <class Registers>
+    auto collect_garbage(Registers& vm, bu::Usize const payload_size) -> void {
+        std::vector<std::byte*> roots;
+
+        auto const add_frame = [&](std::byte* const frame, std::byte const* const resume_point) {
+            auto const offset = static_cast<vm::Jump_offset_type>(resume_point - vm.instruction_anchor);
+            if (auto const* const map = vm.stack_maps.find(offset)) {
+                for (vm::Local_offset_type const slot : *map) {
+                    roots.push_back(frame + slot);
+                }
+            }
+        };
+
+        // The instruction pointer is past the alloc_object, and each return address is past a call
+        std::byte const* resume_point = vm.instruction_pointer;
+        for (vm::Activation_record* record = vm.activation_record; record; record = record->caller) {
+            add_frame(record->pointer(), resume_point);
+            resume_point = record->return_address;
+        }
+        add_frame(vm.fiber.stack.base(), resume_point);
+
+        vm.fiber.objects.collect(roots, payload_size, vm.collection_profile);
+    }
+
+    ALWAYS_INLINE auto alloc_object(auto& vm) -> void {
+        auto const pointer_count = vm.template extract_argument<vm::Local_size_type>();
+        auto const size          = vm.stack.template pop<bu::Isize>();
+
+        if (size < 0 || static_cast<bu::Usize>(size) < pointer_count * sizeof(std::byte*)) [[unlikely]] {
+            bu::abort(std::format("attempted to allocate an object of {} bytes with {} pointer fields", size, pointer_count));
+        }
+
+        auto object = vm.fiber.objects.allocate(static_cast<bu::Usize>(size), pointer_count);
+        if (!object) [[unlikely]] {
+            collect_garbage(vm, static_cast<bu::Usize>(size));
+            object = vm.fiber.objects.allocate(static_cast<bu::Usize>(size), pointer_count);
+        }
+        vm.stack.push(object);
+    }
+
+    auto pop_element_count(auto& vm) -> bu::Usize {
+        auto const count = vm.stack.template pop<bu::Isize>();
+        if (count < 0) [[unlikely]] {
+            bu::abort(std::format("attempted a vector operation on {} elements", count));
+        }
+        return static_cast<bu::Usize>(count);
+    }
+
+    template <class T, class Result, auto kernel>
+    ALWAYS_INLINE auto vector_elementwise(auto& vm) -> void {
+        auto const count       = pop_element_count(vm);
+        auto const right       = reinterpret_cast<T const*>(vm.stack.template pop<std::byte*>());
+        auto const left        = reinterpret_cast<T const*>(vm.stack.template pop<std::byte*>());
+        auto const destination = reinterpret_cast<Result*>(vm.stack.template pop<std::byte*>());
+        (vm::vector_kernels().*kernel)(destination, left, right, count);
+    }
+
+    template <class T, auto kernel>
+    ALWAYS_INLINE auto vector_reduction(auto& vm) -> void {
+        auto const count  = pop_element_count(vm);
+        auto const source = reinterpret_cast<T const*>(vm.stack.template pop<std::byte*>());
+        vm.stack.push((vm::vector_kernels().*kernel)(source, count));
+    }
+
+    // Pops an index and a slice, and returns the address of the element
+    template <bool checked>
+    auto pop_element_address(auto& vm, bu::Usize const element_size) -> std::byte* {
+        auto const index   = vm.stack.template pop<bu::Isize>();
+        auto const length  = vm.stack.template pop<bu::Isize>();
+        auto const pointer = vm.stack.template pop<std::byte*>();
+
+        if constexpr (checked) {
+            if (index < 0 || index >= length) [[unlikely]] {
+                bu::abort(std::format("the index {} is out of bounds for a slice of length {}", index, length));
+            }
+        }
+        return pointer + static_cast<bu::Usize>(index) * element_size;
+    }
+
+    template <bool checked>
+    ALWAYS_INLINE auto index_load(auto& vm) -> void {
+        auto const size    = vm.template extract_argument<vm::Local_size_type>();
+        auto const element = pop_element_address<checked>(vm, size);
+
+        std::memcpy(vm.stack.pointer, element, size);
+        vm.stack.pointer += size;
+    }
+
+    template <bool checked>
+    ALWAYS_INLINE auto index_store(auto& vm) -> void {
+        auto const size    = vm.template extract_argument<vm::Local_size_type>();
+        auto const element = pop_element_address<checked>(vm, size);
+
+        std::memcpy(element, vm.stack.pointer -= size, size);
+    }
+
+    ALWAYS_INLINE auto check_bounds(auto& vm) -> void {
+        auto const length = vm.stack.template pop<bu::Isize>();
+        auto const end    = vm.stack.template pop<bu::Isize>();
+
+        if (end < 0 || end > length) [[unlikely]] {
+            bu::abort(std::format("the first {} indices are out of bounds for a slice of length {}", end, length));
+        }
+    }
+
+    ALWAYS_INLINE auto region_enter(auto& vm) -> void {
+        vm.fiber.heap.enter_region();
+    }
+
+    ALWAYS_INLINE auto region_exit(auto& vm) -> void {
+        vm.fiber.heap.exit_region();
+    }
+
+
+    // When size is nonzero it replaces the size argument, so the copy compiles to plain moves
+    template <class Offset, bu::Usize size = 0>
+    ALWAYS_INLINE auto load_local(auto& vm) -> void {
+        auto const offset = vm.template extract_argument<Offset>();
+        bu::Usize  bytes  = size;
+        if constexpr (size == 0) {
+            bytes = vm.template extract_argument<vm::Local_size_type>();
+        }
+        std::memcpy(vm.stack.pointer, vm.activation_record->pointer() + offset, bytes);
+        vm.stack.pointer += bytes;
+    }
+
+    template <class Offset, bu::Usize size = 0>
+    ALWAYS_INLINE auto store_local(auto& vm) -> void {
+        auto const offset = vm.template extract_argument<Offset>();
+        bu::Usize  bytes  = size;
+        if constexpr (size == 0) {
+            bytes = vm.template extract_argument<vm::Local_size_type>();
+        }
+        std::memcpy(vm.activation_record->pointer() + offset, vm.stack.pointer -= bytes, bytes);
+    }
+
+
+    template <class Target>
+    ALWAYS_INLINE auto call(auto& vm) -> void {
+        vm.charge_budget();
+
+        auto const return_value_size     = vm.template extract_argument<vm::Local_size_type>();
         auto const return_value_address  = vm.stack.pointer;
         auto const old_activation_record = vm.activation_record;
 
@@ -194,27 +527,46 @@ namespace {
         vm.stack.push(
             vm::Activation_record {
                 .return_value_address = return_value_address,
-                .return_address       = vm.instruction_pointer + sizeof(vm::Jump_offset_type),
+                .return_address       = vm.instruction_pointer + sizeof(Target),
                 .caller               = old_activation_record,
             }
         );
-        vm.jump_to(vm.extract_argument<vm::Jump_offset_type>());
+        vm.jump_to(vm.template extract_argument<Target>());
     }
 
-    auto call_0(VM& vm) -> void {
+    template <class Target>
+    ALWAYS_INLINE auto call_0(auto& vm) -> void {
+        vm.charge_budget();
+
         auto const old_activation_record = vm.activation_record;
         vm.activation_record = reinterpret_cast<vm::Activation_record*>(vm.stack.pointer);
 
         vm.stack.push(
             vm::Activation_record {
-                .return_address = vm.instruction_pointer + sizeof(vm::Jump_offset_type),
+                .return_address = vm.instruction_pointer + sizeof(Target),
                 .caller         = old_activation_record,
             }
         );
-        vm.jump_to(vm.extract_argument<vm::Jump_offset_type>());
+        vm.jump_to(vm.template extract_argument<Target>());
+    }
+
+    // Replaces the frame of the current function with that of the callee, which must
+    // take arguments and return a value of the same sizes. The new arguments are moved
+    // over the current ones, and the activation record is reused as is, so the callee
+    // returns directly to the current function's caller.
+    ALWAYS_INLINE auto tail_call(auto& vm) -> void {
+        vm.charge_budget();
+
+        auto const return_value_size = vm.template extract_argument<vm::Local_size_type>();
+        auto const argument_size     = vm.template extract_argument<vm::Local_size_type>();
+        auto const frame             = vm.activation_record->pointer();
+
+        std::memmove(frame - return_value_size - argument_size, vm.stack.pointer - argument_size, argument_size);
+        vm.stack.pointer = frame + sizeof(vm::Activation_record);
+        vm.jump_to(vm.template extract_argument<vm::Jump_offset_type>());
     }
 
-    auto ret(VM& vm) -> void {
+    ALWAYS_INLINE auto ret(auto& vm) -> void {
         auto const ar = vm.activation_record;
         vm.stack.pointer       = ar->pointer();      // pop callee's activation record
         vm.activation_record   = ar->caller;         // restore caller state
@@ -222,21 +574,57 @@ namespace {
     }
 
 
-    auto halt(VM& vm) -> void {
+    // Superinstructions, each equivalent to a sequence of two instructions
+
+    template <class T, template <class> class F>
+    ALWAYS_INLINE auto push_binary_op(auto& vm) -> void { // push, binary_op
+        auto const right = vm.template extract_argument<T>();
+        auto const left  = vm.stack.template pop<T>();
+        vm.stack.push(F<T>{}(left, right));
+    }
+
+    template <class T, template <class> class F>
+    ALWAYS_INLINE auto dup_local_jump_immediate(auto& vm) -> void { // dup, local_jump_immediate
+        auto const offset = vm.template extract_argument<vm::Local_offset_type>();
+        auto const right  = vm.stack.template top<T>();
+        auto const left   = vm.template extract_argument<T>();
+
+        if (F<T>{}(left, right)) {
+            vm.branch_to(vm.instruction_pointer + offset);
+        }
+    }
+
+    template <class T> ALWAYS_INLINE auto dup_local_jump_eq_i(auto& vm)  -> void { dup_local_jump_immediate<T, std::equal_to>(vm); }
+    template <class T> ALWAYS_INLINE auto dup_local_jump_neq_i(auto& vm) -> void { dup_local_jump_immediate<T, std::not_equal_to>(vm); }
+    template <class T> ALWAYS_INLINE auto dup_local_jump_lt_i(auto& vm)  -> void { dup_local_jump_immediate<T, std::less>(vm); }
+    template <class T> ALWAYS_INLINE auto dup_local_jump_lte_i(auto& vm) -> void { dup_local_jump_immediate<T, std::less_equal>(vm); }
+    template <class T> ALWAYS_INLINE auto dup_local_jump_gt_i(auto& vm)  -> void { dup_local_jump_immediate<T, std::greater>(vm); }
+    template <class T> ALWAYS_INLINE auto dup_local_jump_gte_i(auto& vm) -> void { dup_local_jump_immediate<T, std::greater_equal>(vm); }
+
+
+    ALWAYS_INLINE auto yield(auto& vm) -> void {
+        vm.keep_running = false;
+    }
+
+    ALWAYS_INLINE auto halt(auto& vm) -> void {
         vm.keep_running = false;
+        vm.has_halted   = true;
     }
 
 
-    constexpr std::array instructions {
+    template <class Registers>
+    constexpr auto instructions = std::to_array<void(*)(Registers&)>({
         push <bu::Isize>, push <bu::Float>, push <bu::Char>, push <String>, push_bool<true>, push_bool<false>,
         dup  <bu::Isize>, dup  <bu::Float>, dup  <bu::Char>, dup  <String>, dup  <bool>,
-        print<bu::Isize>, print<bu::Float>, print<bu::Char>, print<String>, print<bool>,
+        print<bu::Isize>, print<bu::Float>, print<bu::Char>, print<String>, print<bool>, flush,
 
         add<bu::Isize>, add<bu::Float>,
         sub<bu::Isize>, sub<bu::Float>,
         mul<bu::Isize>, mul<bu::Float>,
         div<bu::Isize>, div<bu::Float>,
 
+        iadd_checked, isub_checked, imul_checked,
+
         iinc_top,
 
         eq <bu::Isize>, eq <bu::Float>, eq <bu::Char>, eq <bool>,
@@ -261,14 +649,43 @@ namespace {
         cast<bu::Float, bool>,
         cast<bu::Char , bool>,
 
+        extend<bu::I8>, extend<bu::I16>, extend<bu::I32>, extend<bu::U8>, extend<bu::U16>, extend<bu::U32>,
+        load_narrow<bu::I8>, load_narrow<bu::I16>, load_narrow<bu::I32>, load_narrow<bu::U8>, load_narrow<bu::U16>, load_narrow<bu::U32>,
+        store_narrow<bu::U8>, store_narrow<bu::U16>, store_narrow<bu::U32>,
+        div<bu::Usize>, lt<bu::Usize>, lte<bu::Usize>, gt<bu::Usize>, gte<bu::Usize>,
+
         bitcopy_from_stack,
         bitcopy_to_stack,
         push_address,
         push_return_value,
 
-        jump            , local_jump,
-        jump_bool<true> , local_jump_bool<true>,
-        jump_bool<false>, local_jump_bool<false>,
+        alloc, region_enter, region_exit,
+
+        alloc_object,
+
+        vector_elementwise<bu::Isize, bu::Isize, &vm::Vector_kernels::iadd>, vector_elementwise<bu::Float, bu::Float, &vm::Vector_kernels::fadd>,
+        vector_elementwise<bu::Isize, bu::Isize, &vm::Vector_kernels::imul>, vector_elementwise<bu::Float, bu::Float, &vm::Vector_kernels::fmul>,
+        vector_elementwise<bu::Isize, bool     , &vm::Vector_kernels::ieq >, vector_elementwise<bu::Float, bool     , &vm::Vector_kernels::feq >,
+        vector_elementwise<bu::Isize, bool     , &vm::Vector_kernels::ilt >, vector_elementwise<bu::Float, bool     , &vm::Vector_kernels::flt >,
+        vector_reduction<bu::Isize, &vm::Vector_kernels::isum>, vector_reduction<bu::Float, &vm::Vector_kernels::fsum>,
+        vector_reduction<bu::Isize, &vm::Vector_kernels::imin>, vector_reduction<bu::Float, &vm::Vector_kernels::fmin>,
+        vector_reduction<bu::Isize, &vm::Vector_kernels::imax>, vector_reduction<bu::Float, &vm::Vector_kernels::fmax>,
+
+        index_load<true>, index_store<true>, index_load<false>, index_store<false>, check_bounds,
+
+        load_local<vm::Local_offset_type>,
+        load_local<vm::Local_offset_type, 1>, load_local<vm::Local_offset_type, 8>, load_local<vm::Local_offset_type, 16>,
+        load_local<vm::Short_local_offset_type, 1>, load_local<vm::Short_local_offset_type, 8>, load_local<vm::Short_local_offset_type, 16>,
+        store_local<vm::Local_offset_type>,
+        store_local<vm::Local_offset_type, 1>, store_local<vm::Local_offset_type, 8>, store_local<vm::Local_offset_type, 16>,
+        store_local<vm::Short_local_offset_type, 1>, store_local<vm::Short_local_offset_type, 8>, store_local<vm::Short_local_offset_type, 16>,
+
+        jump            , local_jump<vm::Local_offset_type>,
+        local_jump<vm::Local_offset_8_type>, local_jump<vm::Local_offset_32_type>,
+        jump_bool<true> , local_jump_bool<true, vm::Local_offset_type>,
+        local_jump_bool<true, vm::Local_offset_8_type>, local_jump_bool<true, vm::Local_offset_32_type>,
+        jump_bool<false>, local_jump_bool<false, vm::Local_offset_type>,
+        local_jump_bool<false, vm::Local_offset_8_type>, local_jump_bool<false, vm::Local_offset_32_type>,
 
         local_jump_eq_i <bu::Isize>, local_jump_eq_i <bu::Float>, local_jump_eq_i <bu::Char>, local_jump_eq_i <bool>,
         local_jump_neq_i<bu::Isize>, local_jump_neq_i<bu::Float>, local_jump_neq_i<bu::Char>, local_jump_neq_i<bool>,
@@ -277,84 +694,504 @@ namespace {
         local_jump_gt_i <bu::Isize>, local_jump_gt_i <bu::Float>,
         local_jump_gte_i<bu::Isize>, local_jump_gte_i<bu::Float>,
 
-        call, call_0, ret,
+        call<vm::Jump_offset_type>, call_0<vm::Jump_offset_type>,
+        call<vm::Jump_offset_32_type>, call_0<vm::Jump_offset_32_type>,
+        tail_call, ret,
 
-        halt
-    };
+        push_binary_op<bu::Isize, wrapping_plus>, push_binary_op<bu::Isize, wrapping_minus>,
+        push_binary_op<bu::Isize, wrapping_multiplies>, push_binary_op<bu::Isize, std::divides>,
+        dup_local_jump_eq_i<bu::Isize>, dup_local_jump_neq_i<bu::Isize>,
+        dup_local_jump_lt_i<bu::Isize>, dup_local_jump_lte_i<bu::Isize>,
+        dup_local_jump_gt_i<bu::Isize>, dup_local_jump_gte_i<bu::Isize>,
 
-    static_assert(instructions.size() == static_cast<bu::Usize>(vm::Opcode::_opcode_count));
+        yield, halt
+    });
 
-}
+    template <bool is_budgeted> using Checked_registers   = Registers<bu::Bytestack_cursor, is_budgeted>;
+    template <bool is_budgeted> using Unchecked_registers = Registers<bu::Unchecked_bytestack_cursor, is_budgeted>;
+    template <bool is_budgeted> using Guarded_registers   = Registers<bu::Guarded_bytestack_cursor, is_budgeted>;
 
+    static_assert(instructions<Checked_registers<false>>.size() == static_cast<bu::Usize>(vm::Opcode::_opcode_count));
+    static_assert(instructions<Checked_registers<false>>.size() <= 0x100);
 
-auto vm::Virtual_machine::run() -> int {
-    instruction_pointer = program.bytecode.bytes.data();
-    instruction_anchor = instruction_pointer;
-    keep_running = true;
 
-    // The first activation record does not need to be initialized
+    template <class Registers> [[noreturn]]
+    auto invalid_opcode(Registers& vm) -> void {
+        bu::abort(
+            std::format(
+                "invalid opcode {} at offset {}",
+                static_cast<bu::U8>(vm.instruction_pointer[-1]),
+                std::distance(vm.instruction_anchor, vm.instruction_pointer - 1)
+            )
+        );
+    }
 
-    if (program.constants.string_pool.empty()) {
-        // move this somewhere else
 
-        program.constants.string_pool.reserve(program.constants.string_buffer_views.size());
+    template <class Registers>
+    auto run_table(VM& machine, vm::Fiber& fiber) -> vm::Stop_reason {
+        Registers vm { machine, fiber };
 
-        for (auto const [offset, length] : program.constants.string_buffer_views) {
-            program.constants.string_pool.emplace_back(program.constants.string_buffer.data() + offset, length);
+        while (vm.keep_running) {
+            auto const opcode = vm.fetch_opcode();
+            instructions<Registers>[static_cast<bu::Usize>(opcode)](vm);
         }
 
-        bu::release_vector_memory(program.constants.string_buffer_views);
+        return vm.write_back();
+    }
+
+
+    template <class Registers, bu::Usize opcode>
+    constexpr auto instruction_for = opcode < instructions<Registers>.size()
+        ? instructions<Registers>[opcode]
+        : invalid_opcode<Registers>;
+
+    // Both of these leave the engine, so that the fiber can be suspended or finished
+    constexpr auto is_stopping_opcode(bu::Usize const opcode) noexcept -> bool {
+        return opcode == static_cast<bu::Usize>(vm::Opcode::yield)
+            || opcode == static_cast<bu::Usize>(vm::Opcode::halt);
     }
 
-    while (keep_running) {
-        auto const opcode = extract_argument<Opcode>();
-        //bu::print(" -> {}\n", opcode);
-        instructions[static_cast<bu::Usize>(opcode)](*this);
+    // These may run out of budget, which stops the engine after the instruction
+    constexpr auto may_charge_budget(bu::Usize const opcode) noexcept -> bool {
+        auto const is_between = [=](vm::Opcode const first, vm::Opcode const last) {
+            return opcode >= static_cast<bu::Usize>(first) && opcode <= static_cast<bu::Usize>(last);
+        };
+        return is_between(vm::Opcode::jump, vm::Opcode::tail_call)
+            || is_between(vm::Opcode::idup_local_jump_ieq_i, vm::Opcode::idup_local_jump_igte_i);
+    }
+
+
+// Expands X once for every possible opcode byte, so the threaded engine
+// never has to range check an opcode before dispatching on it.
+
+#define VMT22A_OPCODE_BYTES_16(X, high)                                                       \
+X(0x##high##0) X(0x##high##1) X(0x##high##2) X(0x##high##3) X(0x##high##4) X(0x##high##5) \
+X(0x##high##6) X(0x##high##7) X(0x##high##8) X(0x##high##9) X(0x##high##A) X(0x##high##B) \
+X(0x##high##C) X(0x##high##D) X(0x##high##E) X(0x##high##F)
+
+#define VMT22A_OPCODE_BYTES(X)                                                         \
+VMT22A_OPCODE_BYTES_16(X, 0) VMT22A_OPCODE_BYTES_16(X, 1) VMT22A_OPCODE_BYTES_16(X, 2) \
+VMT22A_OPCODE_BYTES_16(X, 3) VMT22A_OPCODE_BYTES_16(X, 4) VMT22A_OPCODE_BYTES_16(X, 5) \
+VMT22A_OPCODE_BYTES_16(X, 6) VMT22A_OPCODE_BYTES_16(X, 7) VMT22A_OPCODE_BYTES_16(X, 8) \
+VMT22A_OPCODE_BYTES_16(X, 9) VMT22A_OPCODE_BYTES_16(X, A) VMT22A_OPCODE_BYTES_16(X, B) \
+VMT22A_OPCODE_BYTES_16(X, C) VMT22A_OPCODE_BYTES_16(X, D) VMT22A_OPCODE_BYTES_16(X, E) \
+VMT22A_OPCODE_BYTES_16(X, F)
+
+
+    // Every handler is called through a compile-time constant pointer, so it is
+    // inlined into this function, and yield and halt leave the loop directly
+    // instead of going through keep_running. Only jumps and calls check it, and
+    // only when the fiber runs on a budget. Where computed goto is available,
+    // each handler ends in its own indirect jump, which lets the branch predictor
+    // learn common opcode sequences. Elsewhere, a dense switch over the opcode
+    // byte is used.
+
+    template <class Registers>
+    auto run_threaded(VM& machine, vm::Fiber& fiber) -> vm::Stop_reason {
+        Registers vm { machine, fiber };
+
+#define VMT22A_CHECK_BUDGET(opcode)                                      \
+    if constexpr (Registers::is_budgeted && may_charge_budget(opcode)) { \
+        if (!vm.keep_running) [[unlikely]] {                             \
+            goto stopped;                                                \
+        }                                                                \
+    }
+
+#if defined(__GNUC__) || defined(__clang__)
+
+#define VMT22A_LABEL_ADDRESS(opcode) &&execute_##opcode,
+#define VMT22A_DISPATCH() goto* labels[std::to_underlying(vm.fetch_opcode())]
+#define VMT22A_EXECUTE(opcode)                      \
+    execute_##opcode:                               \
+        instruction_for<Registers, opcode>(vm);     \
+        if constexpr (is_stopping_opcode(opcode)) { \
+            goto stopped;                           \
+        }                                           \
+        else {                                      \
+            VMT22A_CHECK_BUDGET(opcode);            \
+            VMT22A_DISPATCH();                      \
+        }
+
+        static void* const labels[] { VMT22A_OPCODE_BYTES(VMT22A_LABEL_ADDRESS) };
+
+        VMT22A_DISPATCH();
+        VMT22A_OPCODE_BYTES(VMT22A_EXECUTE)
+
+#undef VMT22A_LABEL_ADDRESS
+#undef VMT22A_DISPATCH
+#undef VMT22A_EXECUTE
+
+#else
+
+#define VMT22A_EXECUTE(opcode)                      \
+    case opcode:                                    \
+        instruction_for<Registers, opcode>(vm);     \
+        if constexpr (is_stopping_opcode(opcode)) { \
+            goto stopped;                           \
+        }                                           \
+        else {                                      \
+            VMT22A_CHECK_BUDGET(opcode);            \
+            break;                                  \
+        }
+
+        for (;;) {
+            switch (std::to_underlying(vm.fetch_opcode())) {
+                VMT22A_OPCODE_BYTES(VMT22A_EXECUTE)
+            }
+        }
+
+#undef VMT22A_EXECUTE
+
+#endif
+
+#undef VMT22A_CHECK_BUDGET
+
+    stopped:
+        return vm.write_back();
     }
 
-    flush_output();
+#undef VMT22A_OPCODE_BYTES_16
+#undef VMT22A_OPCODE_BYTES
+
 
-    return static_cast<int>(stack.pop<bu::Isize>());
+    // The table engine, except that the interpreter enters compiled code whenever
+    // the fiber is resumed on, or an instruction lands on, one of its entry points.
+    // Compiled code exits back to the interpreter at calls, returns, and instructions
+    // without a template. Compiled code does not check the bounds of the stack, so
+    // programs that have not been verified are only interpreted.
+    template <class Registers>
+    auto run_jit(VM& machine, vm::Fiber& fiber) -> vm::Stop_reason {
+        if constexpr (!Registers::is_verified) {
+            return run_table<Registers>(machine, fiber);
+        }
+
+        Registers vm { machine, fiber };
+
+        // Code compiled without budget checks could loop forever in a budgeted
+        // fiber, so the functions are compiled again when the mode changes
+        if (!machine.jit || machine.jit->checks_budget() != Registers::is_budgeted) {
+            machine.jit = std::make_shared<vm::Jit>(machine.code(), machine.jit_call_threshold, Registers::is_budgeted);
+        }
+        vm::Jit& jit = *machine.jit;
+
+        auto const run_compiled_code = [&] {
+            vm::Jit_context context {
+                .stack_pointer       = vm.stack.pointer,
+                .activation_record   = vm.activation_record,
+                .instruction_pointer = vm.instruction_pointer,
+                .budget              = vm.budget,
+            };
+            jit.run_compiled_code(context);
+
+            vm.stack.pointer       = context.stack_pointer;
+            vm.activation_record   = context.activation_record;
+            vm.instruction_pointer = context.instruction_pointer;
+
+            if constexpr (Registers::is_budgeted) {
+                vm.budget = context.budget;
+                if (vm.budget == 0) {
+                    vm.keep_running = false;
+                }
+            }
+        };
+
+        // A fiber that ran out of budget in a compiled loop is resumed at its entry point
+        run_compiled_code();
+
+        while (vm.keep_running) {
+            auto const opcode = vm.fetch_opcode();
+            instructions<Registers>[static_cast<bu::Usize>(opcode)](vm);
+
+            if (vm::is_call(opcode)) {
+                jit.count_call(static_cast<bu::Usize>(std::distance(vm.instruction_anchor, vm.instruction_pointer)));
+                run_compiled_code();
+            }
+            else if (vm.keep_running && jit.is_entry_point(vm.instruction_pointer)) {
+                run_compiled_code();
+            }
+        }
+
+        return vm.write_back();
+    }
+
+
+#ifdef VMT22A_PROFILING
+
+    // The table engine, with the cycles spent in each handler measured separately,
+    // and the depth of the stack measured after every instruction. This is the only
+    // engine that touches the profiles, so the others stay as fast as if profiling
+    // did not exist. The profiles accumulate over every resume of every fiber, and
+    // run() starts new ones. Only built with VMT22A_PROFILING defined, so that other
+    // builds carry neither the engine nor the profiles.
+    template <class Registers>
+    auto run_profiled(VM& machine, vm::Fiber& fiber) -> vm::Stop_reason {
+        Registers           vm { machine, fiber };
+        vm::Opcode_profile& profile       = machine.profile;
+        vm::Stack_profile&  stack_profile = machine.stack_profile;
+
+        if (profile.executions.empty()) {
+            profile.reset();
+        }
+        if (stack_profile.frame_sizes.size() != machine.code().size()) {
+            stack_profile.reset(machine.code().size());
+        }
+        auto previous = vm::Opcode::_opcode_count; // The first instruction has no predecessor
+
+        auto const current_offset = [&] {
+            return static_cast<bu::Usize>(std::distance(vm.instruction_anchor, vm.instruction_pointer));
+        };
+
+        std::byte* const        bottom    = fiber.stack.base();
+        std::vector<bu::Usize>& functions = stack_profile.active_functions[bottom];
+        if (functions.empty()) {
+            functions.push_back(current_offset());
+        }
+
+        while (vm.keep_running) {
+            auto const opcode = vm.fetch_opcode();
+            auto const start  = vm::read_cycle_counter();
+            instructions<Registers>[static_cast<bu::Usize>(opcode)](vm);
+            profile.record(previous, opcode, vm::read_cycle_counter() - start);
+            previous = opcode;
+
+            if (opcode == vm::Opcode::tail_call) {
+                functions.back() = current_offset();
+            }
+            else if (vm::is_call(opcode)) {
+                functions.push_back(current_offset());
+            }
+            else if (opcode == vm::Opcode::ret) {
+                functions.pop_back();
+            }
+
+            // Code outside of any function has no activation record, and its frame starts at the bottom
+            auto const frame = vm.activation_record ? vm.activation_record->pointer() : bottom;
+            stack_profile.record(
+                functions,
+                static_cast<bu::Usize>(vm.stack.pointer - bottom),
+                static_cast<bu::Usize>(vm.stack.pointer - frame)
+            );
+        }
+
+        auto const reason = vm.write_back();
+        if (reason == vm::Stop_reason::halt) {
+            stack_profile.active_functions.erase(bottom);
+        }
+        return reason;
+    }
+
+#endif
+
+
+    template <class Registers>
+    auto run_on_engine(VM& machine, vm::Fiber& fiber) -> vm::Stop_reason {
+        switch (machine.dispatch_engine) {
+        case vm::Dispatch_engine::threaded:
+            return run_threaded<Registers>(machine, fiber);
+        case vm::Dispatch_engine::table:
+            return run_table<Registers>(machine, fiber);
+        case vm::Dispatch_engine::jit:
+            return run_jit<Registers>(machine, fiber);
+#ifdef VMT22A_PROFILING
+        case vm::Dispatch_engine::profiled:
+            return run_profiled<Registers>(machine, fiber);
+#endif
+        case vm::Dispatch_engine::traced:
+            // The threaded engine, with the opcode, offset, and stack depth of every
+            // instruction recorded in the ring buffer of the machine before it executes
+            return run_threaded<typename Registers::Traced>(machine, fiber);
+        default:
+            std::unreachable();
+        }
+    }
+
+    template <template <bool> class Registers>
+    auto run_on_budget(VM& machine, vm::Fiber& fiber) -> vm::Stop_reason {
+        return machine.budget == 0
+            ? run_on_engine<Registers<false>>(machine, fiber)
+            : run_on_engine<Registers<true>>(machine, fiber);
+    }
+
+
+    auto make_stack(vm::Stack_kind const kind, bu::Usize const capacity) -> bu::Bytestack {
+        switch (kind) {
+        case vm::Stack_kind::heap:     return bu::Bytestack { capacity };
+        case vm::Stack_kind::guarded:  return bu::Bytestack::guarded(capacity);
+        case vm::Stack_kind::growable: return bu::Bytestack::growable(capacity);
+        default:
+            std::unreachable();
+        }
+    }
+
+
+    auto run_on_stack(VM& machine, vm::Fiber& fiber) -> vm::Stop_reason {
+        if (fiber.stack.is_guarded() && vm::Stack_guard::is_supported) {
+            // A verified program stays within bounds, but may still need to grow its stack
+            auto reason = vm::Stop_reason::halt;
+            vm::Stack_guard guard { fiber.stack, machine.code().data() };
+            guard.run([&] {
+                reason = machine.is_verified
+                    ? run_on_budget<Unchecked_registers>(machine, fiber)
+                    : run_on_budget<Guarded_registers>(machine, fiber);
+            });
+            return reason;
+        }
+        else if (machine.is_verified) {
+            return run_on_budget<Unchecked_registers>(machine, fiber);
+        }
+        else {
+            return run_on_budget<Checked_registers>(machine, fiber);
+        }
+    }
+
+    // A fiber can not be resumed after a trap or a stack fault, and bu::abort ends the
+    // process, so in each case the trace is dumped to show what led to the failure
+    auto run_with_trace_dumps(VM& machine, vm::Fiber& fiber) -> vm::Stop_reason {
+        vm::Debug_table const* const debug_table = &machine.image->debug_table();
+
+        if (machine.trace.capacity() == 0) {
+            machine.trace.reset();
+        }
+
+        vm::Trace_dump_on_terminate const dump_on_terminate { machine.trace, machine.code(), debug_table };
+        try {
+            return run_on_stack(machine, fiber);
+        }
+        catch (vm::Trap const&) {
+            vm::dump_trace(machine.trace, machine.code(), debug_table);
+            throw;
+        }
+        catch (vm::Stack_fault const&) {
+            vm::dump_trace(machine.trace, machine.code(), debug_table);
+            throw;
+        }
+    }
+
+}
+
+vm::Trap::Trap(bu::Usize const offset, std::string&& reason, std::optional<Debug_location> const& location)
+    : bu::Exception { location
+        ? std::format("Trap at offset {} ({} {}): {}", offset, location->function, location->position, reason)
+        : std::format("Trap at offset {}: {}", offset, reason) }
+    , offset        { offset }
+    , reason        { std::move(reason) } {}
+
+
+auto vm::Virtual_machine::run() -> int {
+#ifdef VMT22A_PROFILING
+    if (dispatch_engine == Dispatch_engine::profiled) {
+        profile.reset();
+        stack_profile.reset(code().size());
+        collection_profile = {};
+    }
+#endif
+
+    Fiber fiber = spawn();
+    do {
+        resume(fiber);
+    } while (!fiber.is_finished());
+
+    return *fiber.exit_code;
 }
 
 
-auto vm::Virtual_machine::jump_to(Jump_offset_type const offset) noexcept -> void {
-    instruction_pointer = instruction_anchor + offset;
+auto vm::Virtual_machine::spawn(Jump_offset_type const entry) -> Fiber {
+    // The first activation record does not need to be initialized
+    return Fiber {
+        .stack               = make_stack(stack_kind, stack_capacity),
+        .instruction_pointer = code().data() + entry,
+    };
 }
 
 
-template <bu::trivial T>
-auto vm::Virtual_machine::extract_argument() noexcept -> T {
-    if constexpr (sizeof(T) == 1) {
-        return static_cast<T>(*instruction_pointer++);
+auto vm::Virtual_machine::resume(Fiber& fiber) -> Stop_reason {
+    assert(!fiber.is_finished());
+
+    // Verification fails for every recursive program, among others, which the jit engine then interprets
+    if (dispatch_engine == Dispatch_engine::jit && !is_verified && !is_unverifiable) {
+        jit.reset();
+        is_verified     = vm::verify(code(), string_pool().size(), stack_capacity).has_value();
+        is_unverifiable = !is_verified;
+    }
+
+    auto reason = Stop_reason::halt;
+
+    // The engines only know the offset of the instruction that failed, so its source
+    // location is looked up here, where the cost of the lookup does not matter
+    try {
+        reason = dispatch_engine == Dispatch_engine::traced
+            ? run_with_trace_dumps(*this, fiber)
+            : run_on_stack(*this, fiber);
+    }
+    catch (Trap const& trap) {
+        throw Trap { trap.offset, std::string { trap.reason }, locate(trap.offset) };
+    }
+    catch (Stack_fault const& fault) {
+        throw Stack_fault { fault.offset, fault.is_overflow, locate(fault.offset) };
     }
-    else {
-        T argument;
-        std::memcpy(&argument, instruction_pointer, sizeof(T));
-        instruction_pointer += sizeof(T);
-        return argument;
+
+    if (fiber.is_finished()) {
+        output.flush();
     }
+    return reason;
 }
 
 
-auto vm::Virtual_machine::flush_output() -> void {
-    std::cout << output_buffer;
-    output_buffer.clear();
+auto vm::Virtual_machine::verify() -> void {
+    is_verified = false;
+    jit.reset(); // The image may have changed since the functions were compiled
+    (void)bu::expect(vm::verify(code(), string_pool().size(), stack_capacity));
+    is_verified = true;
 }
 
 
+auto vm::Program_image::make(Executable_program program) -> std::shared_ptr<Program_image const> {
+    std::shared_ptr<Program_image> image { new Program_image };
+    image->program = std::move(program);
+
+    Constants& constants = image->program.constants;
+    if (constants.string_pool.empty()) {
+        constants.string_pool.reserve(constants.string_buffer_views.size());
+
+        for (auto const [offset, length] : constants.string_buffer_views) {
+            constants.string_pool.emplace_back(constants.string_buffer.data() + offset, length);
+        }
+
+        bu::release_vector_memory(constants.string_buffer_views);
+    }
+
+    image->bytecode = image->program.bytecode.bytes;
+    image->strings  = constants.string_pool;
+    return image;
+}
+
+
+auto vm::Program_image::make(Mapped_program mapped_program) -> std::shared_ptr<Program_image const> {
+    std::shared_ptr<Program_image> image { new Program_image };
+    image->mapped_program = std::move(mapped_program);
+    image->bytecode       = image->mapped_program->code();
+    image->strings        = image->mapped_program->string_pool();
+
+    image->program.debug_table = image->mapped_program->debug_table();
+    return image;
+}
+
+
+
 auto vm::argument_bytes(Opcode const opcode) noexcept -> bu::Usize {
     static constexpr auto bytecounts = std::to_array<bu::Usize>({
         sizeof(bu::Isize), sizeof(bu::Float), sizeof(bu::Char), sizeof(bu::Usize), 0, 0, // push
 
-        0, 0, 0, 0, 0, // dup
-        0, 0, 0, 0, 0, // print
+        0, 0, 0, 0, 0,    // dup
+        0, 0, 0, 0, 0, 0, // print, flush
 
         0, 0, // add
         0, 0, // sub
         0, 0, // mul
         0, 0, // div
 
+        0, 0, 0, // checked add, sub, mul
+
         0, // iinc_top
 
         0, 0, 0, 0, // eq
@@ -379,13 +1216,37 @@ auto vm::argument_bytes(Opcode const opcode) noexcept -> bu::Usize {
         0,    // ftob
         0,    // ctob
 
+        0, 0, 0, 0, 0, 0, // ext
+        0, 0, 0, 0, 0, 0, // load
+        0, 0, 0,          // store
+        0, 0, 0, 0, 0,    // udiv, unsigned comparisons
+
         sizeof(Local_size_type),   // bitcopy_from
         sizeof(Local_size_type),   // bitcopy_to
         sizeof(Local_offset_type), // push_address
         0,                         // push_return_value_address
 
-        sizeof(Jump_offset_type), sizeof(Jump_offset_type), sizeof(Jump_offset_type),    // jump
-        sizeof(Local_offset_type), sizeof(Local_offset_type), sizeof(Local_offset_type), // local_jump
+        0, 0, 0, // alloc, region_enter, region_exit
+
+        sizeof(Local_size_type), // alloc_object
+
+        0, 0, 0, 0, 0, 0, 0, 0,    // ivec_add through fvec_lt
+        0, 0, 0, 0, 0, 0,          // ivec_sum through fvec_max
+
+        sizeof(Local_size_type), sizeof(Local_size_type), // index_load, index_store
+        sizeof(Local_size_type), sizeof(Local_size_type), // index_load_unchecked, index_store_unchecked
+        0,                                                // check_bounds
+
+        sizeof(Local_offset_type) + sizeof(Local_size_type),                                               // load_local
+        sizeof(Local_offset_type), sizeof(Local_offset_type), sizeof(Local_offset_type),                   // load_local_n
+        sizeof(Short_local_offset_type), sizeof(Short_local_offset_type), sizeof(Short_local_offset_type), // load_local_n_short
+        sizeof(Local_offset_type) + sizeof(Local_size_type),                                               // store_local
+        sizeof(Local_offset_type), sizeof(Local_offset_type), sizeof(Local_offset_type),                   // store_local_n
+        sizeof(Short_local_offset_type), sizeof(Short_local_offset_type), sizeof(Short_local_offset_type), // store_local_n_short
+
+        sizeof(Jump_offset_type), sizeof(Local_offset_type), sizeof(Local_offset_8_type), sizeof(Local_offset_32_type), // jump
+        sizeof(Jump_offset_type), sizeof(Local_offset_type), sizeof(Local_offset_8_type), sizeof(Local_offset_32_type), // jump_true
+        sizeof(Jump_offset_type), sizeof(Local_offset_type), sizeof(Local_offset_8_type), sizeof(Local_offset_32_type), // jump_false
 
         sizeof(Local_offset_type) + sizeof(bu::Isize), sizeof(Local_offset_type) + sizeof(bu::Float), sizeof(Local_offset_type) + sizeof(bu::Char), sizeof(Local_offset_type) + 1, // local_jump_eq
         sizeof(Local_offset_type) + sizeof(bu::Isize), sizeof(Local_offset_type) + sizeof(bu::Float), sizeof(Local_offset_type) + sizeof(bu::Char), sizeof(Local_offset_type) + 1, // local_jump_neq
@@ -394,10 +1255,19 @@ auto vm::argument_bytes(Opcode const opcode) noexcept -> bu::Usize {
         sizeof(Local_offset_type) + sizeof(bu::Isize), sizeof(Local_offset_type) + sizeof(bu::Float), // local_jump_gt
         sizeof(Local_offset_type) + sizeof(bu::Isize), sizeof(Local_offset_type) + sizeof(bu::Float), // local_jump_gte
 
-        sizeof(Local_size_type) + sizeof(Jump_offset_type), // call
-        sizeof(Jump_offset_type),                           // call_0
-        0,                                                  // ret
+        sizeof(Local_size_type) + sizeof(Jump_offset_type),     // call
+        sizeof(Jump_offset_type),                               // call_0
+        sizeof(Local_size_type) + sizeof(Jump_offset_32_type),  // call_32
+        sizeof(Jump_offset_32_type),                            // call_0_32
+        2 * sizeof(Local_size_type) + sizeof(Jump_offset_type), // tail_call
+        0,                                                      // ret
+
+        sizeof(bu::Isize), sizeof(bu::Isize), sizeof(bu::Isize), sizeof(bu::Isize),                                 // ipush_op
+        sizeof(Local_offset_type) + sizeof(bu::Isize), sizeof(Local_offset_type) + sizeof(bu::Isize),             // idup_local_jump_eq
+        sizeof(Local_offset_type) + sizeof(bu::Isize), sizeof(Local_offset_type) + sizeof(bu::Isize),             // idup_local_jump_lt
+        sizeof(Local_offset_type) + sizeof(bu::Isize), sizeof(Local_offset_type) + sizeof(bu::Isize),             // idup_local_jump_gt
 
+        0, // yield
         0, // halt
     });
     static_assert(bytecounts.size() == static_cast<bu::Usize>(Opcode::_opcode_count));
@@ -2,7 +2,14 @@
 
 #include "bu/utilities.hpp"
 #include "bu/bytestack.hpp"
+#include "bu/flatmap.hpp"
 #include "bytecode.hpp"
+#include "debug_table.hpp"
+#include "profiler.hpp"
+#include "execution_trace.hpp"
+#include "output.hpp"
+#include "heap.hpp"
+#include "collected_heap.hpp"
 
 
 namespace vm {
@@ -11,6 +18,13 @@ namespace vm {
     using Local_offset_type = bu::I16; // signed because function parameters use negative offsets
     using Local_size_type   = std::make_unsigned_t<Local_offset_type>;
 
+    // The compact branch encodings chosen by vm::Bytecode_assembler
+    using Local_offset_8_type  = bu::I8;  // local_jump_8 and its conditional forms
+    using Local_offset_32_type = bu::I32; // local_jump_32 and its conditional forms
+    using Jump_offset_32_type  = bu::U32; // call_32 and call_0_32
+
+    using Short_local_offset_type = bu::U8; // The short forms of load_local and store_local
+
 
     struct Activation_record {
         std::byte*         return_value_address;
@@ -42,10 +56,20 @@ namespace vm {
     };
 
 
+    // The slots of each frame that hold pointers to collected objects, which are the roots
+    // of a collection. A map is keyed by the offset of the instruction that follows a call or
+    // alloc_object, and lists the offsets of the slots from the activation record, or from the
+    // bottom of the stack outside of any function, while that instruction is in progress. The
+    // frame of a function that is suspended at a call or alloc_object without a map holds no
+    // pointers to collected objects.
+    using Stack_maps = bu::Flatmap<Jump_offset_type, std::vector<Local_offset_type>>;
+
+
     // Represents one compiled module
     struct Compiled_module {
-        Bytecode  bytecode;
-        Constants constants;
+        Bytecode    bytecode;
+        Constants   constants;
+        Debug_table debug_table;
 
         // add offset handling
     };
@@ -53,35 +77,214 @@ namespace vm {
 
     // Represents an entire program, produced by linking one or more compiled modules
     struct Executable_program {
-        Bytecode  bytecode;
-        Constants constants;
-        bu::Usize stack_capacity;
+        Bytecode    bytecode;
+        Constants   constants;
+        bu::Usize   stack_capacity;
+        Stack_maps  stack_maps;
+        Debug_table debug_table; // Only read to report the locations of instructions, never while running
 
         auto serialize() const -> std::vector<std::byte>;
         static auto deserialize(std::span<std::byte const>) -> Executable_program;
+
+        // Serializes the program in the format read by Mapped_program. Mapped programs
+        // have no stack maps, so throws bu::Exception if the program has any. The debug
+        // table is written last, so it is only paged in by the lookups that read it.
+        auto serialize_for_mapping() const -> std::vector<std::byte>;
     };
 
 
-    struct [[nodiscard]] Virtual_machine {
-        Executable_program program;
+    // A program serialized with Executable_program::serialize_for_mapping, mapped into
+    // memory as is. The bytecode is executed in place, and the string constants are
+    // stored as Constants::String records whose pointers only need to be relocated,
+    // so loading time does not depend on the size of the bytecode or the strings.
+    // The debug table is viewed in place as well.
+    class [[nodiscard]] Mapped_program {
+        std::byte*                         base = nullptr;
+        bu::Usize                          size = 0;
+        std::span<std::byte>               bytecode;
+        std::span<Constants::String const> strings;
+        Debug_table                        table;
+        bu::Usize                          capacity = 0;
+
+        Mapped_program() = default;
+    public:
+        static constexpr auto magic = std::to_array({ 'v', 'm', 't', '2', '2', 'a', 'm', 'p' });
+
+        // Throws bu::Exception if the file can not be mapped or is not a mapped program
+        static auto map(std::filesystem::path const&) -> Mapped_program;
+
+        Mapped_program(Mapped_program&&) noexcept;
+        auto operator=(Mapped_program&&) noexcept -> Mapped_program&;
+        ~Mapped_program();
+
+        auto code() const noexcept -> std::span<std::byte> {
+            return bytecode;
+        }
+        auto string_pool() const noexcept -> std::span<Constants::String const> {
+            return strings;
+        }
+        auto stack_capacity() const noexcept -> bu::Usize {
+            return capacity;
+        }
+        auto debug_table() const noexcept -> Debug_table const& {
+            return table;
+        }
+    };
+
+
+    // A program that is ready to run. The string constants are resolved when the
+    // image is made, and nothing that runs the program writes to the image, so
+    // one image can be shared by any number of machines on any number of threads.
+    class [[nodiscard]] Program_image {
+        Executable_program                 program;
+        std::optional<Mapped_program>      mapped_program;
+        std::span<std::byte>               bytecode; // Owned by program or mapped_program
+        std::span<Constants::String const> strings;  // Owned by program or mapped_program
+
+        Program_image() = default;
+    public:
+        static auto make(Executable_program) -> std::shared_ptr<Program_image const>;
+        static auto make(Mapped_program)     -> std::shared_ptr<Program_image const>;
+
+        Program_image(Program_image const&) = delete;
+        auto operator=(Program_image const&) -> Program_image& = delete;
+
+        auto code() const noexcept -> std::span<std::byte> {
+            return bytecode;
+        }
+        auto string_pool() const noexcept -> std::span<Constants::String const> {
+            return strings;
+        }
+        auto stack_maps() const noexcept -> Stack_maps const& {
+            return program.stack_maps;
+        }
+        auto debug_table() const noexcept -> Debug_table const& {
+            return program.debug_table; // Views the mapping for mapped programs
+        }
+    };
+
+
+    enum class Dispatch_engine {
+        threaded, // Every handler is inlined into one function, and each has its own dispatch site
+        table,    // Every instruction is an indirect call through a table of handler pointers
+        jit,      // Like table, but frequently called functions are compiled to machine code by vm::Jit
+#ifdef VMT22A_PROFILING
+        profiled, // Like table, but every instruction is counted and timed in Virtual_machine::profile
+#endif
+        traced,   // Like threaded, but every instruction is recorded in Virtual_machine::trace
+    };
+
+
+    enum class Stack_kind {
+        heap,     // Allocated on the heap, with bounds checked by every stack operation
+        guarded,  // Mapped between guard pages, with bounds checked by a vm::Stack_guard
+        growable, // Like guarded, but only a page is accessible at first, and the vm::Stack_guard grows it on demand
+    };
+
+
+    class Jit;
+
+
+    // Why Virtual_machine::resume returned
+    enum class Stop_reason {
+        yield,  // The fiber executed yield
+        budget, // The fiber ran out of budget, and continues where it stopped when resumed
+        halt,   // The fiber executed halt, and is finished
+    };
+
+
+    // Thrown by Virtual_machine::resume when an instruction detects an error at runtime,
+    // such as an overflowing checked arithmetic operation. The fiber can not be resumed again.
+    // The message names the source location of the instruction if the debug table has it.
+    struct [[nodiscard]] Trap : bu::Exception {
+        bu::Usize   offset; // The bytecode offset of the instruction that trapped
+        std::string reason;
+
+        Trap(bu::Usize offset, std::string&& reason, std::optional<Debug_location> const& = std::nullopt);
+    };
+
+
+    // The state of one execution of a program. Fibers are suspended by the yield
+    // instruction or by running out of budget, and can then be resumed by any machine that holds the same
+    // image, so a fiber costs no more than its stack and its heaps.
+    struct [[nodiscard]] Fiber {
         bu::Bytestack      stack;
+        Heap               heap;
+        Collected_heap     objects;
         std::byte*         instruction_pointer = nullptr;
-        std::byte*         instruction_anchor  = nullptr;
         Activation_record* activation_record   = nullptr;
-        bool               keep_running        = true;
+        std::optional<int> exit_code;                     // Present once the fiber has executed halt
 
+        auto is_finished() const noexcept -> bool {
+            return exit_code.has_value();
+        }
+    };
 
+
+    struct [[nodiscard]] Virtual_machine {
+        std::shared_ptr<Program_image const> image;
+        bu::Usize                            stack_capacity     = 0; // The size of the stack of every fiber
+        Stack_kind                           stack_kind         = Stack_kind::heap;
+        Dispatch_engine                      dispatch_engine    = Dispatch_engine::threaded;
+        bu::Usize                            jit_call_threshold = 1000;
+        bu::Usize                            budget             = 0; // Backward jumps and calls per resume, or zero for no limit
+        std::shared_ptr<Jit>                 jit;                    // Created by the first resume on the jit engine, and kept until verify()
+#ifdef VMT22A_PROFILING
+        Opcode_profile                       profile;
+        Stack_profile                        stack_profile;          // Collected along with profile
+#endif
+        Collection_profile                   collection_profile;     // Collected by every engine
+        Execution_trace                      trace;                  // Recorded by the traced engine, which gives it the default capacity unless it was reset first
+        bool                                 is_verified        = false;
+        bool                                 is_unverifiable    = false; // Set by the jit engine when verification fails, so that it is not tried again
+
+
+        // Runs the program from the start on a new fiber until it halts, resuming it
+        // after every yield and every time it runs out of budget, and returns its exit code. The jit engine verifies the
+        // program first if it has not been verified, because compiled code does not
+        // check stack bounds, and only interprets the program if verification fails.
         auto run() -> int;
 
-        auto jump_to(Jump_offset_type) noexcept -> void;
+        // Creates a fiber that starts at the given offset in the bytecode. Verification
+        // only covers the code reachable from the start of the bytecode, so other entry
+        // points are only safe to use on a machine that has not been verified.
+        auto spawn(Jump_offset_type entry = 0) -> Fiber;
+
+        // Runs the fiber until it executes yield or halt, or runs out of budget. The
+        // budget is only checked at backward jumps and calls, which every loop and
+        // every recursion pass through, so the rest of the instructions run as fast
+        // as without a budget. The fiber must not be finished. Throws vm::Stack_fault if
+        // the fiber overflows or underflows a guarded stack, and vm::Trap if an instruction
+        // traps, after either of which the fiber can not be resumed again.
+        auto resume(Fiber&) -> Stop_reason;
 
-        template <bu::trivial T>
-        auto extract_argument() noexcept -> T;
+        // Verifies the image against the stack capacity, and if it passes, lets
+        // run() use stack operations without bounds checks. The image must not be
+        // replaced afterwards. Throws vm::Verification_error on failure.
+        auto verify() -> void;
 
+        auto code() const noexcept -> std::span<std::byte> {
+            return image->code();
+        }
+        auto string_pool() const noexcept -> std::span<Constants::String const> {
+            return image->string_pool();
+        }
+
+        // The function and source position the instruction at the offset was compiled
+        // from, if the program has a debug table that covers it
+        auto locate(bu::Usize const offset) const -> std::optional<Debug_location> {
+            return image->debug_table().find(offset);
+        }
+
+        // The instructions most recently executed by the traced engine, for formatting with
+        // vm_formatting.hpp. The traced engine also dumps them to standard error when a
+        // fiber traps or faults, and when the process terminates, for example by bu::abort.
+        auto trace_listing() const -> Trace_listing {
+            return { trace.snapshot(), code(), &image->debug_table() };
+        }
 
-        std::string output_buffer;
 
-        auto flush_output() -> void;
+        Output_buffer output;
     };
 
 }
\ No newline at end of file
@@ -0,0 +1,230 @@
+#include "bu/utilities.hpp"
+#include "bu/timer.hpp"
+#include "vm_benchmark.hpp"
+#include "virtual_machine.hpp"
+#include "opcode.hpp"
+#include "superinstructions.hpp"
+#include "register_machine.hpp"
+
+
+namespace {
+
+    using Nanosecond_timer = bu::Basic_timer<std::chrono::steady_clock, std::chrono::nanoseconds>;
+
+    constexpr bu::Isize iteration_count = 10'000'000;
+
+    // Preempts the benchmarks a thousand times per run, which measures the cost of
+    // the budget checks themselves rather than that of switching between fibers
+    constexpr auto preemption_budget = static_cast<bu::Usize>(iteration_count / 1000);
+
+
+    struct Benchmark {
+        std::string_view name;
+        bu::Usize        instructions_per_iteration;
+        vm::Bytecode     bytecode;
+    };
+
+    auto make_benchmark(std::string_view const name,
+                        bu::Usize        const instructions_per_iteration,
+                        bu::trivial auto const... program) -> Benchmark
+    {
+        Benchmark benchmark { .name = name, .instructions_per_iteration = instructions_per_iteration };
+        benchmark.bytecode.write(program...);
+        return benchmark;
+    }
+
+    auto benchmarks() -> std::vector<Benchmark> {
+        using enum vm::Opcode;
+
+        std::vector<Benchmark> vector;
+
+        // Pure dispatch cost: increment and compare
+        vector.push_back(make_benchmark(
+            "tight loop", 3,
+            ipush, 0_iz,
+            iinc_top,
+            idup,
+            local_jump_ineq_i, vm::Local_offset_type(-13), iteration_count,
+            halt
+        ));
+
+        // A more even mix of pushes, arithmetic, logic, and branches
+        vector.push_back(make_benchmark(
+            "arithmetic loop", 11,
+            ipush, 0_iz,
+            iinc_top,
+            idup,
+            ipush, 7_iz,
+            imul,
+            ipush, 3_iz,
+            idiv,
+            ineq_i, 5_iz,
+            lnot,
+            local_jump_true, vm::Local_offset_type(0),
+            idup,
+            local_jump_ineq_i, vm::Local_offset_type(-47), iteration_count,
+            halt
+        ));
+
+        // A counter kept in a local variable, which fusion turns into load_local and store_local
+        vector.push_back(make_benchmark(
+            "local variable loop", 8,
+            call, vm::Local_size_type(8), vm::Jump_offset_type(12),
+            halt,
+
+            ipush, 0_iz,
+            push_address, vm::Local_offset_type(24),
+            bitcopy_to_stack, vm::Local_size_type(8),
+            iinc_top,
+            push_address, vm::Local_offset_type(24),
+            bitcopy_from_stack, vm::Local_size_type(8),
+            push_address, vm::Local_offset_type(24),
+            bitcopy_to_stack, vm::Local_size_type(8),
+            local_jump_ineq_i, vm::Local_offset_type(-30), iteration_count,
+            push_address, vm::Local_offset_type(24),
+            bitcopy_to_stack, vm::Local_size_type(8),
+            push_return_value_address,
+            bitcopy_from_stack, vm::Local_size_type(8),
+            ret
+        ));
+
+        return vector;
+    }
+
+    // The time is always divided by the instruction count of the unfused
+    // bytecode, so that runs with and without superinstructions are comparable
+    auto time_per_instruction(Benchmark const&          benchmark,
+                              vm::Bytecode const&       bytecode,
+                              vm::Dispatch_engine const engine,
+                              bu::Usize           const budget = 0)
+        -> std::chrono::duration<double, std::nano>
+    {
+        vm::Virtual_machine machine {
+            .image           = vm::Program_image::make(vm::Executable_program { .bytecode = bytecode }),
+            .stack_capacity  = 256,
+            .dispatch_engine = engine,
+            .budget          = budget,
+        };
+
+        Nanosecond_timer const timer;
+        bu::always_assert(machine.run() == iteration_count);
+        auto const elapsed = timer.elapsed();
+
+        return std::chrono::duration<double, std::nano> { elapsed }
+             / static_cast<double>(benchmark.instructions_per_iteration * iteration_count);
+    }
+
+
+    // The tight loop benchmark on the register machine, which needs two
+    // instructions per iteration instead of the stack machine's three
+    auto register_loop_time_per_iteration() -> std::chrono::duration<double, std::nano> {
+        using enum vm::Register_opcode;
+        constexpr vm::Register_index counter = 0, limit = 1;
+
+        vm::Register_machine machine;
+        machine.bytecode.write(
+            imove, counter, 0_iz,
+            imove, limit, iteration_count,
+            iadd_i, counter, counter, 1_iz,
+            jump_ilt, counter, limit, vm::Local_offset_type(-16),
+            halt, counter
+        );
+
+        Nanosecond_timer const timer;
+        bu::always_assert(machine.run() == iteration_count);
+        auto const elapsed = timer.elapsed();
+
+        return std::chrono::duration<double, std::nano> { elapsed } / static_cast<double>(iteration_count);
+    }
+
+
+    constexpr bu::Isize call_count = iteration_count / 100;
+
+    // A loop that calls a function call_count times, which itself loops 100 times,
+    // so that the function is hot enough for the JIT to compile it
+    auto function_call_time_per_iteration(vm::Dispatch_engine const engine) -> std::chrono::duration<double, std::nano> {
+        using enum vm::Opcode;
+
+        vm::Executable_program program;
+        program.bytecode.write(
+            ipush, 0_iz,
+            call_0, vm::Jump_offset_type(32),
+            iinc_top,
+            idup,
+            local_jump_ineq_i, vm::Local_offset_type(-22), call_count,
+            halt,
+
+            ipush, 0_iz,
+            iinc_top,
+            idup,
+            local_jump_ineq_i, vm::Local_offset_type(-13), 100_iz,
+            ret
+        );
+
+        vm::Virtual_machine machine {
+            .image           = vm::Program_image::make(std::move(program)),
+            .stack_capacity  = 256,
+            .dispatch_engine = engine,
+        };
+        machine.verify();
+
+        Nanosecond_timer const timer;
+        bu::always_assert(machine.run() == call_count);
+        auto const elapsed = timer.elapsed();
+
+        return std::chrono::duration<double, std::nano> { elapsed } / static_cast<double>(call_count * 100);
+    }
+
+}
+
+
+auto vm::run_benchmarks() -> void {
+    for (Benchmark const& benchmark : benchmarks()) {
+        auto const fused_bytecode = fuse_superinstructions(benchmark.bytecode);
+
+        auto const threaded = time_per_instruction(benchmark, benchmark.bytecode, Dispatch_engine::threaded);
+        auto const table    = time_per_instruction(benchmark, benchmark.bytecode, Dispatch_engine::table);
+        auto const fused    = time_per_instruction(benchmark, fused_bytecode,     Dispatch_engine::threaded);
+        auto const budgeted = time_per_instruction(benchmark, benchmark.bytecode, Dispatch_engine::threaded, preemption_budget);
+
+        bu::print(
+            "{}:\n    threaded: {:.2f} ns/instruction\n    table:    {:.2f} ns/instruction\n    speedup:  {:.2f}x\n",
+            benchmark.name,
+            threaded.count(),
+            table.count(),
+            table / threaded
+        );
+        bu::print(
+            "    threaded with superinstructions: {:.2f} ns/instruction ({} -> {} bytes)\n",
+            fused.count(),
+            benchmark.bytecode.bytes.size(),
+            fused_bytecode.bytes.size()
+        );
+        bu::print(
+            "    threaded with a budget of {}: {:.2f} ns/instruction\n",
+            preemption_budget,
+            budgeted.count()
+        );
+    }
+
+    auto const tight_loop = benchmarks().front();
+    auto const stack_time = time_per_instruction(tight_loop, tight_loop.bytecode, Dispatch_engine::threaded)
+                          * static_cast<double>(tight_loop.instructions_per_iteration);
+
+    bu::print(
+        "{} on the register machine:\n    registers: {:.2f} ns/iteration\n    stack:     {:.2f} ns/iteration\n",
+        tight_loop.name,
+        register_loop_time_per_iteration().count(),
+        stack_time.count()
+    );
+
+    auto const interpreted = function_call_time_per_iteration(Dispatch_engine::threaded);
+    auto const compiled    = function_call_time_per_iteration(Dispatch_engine::jit);
+
+    bu::print(
+        "function calls:\n    threaded: {:.2f} ns/iteration\n    jit:      {:.2f} ns/iteration\n    speedup:  {:.2f}x\n",
+        interpreted.count(),
+        compiled.count(),
+        interpreted / compiled
+    );
+}
\ No newline at end of file
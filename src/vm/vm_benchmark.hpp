@@ -0,0 +1,11 @@
+#pragma once
+
+#include "bu/utilities.hpp"
+
+
+namespace vm {
+
+    // Runs a set of bytecode loops on every dispatch engine and reports the time spent per instruction
+    auto run_benchmarks() -> void;
+
+}
\ No newline at end of file
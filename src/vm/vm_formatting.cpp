@@ -8,13 +8,15 @@ namespace {
     constexpr auto opcode_strings = std::to_array<std::string_view>({
         "ipush" , "fpush" , "cpush" , "spush" , "push_true", "push_false",
         "idup"  , "fdup"  , "cdup"  , "sdup"  , "bdup"  ,
-        "iprint", "fprint", "cprint", "sprint", "bprint",
+        "iprint", "fprint", "cprint", "sprint", "bprint", "flush",
 
         "iadd", "fadd",
         "isub", "fsub",
         "imul", "fmul",
         "idiv", "fdiv",
 
+        "iadd_checked", "isub_checked", "imul_checked",
+
         "iinc_top",
 
         "ieq" , "feq" , "ceq" , "beq" ,
@@ -40,14 +42,32 @@ namespace {
         "cast_ftob",
         "cast_ctob",
 
+        "ext_i8" , "ext_i16" , "ext_i32" , "ext_u8" , "ext_u16" , "ext_u32" ,
+        "load_i8", "load_i16", "load_i32", "load_u8", "load_u16", "load_u32",
+        "store_8", "store_16", "store_32",
+        "udiv", "ult", "ulte", "ugt", "ugte",
+
         "bitcopy_from_stack",
         "bitcopy_to_stack",
         "push_address",
         "push_return_value_address",
 
-        "jump",       "local_jump",
-        "jump_true",  "local_jump_true",
-        "jump_false", "local_jump_false",
+        "alloc", "region_enter", "region_exit",
+
+        "alloc_object",
+
+        "ivec_add", "fvec_add", "ivec_mul", "fvec_mul",
+        "ivec_eq" , "fvec_eq" , "ivec_lt" , "fvec_lt" ,
+        "ivec_sum", "fvec_sum", "ivec_min", "fvec_min", "ivec_max", "fvec_max",
+
+        "index_load", "index_store", "index_load_unchecked", "index_store_unchecked", "check_bounds",
+
+        "load_local" , "load_local_1" , "load_local_8" , "load_local_16" , "load_local_1_short" , "load_local_8_short" , "load_local_16_short" ,
+        "store_local", "store_local_1", "store_local_8", "store_local_16", "store_local_1_short", "store_local_8_short", "store_local_16_short",
+
+        "jump",       "local_jump",       "local_jump_8",       "local_jump_32",
+        "jump_true",  "local_jump_true",  "local_jump_true_8",  "local_jump_true_32",
+        "jump_false", "local_jump_false", "local_jump_false_8", "local_jump_false_32",
 
         "local_jump_ieq_i" , "local_jump_feq_i" , "local_jump_ceq_i" , "local_jump_beq_i" ,
         "local_jump_ineq_i", "local_jump_fneq_i", "local_jump_cneq_i", "local_jump_bneq_i",
@@ -56,14 +76,45 @@ namespace {
         "local_jump_igt_i" , "local_jump_fgt_i" ,
         "local_jump_igte_i", "local_jump_fgte_i",
 
-        "call", "call_0", "ret",
+        "call", "call_0", "call_32", "call_0_32", "tail_call", "ret",
+
+        "ipush_iadd", "ipush_isub", "ipush_imul", "ipush_idiv",
+        "idup_local_jump_ieq_i" , "idup_local_jump_ineq_i",
+        "idup_local_jump_ilt_i" , "idup_local_jump_ilte_i",
+        "idup_local_jump_igt_i" , "idup_local_jump_igte_i",
 
+        "yield",
         "halt"
     });
 
     static_assert(opcode_strings.size() == static_cast<bu::Usize>(vm::Opcode::_opcode_count));
 
 
+    constexpr auto register_opcode_strings = std::to_array<std::string_view>({
+        "imove", "fmove", "move",
+
+        "iadd"  , "fadd"  , "isub", "fsub",
+        "imul"  , "fmul"  , "idiv", "fdiv",
+        "iadd_i", "isub_i", "imul_i",
+
+        "ieq" , "feq" , "ineq", "fneq",
+        "ilt" , "flt" , "ilte", "flte",
+
+        "jump",
+        "jump_true", "jump_false",
+        "jump_ieq" , "jump_ineq",
+        "jump_ilt" , "jump_ilte",
+
+        "iprint", "fprint",
+
+        "call",
+        "ret",
+        "halt"
+    });
+
+    static_assert(register_opcode_strings.size() == static_cast<bu::Usize>(vm::Register_opcode::_opcode_count));
+
+
     template <class T>
     auto extract(std::byte const*& start, std::byte const* stop) noexcept -> T {
         assert(start + sizeof(T) <= stop);
@@ -92,6 +143,10 @@ namespace {
 
         switch (opcode) {
         case vm::Opcode::ipush:
+        case vm::Opcode::ipush_iadd:
+        case vm::Opcode::ipush_isub:
+        case vm::Opcode::ipush_imul:
+        case vm::Opcode::ipush_idiv:
         case vm::Opcode::ieq_i:
         case vm::Opcode::ineq_i:
         case vm::Opcode::ilt_i:
@@ -120,28 +175,66 @@ namespace {
 
         case vm::Opcode::bitcopy_from_stack:
         case vm::Opcode::bitcopy_to_stack:
+        case vm::Opcode::alloc_object:
+        case vm::Opcode::index_load:
+        case vm::Opcode::index_store:
+        case vm::Opcode::index_load_unchecked:
+        case vm::Opcode::index_store_unchecked:
             return unary(bu::type<vm::Local_size_type>);
 
         case vm::Opcode::push_address:
+        case vm::Opcode::load_local_1:
+        case vm::Opcode::load_local_8:
+        case vm::Opcode::load_local_16:
+        case vm::Opcode::store_local_1:
+        case vm::Opcode::store_local_8:
+        case vm::Opcode::store_local_16:
             return unary(bu::type<vm::Local_offset_type>);
 
+        case vm::Opcode::load_local_1_short:
+        case vm::Opcode::load_local_8_short:
+        case vm::Opcode::load_local_16_short:
+        case vm::Opcode::store_local_1_short:
+        case vm::Opcode::store_local_8_short:
+        case vm::Opcode::store_local_16_short:
+            return unary(bu::type<vm::Short_local_offset_type>);
+
         case vm::Opcode::jump:
         case vm::Opcode::jump_true:
         case vm::Opcode::jump_false:
         case vm::Opcode::call_0:
             return unary(bu::type<vm::Jump_offset_type>);
 
+        case vm::Opcode::call_0_32:
+            return unary(bu::type<vm::Jump_offset_32_type>);
+
         case vm::Opcode::local_jump:
         case vm::Opcode::local_jump_true:
         case vm::Opcode::local_jump_false:
             return unary(bu::type<vm::Local_offset_type>);
 
+        case vm::Opcode::local_jump_8:
+        case vm::Opcode::local_jump_true_8:
+        case vm::Opcode::local_jump_false_8:
+            return unary(bu::type<vm::Local_offset_8_type>);
+
+        case vm::Opcode::local_jump_32:
+        case vm::Opcode::local_jump_true_32:
+        case vm::Opcode::local_jump_false_32:
+            return unary(bu::type<vm::Local_offset_32_type>);
+
         case vm::Opcode::local_jump_ieq_i:
         case vm::Opcode::local_jump_ineq_i:
         case vm::Opcode::local_jump_ilt_i:
         case vm::Opcode::local_jump_ilte_i:
         case vm::Opcode::local_jump_igt_i:
         case vm::Opcode::local_jump_igte_i:
+        case vm::Opcode::idup_local_jump_ieq_i:
+        case vm::Opcode::idup_local_jump_ineq_i:
+        case vm::Opcode::idup_local_jump_ilt_i:
+        case vm::Opcode::idup_local_jump_ilte_i:
+        case vm::Opcode::idup_local_jump_igt_i:
+        case vm::Opcode::idup_local_jump_igte_i:
             return binary(bu::type<vm::Local_offset_type>, bu::type<bu::Isize>);
 
         case vm::Opcode::local_jump_feq_i:
@@ -162,6 +255,20 @@ namespace {
 
         case vm::Opcode::call:
             return binary(bu::type<vm::Local_size_type>, bu::type<vm::Jump_offset_type>);
+        case vm::Opcode::call_32:
+            return binary(bu::type<vm::Local_size_type>, bu::type<vm::Jump_offset_32_type>);
+
+        case vm::Opcode::tail_call:
+        {
+            auto const return_value_size = extract<vm::Local_size_type>(start, stop);
+            auto const argument_size     = extract<vm::Local_size_type>(start, stop);
+            auto const target            = extract<vm::Jump_offset_type>(start, stop);
+            return std::format_to(out, "{} {} {} {}", opcode, return_value_size, argument_size, target);
+        }
+
+        case vm::Opcode::load_local:
+        case vm::Opcode::store_local:
+            return binary(bu::type<vm::Local_offset_type>, bu::type<vm::Local_size_type>);
 
         default:
             assert(vm::argument_bytes(opcode) == 0);
@@ -169,6 +276,85 @@ namespace {
         }
     }
 
+
+    auto format_register_instruction(std::format_context::iterator out,
+                                     std::byte const*&             start,
+                                     std::byte const*              stop)
+    {
+        using Opcode = vm::Register_opcode;
+
+        auto const opcode = extract<Opcode>(start, stop);
+        auto const reg    = [&] { return extract<vm::Register_index>(start, stop); };
+        auto const offset = [&] { return extract<vm::Local_offset_type>(start, stop); };
+
+        switch (opcode) {
+        case Opcode::imove:
+        {
+            auto const destination = reg();
+            return std::format_to(out, "{} r{}, {}", opcode, destination, extract<bu::Isize>(start, stop));
+        }
+        case Opcode::fmove:
+        {
+            auto const destination = reg();
+            return std::format_to(out, "{} r{}, {}", opcode, destination, extract<bu::Float>(start, stop));
+        }
+        case Opcode::move:
+        {
+            auto const destination = reg();
+            return std::format_to(out, "{} r{}, r{}", opcode, destination, reg());
+        }
+
+        case Opcode::iadd_i:
+        case Opcode::isub_i:
+        case Opcode::imul_i:
+        {
+            auto const destination = reg();
+            auto const left        = reg();
+            return std::format_to(out, "{} r{}, r{}, {}", opcode, destination, left, extract<bu::Isize>(start, stop));
+        }
+
+        case Opcode::jump:
+            return std::format_to(out, "{} {}", opcode, offset());
+        case Opcode::jump_true:
+        case Opcode::jump_false:
+        {
+            auto const condition = reg();
+            return std::format_to(out, "{} r{}, {}", opcode, condition, offset());
+        }
+        case Opcode::jump_ieq:
+        case Opcode::jump_ineq:
+        case Opcode::jump_ilt:
+        case Opcode::jump_ilte:
+        {
+            auto const left  = reg();
+            auto const right = reg();
+            return std::format_to(out, "{} r{}, r{}, {}", opcode, left, right, offset());
+        }
+
+        case Opcode::iprint:
+        case Opcode::fprint:
+        case Opcode::halt:
+            return std::format_to(out, "{} r{}", opcode, reg());
+
+        case Opcode::call:
+        {
+            auto const base = reg();
+            return std::format_to(out, "{} r{}, {}", opcode, base, extract<vm::Jump_offset_type>(start, stop));
+        }
+
+        case Opcode::ret:
+            return std::format_to(out, "{}", opcode);
+
+        default:
+        {
+            assert(vm::argument_bytes(opcode) == 3 * sizeof(vm::Register_index));
+            auto const destination = reg();
+            auto const left        = reg();
+            return std::format_to(out, "{} r{}, r{}, r{}", opcode, destination, left, reg());
+        }
+        }
+    }
+
 }
 
 
@@ -189,5 +375,56 @@ DEFINE_FORMATTER_FOR(vm::Bytecode) {
         std::format_to(out, "\n");
     }
 
+    return out;
+}
+
+// One instruction per line, preceded by its offset and the depth of the stack before it
+DEFINE_FORMATTER_FOR(vm::Trace_listing) {
+    auto const start = value.code.data();
+    auto const stop  = start + value.code.size();
+    auto const out   = context.out();
+
+    auto const digit_count = bu::digit_count(value.code.size());
+
+    for (vm::Execution_trace::Entry const& entry : value.entries) {
+        std::format_to(out, "{:>{}} [{}] ", entry.offset, digit_count, entry.stack_depth);
+
+        // The code may have been replaced since the entry was recorded
+        if (entry.offset < value.code.size() && start[entry.offset] == static_cast<std::byte>(entry.opcode)) {
+            auto pointer = start + entry.offset;
+            format_instruction(out, pointer, stop);
+        }
+        else {
+            std::format_to(out, "{}", entry.opcode);
+        }
+
+        if (value.debug_table) {
+            if (auto const location = value.debug_table->find(entry.offset)) {
+                std::format_to(out, " ({} {})", location->function, location->position);
+            }
+        }
+        std::format_to(out, "\n");
+    }
+
+    return out;
+}
+
+DEFINE_FORMATTER_FOR(vm::Register_opcode) {
+    return std::format_to(context.out(), "{}", register_opcode_strings[static_cast<bu::Usize>(value)]);
+}
+
+DEFINE_FORMATTER_FOR(vm::Register_bytecode) {
+    auto const start = value.bytes.data();
+    auto const stop  = start + value.bytes.size();
+    auto const out   = context.out();
+
+    auto const digit_count = bu::digit_count(bu::unsigned_distance(start, stop));
+
+    for (auto pointer = start; pointer < stop; ) {
+        std::format_to(out, "{:>{}} ", std::distance(start, pointer), digit_count);
+        format_register_instruction(out, pointer, stop);
+        std::format_to(out, "\n");
+    }
+
     return out;
 }
\ No newline at end of file
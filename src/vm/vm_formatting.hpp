@@ -3,7 +3,12 @@
 #include "bu/utilities.hpp"
 #include "opcode.hpp"
 #include "bytecode.hpp"
+#include "register_machine.hpp"
+#include "execution_trace.hpp"
 
 
 DECLARE_FORMATTER_FOR(vm::Opcode);
-DECLARE_FORMATTER_FOR(vm::Bytecode);
\ No newline at end of file
+DECLARE_FORMATTER_FOR(vm::Bytecode);
+DECLARE_FORMATTER_FOR(vm::Trace_listing);
+DECLARE_FORMATTER_FOR(vm::Register_opcode);
+DECLARE_FORMATTER_FOR(vm::Register_bytecode);
\ No newline at end of file
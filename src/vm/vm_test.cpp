@@ -3,14 +3,104 @@
 
 #include "vm/opcode.hpp"
 #include "vm/virtual_machine.hpp"
+#include "vm/vm_formatting.hpp"
+#include "vm/verifier.hpp"
+#include "vm/superinstructions.hpp"
+#include "vm/register_machine.hpp"
+#include "vm/bytecode_assembler.hpp"
+#include "vm/scheduler.hpp"
+#include "vm/host.hpp"
+#include "vm/stack_guard.hpp"
+#include "vm/heap.hpp"
+#include "vm/vector_kernels.hpp"
+#include "vm/bounds_checks.hpp"
+#include "vm/debug_table.hpp"
 
 
 namespace {
 
+    // The engines that must agree on the result of every program
+    constexpr std::array every_engine {
+        vm::Dispatch_engine::threaded,
+        vm::Dispatch_engine::table,
+#ifdef VMT22A_PROFILING
+        vm::Dispatch_engine::profiled,
+#endif
+        vm::Dispatch_engine::jit,
+    };
+
+    auto image_of(vm::Bytecode bytecode) -> std::shared_ptr<vm::Program_image const> {
+        return vm::Program_image::make(vm::Executable_program { .bytecode = std::move(bytecode) });
+    }
+
+    auto run_program(vm::Bytecode const& bytecode) -> int {
+        vm::Virtual_machine machine {
+            .image          = image_of(bytecode),
+            .stack_capacity = 256,
+        };
+
+        auto const result = machine.run();
+
+        // The table engine must agree with the default threaded engine
+        machine.dispatch_engine = vm::Dispatch_engine::table;
+        tests::assert_eq(result, machine.run());
+
+#ifdef VMT22A_PROFILING
+        // And so must the profiled engine
+        machine.dispatch_engine = vm::Dispatch_engine::profiled;
+        tests::assert_eq(result, machine.run());
+#endif
+
+        // And the traced engine
+        machine.dispatch_engine = vm::Dispatch_engine::traced;
+        tests::assert_eq(result, machine.run());
+        machine.dispatch_engine = vm::Dispatch_engine::table;
+
+        // And a guarded stack, whose bounds are only checked by the guard pages
+        machine.stack_kind = vm::Stack_kind::guarded;
+        tests::assert_eq(result, machine.run());
+        machine.stack_kind = vm::Stack_kind::heap;
+
+        // So must the unchecked stack path enabled by verification
+        machine.verify();
+        tests::assert_eq(result, machine.run());
+
+        // And the JIT, compiling every function as soon as it is called
+        machine.dispatch_engine    = vm::Dispatch_engine::jit;
+        machine.jit_call_threshold = 0;
+        tests::assert_eq(result, machine.run());
+
+        // And the same program with superinstructions, both interpreted and compiled
+        machine.image = image_of(vm::fuse_superinstructions(bytecode));
+        machine.verify();
+        machine.dispatch_engine = vm::Dispatch_engine::table;
+        tests::assert_eq(result, machine.run());
+        machine.dispatch_engine = vm::Dispatch_engine::jit;
+        tests::assert_eq(result, machine.run());
+
+        // And every engine on a budget so small that the fiber is preempted all the time
+        machine.budget = 3;
+        for (auto const engine : { vm::Dispatch_engine::threaded, vm::Dispatch_engine::table, vm::Dispatch_engine::jit }) {
+            machine.dispatch_engine = engine;
+            tests::assert_eq(result, machine.run());
+        }
+
+        return result;
+    }
+
     auto run_bytecode(bu::trivial auto const... program) -> int {
-        vm::Virtual_machine machine { .stack = bu::Bytestack { 256 } };
-        machine.program.bytecode.write(program...);
-        return machine.run();
+        vm::Bytecode bytecode;
+        bytecode.write(program...);
+        return run_program(bytecode);
+    }
+
+    auto verification_error_offset(bu::Usize const stack_capacity, bu::trivial auto const... program) -> bu::Usize {
+        vm::Executable_program executable;
+        executable.bytecode.write(program...);
+
+        auto const result = vm::verify(executable, stack_capacity);
+        tests::assert_eq(result.has_value(), false);
+        return result.error().offset;
     }
 
     auto run_vm_tests() -> void {
@@ -53,6 +143,1444 @@ namespace {
                 )
             );
         };
+
+        "local_jump"_test = [] {
+            assert_eq(
+                10,
+                run_bytecode(
+                    ipush, 0_iz,
+                    iinc_top,
+                    idup,
+                    local_jump_ineq_i, vm::Local_offset_type(-13), 10_iz,
+                    halt
+                )
+            );
+        };
+
+        "function_call"_test = [] {
+            // The sum of the squares of 1 through 10, with the square computed by a function
+            assert_eq(
+                385,
+                run_bytecode(
+                    call, vm::Local_size_type(8), vm::Jump_offset_type(12),
+                    halt,
+
+                    // 12: the loop, with the sum at offset 24 and the counter at offset 32
+                    ipush, 0_iz,
+                    ipush, 0_iz,
+                    iinc_top,
+                    idup,
+                    call, vm::Local_size_type(8), vm::Jump_offset_type(85),
+                    push_address, vm::Local_offset_type(40), // Overwrite the argument with the result
+                    bitcopy_from_stack, vm::Local_size_type(8),
+                    push_address, vm::Local_offset_type(24),
+                    bitcopy_to_stack, vm::Local_size_type(8),
+                    iadd,
+                    push_address, vm::Local_offset_type(24),
+                    bitcopy_from_stack, vm::Local_size_type(8),
+                    idup,
+                    local_jump_ineq_i, vm::Local_offset_type(-44), 10_iz,
+                    push_address, vm::Local_offset_type(24),
+                    bitcopy_to_stack, vm::Local_size_type(8),
+                    push_return_value_address,
+                    bitcopy_from_stack, vm::Local_size_type(8),
+                    ret,
+
+                    // 85: the square of the argument
+                    push_address, vm::Local_offset_type(-16),
+                    bitcopy_to_stack, vm::Local_size_type(8),
+                    idup,
+                    imul,
+                    push_return_value_address,
+                    bitcopy_from_stack, vm::Local_size_type(8),
+                    ret
+                )
+            );
+
+            // The sum of 1 through 10, computed recursively
+            vm::Bytecode recursive;
+            recursive.write(
+                ipush, 10_iz,
+                call, vm::Local_size_type(8), vm::Jump_offset_type(21),
+                halt,
+
+                // 21: the argument plus the sum below it, or zero
+                push_address, vm::Local_offset_type(-16),
+                bitcopy_to_stack, vm::Local_size_type(8),
+                idup,
+                local_jump_ineq_i, vm::Local_offset_type(5), 0_iz,
+                push_return_value_address,
+                bitcopy_from_stack, vm::Local_size_type(8),
+                ret,
+
+                // 44: the argument is on the stack
+                idup,
+                ipush, 1_iz,
+                isub,
+                call, vm::Local_size_type(8), vm::Jump_offset_type(21),
+                push_address, vm::Local_offset_type(32), // Overwrite the argument with the result
+                bitcopy_from_stack, vm::Local_size_type(8),
+                iadd,
+                push_return_value_address,
+                bitcopy_from_stack, vm::Local_size_type(8),
+                ret
+            );
+
+            // Recursive programs can not be verified, so the jit engine interprets them
+            for (auto const stack_kind : { vm::Stack_kind::heap, vm::Stack_kind::guarded }) {
+                vm::Virtual_machine machine {
+                    .image              = image_of(recursive),
+                    .stack_capacity     = 1024,
+                    .stack_kind         = stack_kind,
+                    .dispatch_engine    = vm::Dispatch_engine::jit,
+                    .jit_call_threshold = 0,
+                };
+                assert_eq(machine.run(), 55);
+                assert_eq(machine.is_verified, false);
+                assert_eq(machine.is_unverifiable, true);
+            }
+        };
+
+        "jit entry points"_test = [] {
+            // A loop that prints, so every iteration exits compiled code at iprint and enters it again after
+            vm::Bytecode bytecode;
+            bytecode.write(
+                call, vm::Local_size_type(8), vm::Jump_offset_type(12),
+                halt,
+
+                // 12
+                ipush, 0_iz,
+                iinc_top, // 21
+                idup,
+                iprint,
+                idup,
+                local_jump_ineq_i, vm::Local_offset_type(-15), 5_iz,
+                push_return_value_address,
+                bitcopy_from_stack, vm::Local_size_type(8),
+                ret
+            );
+
+            // On a budget of one, every backward jump exits, and the next resume enters compiled code at its target
+            for (auto const budget : { 0_uz, 1_uz }) {
+                vm::Virtual_machine machine {
+                    .image              = image_of(bytecode),
+                    .stack_capacity     = 64,
+                    .dispatch_engine    = vm::Dispatch_engine::jit,
+                    .jit_call_threshold = 0,
+                    .budget             = budget,
+                };
+                machine.output.policy = vm::Flush_policy::capture;
+
+                assert_eq(machine.run(), 5);
+                assert_eq(machine.output.take(), "1\n2\n3\n4\n5\n");
+                assert_eq(machine.is_verified, true);
+            }
+        };
+
+        "local_access"_test = [] {
+            assert_eq(
+                43,
+                run_bytecode(
+                    call, vm::Local_size_type(8), vm::Jump_offset_type(12),
+                    halt,
+
+                    // 12: three locals at offsets 24, 32, and 40
+                    ipush, 0_iz,
+                    ipush, 0_iz,
+                    ipush, 0_iz,
+                    ipush, 40_iz,
+                    store_local_8_short, vm::Short_local_offset_type(24),
+                    ipush, 2_iz,
+                    store_local_8, vm::Local_offset_type(32),
+
+                    // Shift the first two locals up by one
+                    load_local_16_short, vm::Short_local_offset_type(24),
+                    store_local, vm::Local_offset_type(32), vm::Local_size_type(16),
+
+                    load_local_8_short, vm::Short_local_offset_type(32),
+                    load_local, vm::Local_offset_type(40), vm::Local_size_type(8),
+                    iadd,
+
+                    push_true,
+                    store_local_1_short, vm::Short_local_offset_type(24),
+                    load_local_1, vm::Local_offset_type(24),
+                    cast_btoi,
+                    iadd,
+
+                    push_return_value_address,
+                    bitcopy_from_stack, vm::Local_size_type(8),
+                    ret
+                )
+            );
+        };
+
+        "bytecode_assembler"_test = [] {
+            // Counts to 10, with every branch crossing the given amount of unreachable padding
+            auto const count_to_ten = [](bu::Usize const padding) {
+                vm::Bytecode_assembler assembler;
+                auto const loop = assembler.new_label();
+                auto const skip = assembler.new_label();
+                auto const done = assembler.new_label();
+
+                assembler.write(ipush, 0_iz);
+                assembler.bind(loop);
+                assembler.write(iinc_top, idup);
+                assembler.jump_immediate(local_jump_ieq_i, done, 10_iz);
+                assembler.jump(skip);
+                for (bu::Usize i = 0; i != padding; ++i) {
+                    assembler.write(iinc_top);
+                }
+                assembler.bind(skip);
+                assembler.jump(loop);
+                assembler.bind(done);
+                assembler.write(halt);
+
+                return assembler.assemble();
+            };
+
+            auto const opcode_at = [](vm::Bytecode const& bytecode, bu::Usize const offset) {
+                return static_cast<vm::Opcode>(bytecode.bytes.at(offset));
+            };
+
+            // The comparison and jump is written at offset 11, after ipush, iinc_top, and idup
+
+            auto const near = count_to_ten(0);
+            assert_eq(opcode_at(near, 11), local_jump_ieq_i);
+            assert_eq(opcode_at(near, 22), local_jump_8);
+            assert_eq(opcode_at(near, 24), local_jump_8);
+            assert_eq(near.bytes.size(), 27_uz);
+            assert_eq(run_program(near), 10);
+
+            auto const medium = count_to_ten(1000);
+            assert_eq(opcode_at(medium, 11), local_jump_ieq_i);
+            assert_eq(opcode_at(medium, 22), local_jump);
+            assert_eq(run_program(medium), 10);
+
+            // Out of the range of local_jump_ieq_i, the comparison and the jump are separated
+            auto const far = count_to_ten(40000);
+            assert_eq(opcode_at(far, 11), ieq_i);
+            assert_eq(opcode_at(far, 20), local_jump_true_32);
+            assert_eq(opcode_at(far, 25), local_jump_32);
+            assert_eq(run_program(far), 10);
+
+            vm::Bytecode_assembler assembler;
+            auto const function = assembler.new_label();
+            assembler.call_0(function);
+            assembler.bind(function);
+            assembler.write(ret);
+            assert_eq(opcode_at(assembler.assemble(), 0), call_0_32);
+        };
+
+        "tail_call"_test = [] {
+            // The sum of 1 through 10000 with an accumulator, far deeper than the stack could hold without tail calls
+            vm::Bytecode_assembler assembler;
+            auto const sum  = assembler.new_label();
+            auto const done = assembler.new_label();
+
+            assembler.write(ipush, 10000_iz, ipush, 0_iz);
+            assembler.call(8, sum);
+            assembler.write(halt);
+
+            // The counter is at offset -24 and the accumulator at offset -16
+            assembler.bind(sum);
+            assembler.write(load_local_8, vm::Local_offset_type(-24));
+            assembler.jump_immediate(local_jump_ieq_i, done, 0_iz);
+            assembler.write(
+                load_local_8, vm::Local_offset_type(-24),
+                ipush, 1_iz,
+                isub,
+                load_local_8, vm::Local_offset_type(-16),
+                load_local_8, vm::Local_offset_type(-24),
+                iadd
+            );
+            assembler.tail_call(8, 16, sum);
+            assembler.bind(done);
+            assembler.write(
+                load_local_8, vm::Local_offset_type(-16),
+                store_local_8, vm::Local_offset_type(-8),
+                ret
+            );
+
+            assert_eq(run_program(assembler.assemble()), 50005000);
+        };
+
+        "fibers"_test = [] {
+            vm::Bytecode bytecode;
+            bytecode.write(
+                ipush, 0_iz,
+                iinc_top, // 9
+                yield,
+                idup,
+                local_jump_ineq_i, vm::Local_offset_type(-14), 3_iz,
+                halt,
+
+                // 24: a second entry point
+                ipush, 7_iz,
+                yield,
+                halt
+            );
+
+            // run() resumes the fiber after every yield
+            assert_eq(run_program(bytecode), 3);
+
+            vm::Virtual_machine machine {
+                .image          = image_of(bytecode),
+                .stack_capacity = 64,
+            };
+
+            auto fiber = machine.spawn();
+            for (int i = 0; i != 3; ++i) {
+                machine.resume(fiber);
+                assert_eq(fiber.is_finished(), false);
+            }
+            machine.resume(fiber);
+            assert_eq(fiber.exit_code, std::optional { 3 });
+
+            vm::Scheduler scheduler { machine };
+            std::vector<vm::Scheduler::Fiber_id> ids;
+            for (int i = 0; i != 1000; ++i) {
+                ids.push_back(scheduler.spawn(i % 2 == 0 ? 0 : 24));
+            }
+            scheduler.run();
+
+            for (bu::Usize i = 0; i != ids.size(); ++i) {
+                assert_eq(scheduler.exit_code(ids[i]), i % 2 == 0 ? 3 : 7);
+            }
+        };
+
+        "budget"_test = [] {
+            vm::Bytecode bytecode;
+            bytecode.write(
+                call, vm::Local_size_type(8), vm::Jump_offset_type(12),
+                halt,
+
+                // 12: counts to 100, jumping backward 99 times
+                ipush, 0_iz,
+                iinc_top, // 21
+                idup,
+                local_jump_ineq_i, vm::Local_offset_type(-13), 100_iz,
+                push_return_value_address,
+                bitcopy_from_stack, vm::Local_size_type(8),
+                ret
+            );
+
+            // The call and the jumps charge the budget 100 times, so a budget of 10 runs
+            // out 10 times, the last time at the last jump. The JIT compiles the function
+            // at the call, so its budget checks are exercised as well.
+            for (auto const engine : { vm::Dispatch_engine::threaded, vm::Dispatch_engine::table, vm::Dispatch_engine::jit }) {
+                vm::Virtual_machine machine {
+                    .image              = image_of(bytecode),
+                    .stack_capacity     = 64,
+                    .dispatch_engine    = engine,
+                    .jit_call_threshold = 0,
+                    .budget             = 10,
+                };
+
+                auto fiber = machine.spawn();
+                for (int i = 0; i != 10; ++i) {
+                    assert_eq(machine.resume(fiber) == vm::Stop_reason::budget, true);
+                }
+                assert_eq(machine.resume(fiber) == vm::Stop_reason::halt, true);
+                assert_eq(fiber.exit_code, std::optional { 100 });
+            }
+        };
+
+        "stack guard"_test = [] {
+            if constexpr (!vm::Stack_guard::is_supported) {
+                return;
+            }
+
+            auto const fault = [](vm::Bytecode bytecode) -> bu::Pair<bu::Usize, bool> {
+                vm::Virtual_machine machine {
+                    .image          = image_of(std::move(bytecode)),
+                    .stack_capacity = 64,
+                    .stack_kind     = vm::Stack_kind::guarded,
+                };
+                try {
+                    (void)machine.run();
+                }
+                catch (vm::Stack_fault const& fault) {
+                    return { fault.offset, fault.is_overflow };
+                }
+                bu::abort("the stack fault was not caught");
+            };
+
+            vm::Bytecode overflow;
+            overflow.write(
+                ipush, 0_iz,
+                ipush, 1_iz, // 9
+                local_jump, vm::Local_offset_type(-12)
+            );
+            assert_eq(fault(std::move(overflow)), bu::Pair<bu::Usize, bool> { 9, true });
+
+            vm::Bytecode underflow;
+            underflow.write(
+                ipush, 0_iz,
+                iadd, // 9
+                halt
+            );
+            assert_eq(fault(std::move(underflow)), bu::Pair<bu::Usize, bool> { 9, false });
+        };
+
+        "growable stack"_test = [] {
+            if constexpr (!vm::Stack_guard::is_supported) {
+                return;
+            }
+
+            // Pushes far more than the initially accessible part of the stack can hold
+            constexpr bu::Usize push_count = 10000;
+            vm::Bytecode bytecode;
+            for (bu::Usize i = 0; i != push_count; ++i) {
+                bytecode.write(ipush, 1_iz);
+            }
+            bytecode.write(halt);
+
+            vm::Virtual_machine machine {
+                .image          = image_of(std::move(bytecode)),
+                .stack_capacity = 1 << 20,
+                .stack_kind     = vm::Stack_kind::growable,
+            };
+
+            auto fiber = machine.spawn();
+            assert_eq(fiber.stack.committed_capacity() < fiber.stack.capacity(), true);
+            assert_eq(machine.resume(fiber) == vm::Stop_reason::halt, true);
+            assert_eq(fiber.exit_code, std::optional { 1 });
+            assert_eq(fiber.stack.committed_capacity() >= push_count * sizeof(bu::Isize), true);
+
+            // Verification removes the bounds checks, but the guard must still grow the stack
+            machine.verify();
+            assert_eq(machine.run(), 1);
+        };
+
+        "heap"_test = [] {
+            vm::Heap heap;
+            assert_eq(heap.reserved_bytes(), 0_uz);
+
+            // Exiting a region frees its memory for the next one, without returning it to the system
+            heap.enter_region();
+            std::byte* const first = heap.allocate(100);
+            heap.exit_region();
+            heap.enter_region();
+            assert_eq(heap.allocate(100) == first, true);
+            assert_eq(heap.allocate(1) - first, static_cast<bu::Isize>(112)); // Rounded up to the alignment
+            heap.exit_region();
+            assert_eq(heap.reserved_bytes(), vm::Heap::chunk_size);
+            assert_eq(heap.region_depth(), 0_uz);
+
+            // Allocations larger than a chunk get a chunk of their own
+            (void)heap.allocate(vm::Heap::chunk_size * 2);
+            assert_eq(heap.reserved_bytes(), vm::Heap::chunk_size * 3);
+
+            assert_eq(
+                42,
+                run_bytecode(
+                    call, vm::Local_size_type(8), vm::Jump_offset_type(12),
+                    halt,
+
+                    // 12: stores 42 through a pointer kept in the local at offset 24, and reads it back
+                    region_enter,
+                    ipush, 16_iz,
+                    alloc,
+                    ipush, 42_iz,
+                    load_local_8_short, vm::Short_local_offset_type(24),
+                    bitcopy_from_stack, vm::Local_size_type(8),
+                    load_local_8_short, vm::Short_local_offset_type(24),
+                    bitcopy_to_stack, vm::Local_size_type(8),
+                    push_return_value_address,
+                    bitcopy_from_stack, vm::Local_size_type(8),
+                    region_exit,
+                    ret
+                )
+            );
+
+            // A region must be exited by the function that entered it
+            assert_eq(
+                0_uz,
+                verification_error_offset(
+                    256,
+                    region_exit,
+                    ipush, 0_iz,
+                    halt
+                )
+            );
+            assert_eq(
+                20_uz,
+                verification_error_offset(
+                    256,
+                    call_0, vm::Jump_offset_type(19),
+                    ipush, 0_iz,
+                    halt,
+
+                    // 19
+                    region_enter,
+                    ret
+                )
+            );
+        };
+
+        "garbage collection"_test = [] {
+            // Keeps an object that points to another one alive through many collections
+            vm::Executable_program program;
+            program.bytecode.write(
+                call, vm::Local_size_type(8), vm::Jump_offset_type(12),
+                halt,
+
+                // 12: the inner object holds 42, and the local at offset 24 ends up holding the outer one
+                ipush, 8_iz,
+                alloc_object, vm::Local_size_type(0),
+                ipush, 42_iz,
+                load_local_8_short, vm::Short_local_offset_type(24),
+                bitcopy_from_stack, vm::Local_size_type(8),
+                ipush, 8_iz,
+                alloc_object, vm::Local_size_type(1), // 47
+                load_local_8_short, vm::Short_local_offset_type(24),
+                load_local_8_short, vm::Short_local_offset_type(32),
+                bitcopy_from_stack, vm::Local_size_type(8),
+                store_local_8_short, vm::Short_local_offset_type(24),
+
+                // 59: allocates garbage, with a counter at offset 32
+                ipush, 0_iz,
+                ipush, 64_iz, // 68
+                alloc_object, vm::Local_size_type(0), // 77
+                store_local_8_short, vm::Short_local_offset_type(40),
+                iinc_top,
+                idup,
+                local_jump_ineq_i, vm::Local_offset_type(-27), 10000_iz,
+
+                load_local_8_short, vm::Short_local_offset_type(24),
+                bitcopy_to_stack, vm::Local_size_type(8),
+                bitcopy_to_stack, vm::Local_size_type(8),
+                push_return_value_address,
+                bitcopy_from_stack, vm::Local_size_type(8),
+                ret
+            );
+            program.stack_maps.add(50, { 24 });
+            program.stack_maps.add(80, { 24 });
+
+            // The stack maps survive serialization
+            program = vm::Executable_program::deserialize(program.serialize());
+            assert_eq(program.stack_maps.span().size(), 2_uz);
+
+            vm::Virtual_machine machine {
+                .image          = vm::Program_image::make(std::move(program)),
+                .stack_capacity = 256,
+            };
+
+            for (auto const engine : every_engine) {
+                machine.dispatch_engine    = engine;
+                machine.jit_call_threshold = 0;
+                machine.collection_profile = {};
+                assert_eq(machine.run(), 42);
+
+                // Far more was allocated than the initial space holds, but almost none of it survived
+                assert_eq(machine.collection_profile.collections > 1, true);
+                assert_eq(machine.collection_profile.surviving_bytes < machine.collection_profile.allocated_bytes / 100, true);
+            }
+        };
+
+        "vector operations"_test = [] {
+            assert_eq(
+                28,
+                run_bytecode(
+                    call, vm::Local_size_type(8), vm::Jump_offset_type(12),
+                    halt,
+
+                    // 12: doubles the array of 1, 2, 3, 4 at offset 24 in place, and returns its maximum plus its sum
+                    ipush, 1_iz,
+                    ipush, 2_iz,
+                    ipush, 3_iz,
+                    ipush, 4_iz,
+                    push_address, vm::Local_offset_type(24),
+                    push_address, vm::Local_offset_type(24),
+                    push_address, vm::Local_offset_type(24),
+                    ipush, 4_iz,
+                    ivec_add,
+                    push_address, vm::Local_offset_type(24),
+                    ipush, 4_iz,
+                    ivec_max,
+                    push_address, vm::Local_offset_type(24),
+                    ipush, 4_iz,
+                    ivec_sum,
+                    iadd,
+                    push_return_value_address,
+                    bitcopy_from_stack, vm::Local_size_type(8),
+                    ret
+                )
+            );
+
+            // Every supported instruction set agrees with the scalar kernels, including on the remaining elements
+            auto const scalar = vm::vector_kernels_for(vm::Vector_instruction_set::scalar);
+            auto const best   = std::to_underlying(vm::supported_vector_instruction_set());
+
+            for (auto set = std::to_underlying(vm::Vector_instruction_set::sse2); set <= best; ++set) {
+                auto const kernels = vm::vector_kernels_for(static_cast<vm::Vector_instruction_set>(set));
+
+                for (bu::Usize count = 0; count != 20; ++count) {
+                    std::vector<bu::Isize> left(count), right(count), expected(count), actual(count);
+                    std::vector<bu::Float> fleft(count), fright(count);
+                    std::vector<char>      expected_bools(count), actual_bools(count);
+
+                    for (bu::Usize i = 0; i != count; ++i) {
+                        left[i]   = static_cast<bu::Isize>(i * 7 % 11) - 5 + (i == 3 ? 1_iz << 40 : 0);
+                        right[i]  = static_cast<bu::Isize>(i * 5 % 13) - 6;
+                        fleft[i]  = static_cast<bu::Float>(left[i] % 100);
+                        fright[i] = static_cast<bu::Float>(right[i]);
+                    }
+
+                    kernels.iadd(actual.data(), left.data(), right.data(), count);
+                    scalar.iadd(expected.data(), left.data(), right.data(), count);
+                    assert_eq(actual == expected, true);
+
+                    kernels.imul(actual.data(), left.data(), right.data(), count);
+                    scalar.imul(expected.data(), left.data(), right.data(), count);
+                    assert_eq(actual == expected, true);
+
+                    kernels.ilt(reinterpret_cast<bool*>(actual_bools.data()), left.data(), right.data(), count);
+                    scalar.ilt(reinterpret_cast<bool*>(expected_bools.data()), left.data(), right.data(), count);
+                    assert_eq(actual_bools == expected_bools, true);
+
+                    kernels.feq(reinterpret_cast<bool*>(actual_bools.data()), fleft.data(), fright.data(), count);
+                    scalar.feq(reinterpret_cast<bool*>(expected_bools.data()), fleft.data(), fright.data(), count);
+                    assert_eq(actual_bools == expected_bools, true);
+
+                    assert_eq(kernels.isum(left.data(), count), scalar.isum(left.data(), count));
+                    assert_eq(kernels.imin(left.data(), count), scalar.imin(left.data(), count));
+                    assert_eq(kernels.imax(right.data(), count), scalar.imax(right.data(), count));
+
+                    // The elements are small integers, so the sums are exact in any order
+                    assert_eq(kernels.fsum(fleft.data(), count), scalar.fsum(fleft.data(), count));
+                    assert_eq(kernels.fmin(fleft.data(), count), scalar.fmin(fleft.data(), count));
+                    assert_eq(kernels.fmax(fright.data(), count), scalar.fmax(fright.data(), count));
+                }
+            }
+
+            // Integer overflow wraps around in every kernel, including the scalar remainders
+            constexpr auto largest = std::numeric_limits<bu::Isize>::max();
+            for (auto set = std::to_underlying(vm::Vector_instruction_set::scalar); set <= best; ++set) {
+                auto const kernels = vm::vector_kernels_for(static_cast<vm::Vector_instruction_set>(set));
+
+                std::vector<bu::Isize> const large(7, largest);
+                std::vector<bu::Isize>       result(7);
+
+                kernels.iadd(result.data(), large.data(), large.data(), 7);
+                assert_eq(std::ranges::count(result, -2), 7_iz);
+                kernels.imul(result.data(), large.data(), large.data(), 7);
+                assert_eq(std::ranges::count(result, 1), 7_iz);
+                assert_eq(kernels.isum(large.data(), 7), largest - 6);
+            }
+        };
+
+        "bounds checks"_test = [] {
+            // Fills a slice of 4 integers with 0, 1, 2, 3 and returns their sum. The sum loop compares with the given opcode.
+            auto const program = [](vm::Opcode const sum_loop_comparison) {
+                vm::Executable_program program;
+                program.bytecode.write(
+                    call, vm::Local_size_type(8), vm::Jump_offset_type(12),
+                    halt,
+
+                    // 12: the slice is at offset 24, the index at 40
+                    region_enter,
+                    ipush, 32_iz,
+                    alloc,
+                    ipush, 4_iz,
+                    ipush, 0_iz,
+
+                    // 41: while index < length, slice[index] = index
+                    load_local_8_short, vm::Short_local_offset_type(40),
+                    load_local_8_short, vm::Short_local_offset_type(32),
+                    ilt,
+                    local_jump_false_8, vm::Local_offset_8_type(16),
+                    load_local_8_short, vm::Short_local_offset_type(40),
+                    load_local_16_short, vm::Short_local_offset_type(24),
+                    load_local_8_short, vm::Short_local_offset_type(40),
+                    index_store, vm::Local_size_type(8),
+                    load_local_8_short, vm::Short_local_offset_type(40),
+                    iinc_top,
+                    store_local_8_short, vm::Short_local_offset_type(40),
+                    local_jump_8, vm::Local_offset_8_type(-23),
+
+                    // 64: the sum is at offset 48, and the index is reset
+                    ipush, 0_iz,
+                    ipush, 0_iz,
+                    store_local_8_short, vm::Short_local_offset_type(40),
+
+                    // 84: while index < length, sum += slice[index]
+                    load_local_8_short, vm::Short_local_offset_type(40),
+                    load_local_8_short, vm::Short_local_offset_type(32),
+                    sum_loop_comparison,
+                    local_jump_false_8, vm::Local_offset_8_type(19),
+                    load_local_8_short, vm::Short_local_offset_type(48),
+                    load_local_16_short, vm::Short_local_offset_type(24),
+                    load_local_8_short, vm::Short_local_offset_type(40),
+                    index_load, vm::Local_size_type(8),
+                    iadd,
+                    store_local_8_short, vm::Short_local_offset_type(48),
+                    load_local_8_short, vm::Short_local_offset_type(40),
+                    iinc_top,
+                    store_local_8_short, vm::Short_local_offset_type(40),
+                    local_jump_8, vm::Local_offset_8_type(-26),
+
+                    // 110
+                    load_local_8_short, vm::Short_local_offset_type(48),
+                    push_return_value_address,
+                    bitcopy_from_stack, vm::Local_size_type(8),
+                    region_exit,
+                    ret
+                );
+                return program;
+            };
+
+            auto checked = program(ilt);
+            assert_eq(6, run_program(checked.bytecode));
+
+            // Both loops are proven to stay within the slice, and the program still works without the checks
+            auto unchecked = checked;
+            assert_eq(vm::eliminate_bounds_checks(unchecked), 2_uz);
+            assert_eq(unchecked.bytecode.bytes[54] == std::byte(std::to_underlying(index_store_unchecked)), true);
+            assert_eq(unchecked.bytecode.bytes[97] == std::byte(std::to_underlying(index_load_unchecked)), true);
+            assert_eq(6, run_program(unchecked.bytecode));
+
+            // An index that may equal the length keeps its check
+            auto off_by_one = program(ilte);
+            assert_eq(vm::eliminate_bounds_checks(off_by_one), 1_uz);
+            assert_eq(off_by_one.bytecode.bytes[97] == std::byte(std::to_underlying(index_load)), true);
+
+            // Loads slice[index] after overwriting the index through a pointer with a narrow store
+            auto const overwritten_index = [](vm::Opcode const narrow_store) {
+                vm::Executable_program program;
+                program.bytecode.write(
+                    call, vm::Local_size_type(8), vm::Jump_offset_type(12),
+                    halt,
+
+                    // 12: the slice is at offset 24, the index at 40
+                    region_enter,
+                    ipush, 32_iz,
+                    alloc,
+                    ipush, 4_iz,
+                    ipush, 0_iz,
+
+                    // 41
+                    load_local_8_short, vm::Short_local_offset_type(40),
+                    load_local_8_short, vm::Short_local_offset_type(32),
+                    ilt,
+                    local_jump_false_8, vm::Local_offset_8_type(26),
+                    ipush, 100_iz,
+                    push_address, vm::Local_offset_type(40),
+                    narrow_store,
+                    load_local_16_short, vm::Short_local_offset_type(24),
+                    load_local_8_short, vm::Short_local_offset_type(40),
+                    index_load, vm::Local_size_type(8), // 65
+                    push_return_value_address,
+                    bitcopy_from_stack, vm::Local_size_type(8),
+                    region_exit,
+                    ret,
+
+                    // 74
+                    ipush, 0_iz,
+                    push_return_value_address,
+                    bitcopy_from_stack, vm::Local_size_type(8),
+                    region_exit,
+                    ret
+                );
+                return program;
+            };
+
+            // The index is no longer known to be below the length, so the load keeps its check
+            for (auto const narrow_store : { store_8, store_16, store_32 }) {
+                auto overwritten = overwritten_index(narrow_store);
+                assert_eq(vm::eliminate_bounds_checks(overwritten), 0_uz);
+                assert_eq(overwritten.bytecode.bytes[65] == std::byte(std::to_underlying(index_load)), true);
+            }
+        };
+
+        "integer widths"_test = [] {
+            assert_eq(
+                4482,
+                run_bytecode(
+                    call, vm::Local_size_type(8), vm::Jump_offset_type(12),
+                    halt,
+
+                    // 12: the pointer at offset 24 points to 8 bytes
+                    region_enter,
+                    ipush, 8_iz,
+                    alloc,
+
+                    // As an i8, the byte 200 is -56
+                    ipush, 200_iz,
+                    load_local_8_short, vm::Short_local_offset_type(24),
+                    store_8,
+                    load_local_8_short, vm::Short_local_offset_type(24),
+                    load_i8,
+                    load_local_8_short, vm::Short_local_offset_type(24),
+                    load_u8,
+                    iadd, // 144
+
+                    // The i8 127 + 1 wraps around to -128
+                    ipush, 127_iz,
+                    iinc_top,
+                    ext_i8,
+                    iadd, // 16
+
+                    // Only the low 16 bits of 70000 are stored
+                    ipush, 70000_iz,
+                    load_local_8_short, vm::Short_local_offset_type(24),
+                    store_16,
+                    load_local_8_short, vm::Short_local_offset_type(24),
+                    load_u16,
+                    iadd, // 4480
+
+                    // As a u64, -1 is the largest value
+                    ipush, bu::Isize(-1),
+                    ipush, 1_iz,
+                    ugt,
+                    cast_btoi,
+                    iadd, // 4481
+
+                    ipush, bu::Isize(-2),
+                    ipush, 2_iz,
+                    udiv,
+                    ieq_i, std::numeric_limits<bu::Isize>::max(),
+                    cast_btoi,
+                    iadd, // 4482
+
+                    push_return_value_address,
+                    bitcopy_from_stack, vm::Local_size_type(8),
+                    region_exit,
+                    ret
+                )
+            );
+        };
+
+        "checked arithmetic"_test = [] {
+            assert_eq(
+                33,
+                run_bytecode(
+                    call, vm::Local_size_type(8), vm::Jump_offset_type(12),
+                    halt,
+
+                    // 12
+                    ipush, 3_iz,
+                    ipush, 4_iz,
+                    imul_checked,
+                    ipush, 10_iz,
+                    isub_checked,
+                    ipush, 30_iz,
+                    iadd_checked, // 32
+
+                    // The plain opcodes wrap around
+                    ipush, std::numeric_limits<bu::Isize>::max(),
+                    ipush, 1_iz,
+                    iadd,
+                    ieq_i, std::numeric_limits<bu::Isize>::min(),
+                    cast_btoi,
+                    iadd_checked, // 33
+
+                    push_return_value_address,
+                    bitcopy_from_stack, vm::Local_size_type(8),
+                    ret
+                )
+            );
+
+            vm::Bytecode overflow;
+            overflow.write(
+                call, vm::Local_size_type(8), vm::Jump_offset_type(12),
+                halt,
+
+                // 12
+                ipush, std::numeric_limits<bu::Isize>::max(),
+                ipush, 2_iz,
+                imul_checked, // 30
+
+                push_return_value_address,
+                bitcopy_from_stack, vm::Local_size_type(8),
+                ret
+            );
+
+            auto const trap_offset = [&](vm::Dispatch_engine const engine, vm::Stack_kind const stack_kind) -> bu::Usize {
+                vm::Virtual_machine machine {
+                    .image              = image_of(overflow),
+                    .stack_capacity     = 256,
+                    .stack_kind         = stack_kind,
+                    .dispatch_engine    = engine,
+                    .jit_call_threshold = 0,
+                };
+                try {
+                    (void)machine.run();
+                }
+                catch (vm::Trap const& trap) {
+                    return trap.offset;
+                }
+                bu::abort("the trap was not caught");
+            };
+
+            for (auto const engine : every_engine) {
+                assert_eq(trap_offset(engine, vm::Stack_kind::heap), 30_uz);
+            }
+
+            // A trap must leave no stack guard behind, or the next guarded run would fail
+            assert_eq(trap_offset(vm::Dispatch_engine::table, vm::Stack_kind::guarded), 30_uz);
+            assert_eq(trap_offset(vm::Dispatch_engine::jit, vm::Stack_kind::guarded), 30_uz);
+
+            // The message names the source location of the instruction that trapped
+            vm::Debug_table_builder builder;
+            builder.add_function("overflow");
+            builder.add_row(12, { .line = 3, .column = 7 });
+
+            vm::Virtual_machine machine {
+                .image          = vm::Program_image::make(vm::Executable_program { .bytecode = overflow, .debug_table = builder.build() }),
+                .stack_capacity = 256,
+            };
+            try {
+                (void)machine.run();
+                bu::abort("the trap was not caught");
+            }
+            catch (vm::Trap const& trap) {
+                assert_eq(std::string_view { trap.what() }, std::string_view { "Trap at offset 30 (overflow 3:7): 9223372036854775807 * 2 overflows" });
+            }
+        };
+
+        "execution trace"_test = [] {
+            vm::Execution_trace trace;
+            trace.reset(3);
+            assert_eq(trace.capacity(), 4_uz);
+
+            for (bu::Usize i = 0; i != 6; ++i) {
+                trace.record(vm::Opcode::iadd, i, 2 * i);
+            }
+            auto const entries = trace.snapshot();
+            assert_eq(trace.recorded_count(), 6_uz);
+            assert_eq(entries.size(), 4_uz);
+            assert_eq(entries.front().offset, 2_uz);
+            assert_eq(entries.back().offset, 5_uz);
+            assert_eq(entries.back().stack_depth, 10_uz);
+            assert_eq(entries.back().opcode == vm::Opcode::iadd, true);
+
+            vm::Bytecode bytecode;
+            bytecode.write(
+                ipush, 5_iz,
+                ipush, 6_iz,
+                iadd, // 18
+                halt  // 19
+            );
+            vm::Virtual_machine machine {
+                .image           = image_of(std::move(bytecode)),
+                .stack_capacity  = 64,
+                .dispatch_engine = vm::Dispatch_engine::traced,
+            };
+            assert_eq(machine.run(), 11);
+            assert_eq(machine.trace.capacity(), vm::Execution_trace::default_capacity);
+
+            auto const listing = machine.trace_listing();
+            assert_eq(listing.entries.size(), 4_uz);
+            assert_eq(listing.entries[2].offset, 18_uz);
+            assert_eq(listing.entries[2].stack_depth, 16_uz);
+            assert_eq(listing.entries[3].stack_depth, 8_uz);
+            assert_eq(std::format("{}", listing), " 0 [0] ipush 5\n 9 [8] ipush 6\n18 [16] iadd\n19 [8] halt\n");
+        };
+
+        "debug table"_test = [] {
+            vm::Bytecode_assembler assembler;
+            auto const done = assembler.new_label();
+
+            assembler.write(ipush, 0_iz);
+            assembler.begin_function("main");
+            assembler.set_source_position({ .line = 4, .column = 1 });
+            assembler.jump(done);
+            assembler.set_source_position({ .line = 5, .column = 2 });
+            for (bu::Usize i = 0; i != 1000; ++i) {
+                assembler.write(iinc_top);
+            }
+            assembler.bind(done);
+            assembler.begin_function("exit");
+            assembler.set_source_position({ .line = 10, .column = 1 });
+            assembler.write(halt);
+
+            vm::Executable_program program { .stack_capacity = 256 };
+            program.bytecode = assembler.assemble(program.debug_table);
+
+            // The jump is widened to local_jump, so the rows after it move by three bytes instead of one
+            auto const check = [](vm::Debug_table const& table) {
+                auto const location_at = [&](bu::Usize const offset) {
+                    auto const location = table.find(offset);
+                    bu::always_assert(location.has_value());
+                    return std::format("{} {}:{}", location->function, location->position.line, location->position.column);
+                };
+                assert_eq(table.find(0).has_value(), false);
+                assert_eq(table.find(8).has_value(), false);
+                assert_eq(location_at(9), "main 4:1");
+                assert_eq(location_at(11), "main 4:1");
+                assert_eq(location_at(12), "main 5:2");
+                assert_eq(location_at(1011), "main 5:2");
+                assert_eq(location_at(1012), "exit 10:1");
+                assert_eq(location_at(100000), "exit 10:1");
+            };
+            check(program.debug_table);
+            assert_eq(program.bytecode.bytes.size(), 1013_uz);
+
+            // Enough rows for several checkpoints, each with its own function
+            vm::Debug_table_builder builder;
+            for (bu::Usize i = 0; i != 100; ++i) {
+                if (i % 7 == 0) {
+                    builder.add_function(std::format("f{}", i / 7));
+                }
+                builder.add_row(i * 3, { .line = 1000 - i * 5, .column = i % 13 + 1 });
+            }
+            auto const table = vm::Debug_table::deserialize(builder.build().serialized());
+            for (bu::Usize i = 0; i != 100; ++i) {
+                for (bu::Usize offset = i * 3; offset != i * 3 + 3; ++offset) {
+                    auto const location = table.find(offset);
+                    assert_eq(location.has_value(), true);
+                    assert_eq(location->function, std::format("f{}", i / 7));
+                    assert_eq(location->position.line, 1000 - i * 5);
+                    assert_eq(location->position.column, i % 13 + 1);
+                }
+            }
+
+            // The table survives serialization, and running the program does not depend on it
+            program = vm::Executable_program::deserialize(program.serialize());
+            check(program.debug_table);
+
+            vm::Virtual_machine machine {
+                .image          = vm::Program_image::make(std::move(program)),
+                .stack_capacity = 256,
+            };
+            assert_eq(machine.run(), 0);
+            assert_eq(machine.locate(12).has_value(), true);
+            assert_eq(machine.locate(12)->position.line, 5_uz);
+            assert_eq(vm::Debug_table {}.find(0).has_value(), false);
+        };
+
+        "host"_test = [] {
+            vm::Executable_program program;
+            auto const string = program.constants.add_to_string_pool("instance ");
+            program.bytecode.write(
+                spush, string,
+                sprint,
+                ipush, 0_iz,
+                iinc_top, // 19
+                yield,
+                idup,
+                local_jump_ineq_i, vm::Local_offset_type(-14), 3_iz,
+                idup,
+                iprint,
+                halt
+            );
+
+            vm::Host host {
+                .image          = vm::Program_image::make(std::move(program)),
+                .stack_capacity = 64,
+                .thread_count   = 4,
+            };
+            host.output.policy = vm::Flush_policy::capture;
+
+            auto const exit_codes = host.run(100);
+            assert_eq(exit_codes.size(), 100_uz);
+            assert_eq(std::ranges::count(exit_codes, 3), 100_iz);
+
+            // The output of each instance stays together
+            std::string expected;
+            for (int i = 0; i != 100; ++i) {
+                expected.append("instance 3\n");
+            }
+            assert_eq(host.output.buffered(), std::string_view { expected });
+
+            host.dispatch_engine = vm::Dispatch_engine::jit;
+            host.output.take();
+            assert_eq(std::ranges::count(host.run(10), 3), 10_iz);
+            assert_eq(host.output.buffered().size(), 110_uz);
+
+            // Every instance of this program traps after printing, which must neither terminate
+            // the process nor hold back the output of the instances that follow
+            vm::Executable_program trapping;
+            auto const partial = trapping.constants.add_to_string_pool("partial ");
+            trapping.bytecode.write(
+                spush, partial,
+                sprint,
+                ipush, std::numeric_limits<bu::Isize>::max(),
+                ipush, 1_iz,
+                iadd_checked,
+                iprint,
+                halt
+            );
+            auto const good_image = std::exchange(host.image, vm::Program_image::make(std::move(trapping)));
+
+            for (auto const engine : { vm::Dispatch_engine::threaded, vm::Dispatch_engine::jit }) {
+                host.dispatch_engine = engine;
+                host.is_verified     = false;
+                host.output.take();
+
+                auto const failed = host.run(5);
+                assert_eq(std::ranges::count(failed, vm::Host::failure_exit_code), 5_iz);
+                assert_eq(host.failures.size(), 5_uz);
+                for (bu::Usize i = 0; i != 5; ++i) {
+                    assert_eq(host.failures[i].instance, i);
+                    assert_eq(host.failures[i].message.empty(), false);
+                }
+                assert_eq(host.output.buffered(), std::string_view { "partial partial partial partial partial " });
+            }
+
+            // A failed run leaves the host usable, and the next run forgets its failures
+            host.image       = good_image;
+            host.is_verified = false;
+            host.output.take();
+            assert_eq(std::ranges::count(host.run(10), 3), 10_iz);
+            assert_eq(host.failures.empty(), true);
+        };
+
+#ifdef VMT22A_PROFILING
+        "profiler"_test = [] {
+            vm::Bytecode bytecode;
+            bytecode.write(
+                ipush, 0_iz,
+                iinc_top,
+                idup,
+                local_jump_ineq_i, vm::Local_offset_type(-13), 10_iz,
+                halt
+            );
+            vm::Virtual_machine machine {
+                .image           = image_of(std::move(bytecode)),
+                .stack_capacity  = 256,
+                .dispatch_engine = vm::Dispatch_engine::profiled,
+            };
+            assert_eq(10, machine.run());
+
+            auto const executions = [&](vm::Opcode const opcode) {
+                return machine.profile.executions[static_cast<bu::Usize>(opcode)];
+            };
+            auto const pair_executions = [&](vm::Opcode const first, vm::Opcode const second) {
+                return machine.profile.pair_executions[
+                    static_cast<bu::Usize>(first) * vm::Opcode_profile::opcode_count + static_cast<bu::Usize>(second)];
+            };
+
+            assert_eq(executions(ipush), 1_u64);
+            assert_eq(executions(iinc_top), 10_u64);
+            assert_eq(executions(halt), 1_u64);
+            assert_eq(pair_executions(ipush, iinc_top), 1_u64);
+            assert_eq(pair_executions(local_jump_ineq_i, iinc_top), 9_u64);
+            assert_eq(pair_executions(local_jump_ineq_i, halt), 1_u64);
+        };
+
+        "stack profile"_test = [] {
+            vm::Bytecode bytecode;
+            bytecode.write(
+                call, vm::Local_size_type(8), vm::Jump_offset_type(12),
+                halt,
+
+                // 12
+                ipush, 1_iz,
+                ipush, 2_iz,
+                iadd,
+                push_return_value_address,
+                bitcopy_from_stack, vm::Local_size_type(8),
+                ret
+            );
+            vm::Virtual_machine machine {
+                .image           = image_of(std::move(bytecode)),
+                .stack_capacity  = 256,
+                .dispatch_engine = vm::Dispatch_engine::profiled,
+            };
+            assert_eq(3, machine.run());
+
+            // The return value, the activation record, and the two operands of iadd
+            vm::Stack_profile const& profile = machine.stack_profile;
+            assert_eq(profile.peak_depth, 48_uz);
+            assert_eq(profile.peak_call_depth, 1_uz);
+            assert_eq(profile.frame_sizes[0], 8_uz);
+            assert_eq(profile.frame_sizes[12], 40_uz);
+            assert_eq(profile.suggested_capacity(), 64_uz);
+            assert_eq(profile.active_functions.empty(), true);
+        };
+#endif
+
+        "output"_test = [] {
+            vm::Output_buffer output;
+            output.policy = vm::Flush_policy::explicit_flush;
+
+            output.print(-15_iz);
+            output.print(2.5);
+            output.print('x');
+            output.print(true);
+            output.print(std::string_view { "no newline" });
+            assert_eq(output.buffered(), std::string_view { "-15\n2.5\nx\ntrue\nno newline" });
+
+            // Below the threshold, nothing is flushed
+            output.policy          = vm::Flush_policy::size_threshold;
+            output.flush_threshold = 1000;
+            output.print(0_iz);
+            assert_eq(output.buffered().size(), 29_uz);
+        };
+
+        "output flushing"_test = [] {
+            // The output buffer writes to the descriptor of a temporary file, which is read back after every step
+            std::FILE* const file = std::tmpfile();
+            bu::always_assert(file != nullptr);
+#ifdef _WIN32
+            int const descriptor = _fileno(file);
+#else
+            int const descriptor = fileno(file);
+#endif
+            auto const written = [file] {
+                std::string contents(1024, '\0');
+                std::rewind(file);
+                contents.resize(std::fread(contents.data(), 1, contents.size(), file));
+                return contents;
+            };
+
+            vm::Output_buffer output;
+            output.file_descriptor = descriptor;
+
+            // Nothing is written until the buffer reaches the threshold, and then all of it is
+            output.policy          = vm::Flush_policy::size_threshold;
+            output.flush_threshold = 10;
+            output.print(1_iz);
+            assert_eq(written(), "");
+            output.print(std::string_view { "12345678" });
+            assert_eq(written(), "1\n12345678");
+            assert_eq(output.buffered().empty(), true);
+
+            // Only prints that write a newline flush
+            output.policy = vm::Flush_policy::newline;
+            output.print(std::string_view { "a" });
+            assert_eq(written(), "1\n12345678");
+            output.print(std::string_view { "b\nc" });
+            assert_eq(written(), "1\n12345678ab\nc");
+
+            // Only an explicit flush writes
+            output.policy = vm::Flush_policy::explicit_flush;
+            output.print(2_iz);
+            assert_eq(written(), "1\n12345678ab\nc");
+            output.flush();
+            assert_eq(written(), "1\n12345678ab\nc2\n");
+
+            // Captured output is never written
+            output.policy = vm::Flush_policy::capture;
+            output.print(3_iz);
+            output.flush();
+            assert_eq(written(), "1\n12345678ab\nc2\n");
+            assert_eq(output.take(), "3\n");
+
+            // The flush opcode writes what was printed before it, and halting writes the rest
+            vm::Bytecode bytecode;
+            bytecode.write(
+                ipush, 4_iz,
+                iprint,
+                flush,
+                yield,
+                ipush, 5_iz,
+                iprint,
+                yield,
+                ipush, 0_iz,
+                halt
+            );
+            vm::Virtual_machine machine {
+                .image          = image_of(std::move(bytecode)),
+                .stack_capacity = 64,
+            };
+            machine.output.policy          = vm::Flush_policy::explicit_flush;
+            machine.output.file_descriptor = descriptor;
+
+            auto fiber = machine.spawn();
+            assert_eq(machine.resume(fiber) == vm::Stop_reason::yield, true);
+            assert_eq(written(), "1\n12345678ab\nc2\n4\n");
+            assert_eq(machine.resume(fiber) == vm::Stop_reason::yield, true);
+            assert_eq(written(), "1\n12345678ab\nc2\n4\n");
+            assert_eq(machine.resume(fiber) == vm::Stop_reason::halt, true);
+            assert_eq(written(), "1\n12345678ab\nc2\n4\n5\n");
+
+            std::fclose(file);
+        };
+
+        "mapped_program"_test = [] {
+            vm::Executable_program program { .stack_capacity = 256 };
+            program.constants.add_to_string_pool("hello, world");
+            program.bytecode.write(
+                ipush, 6_iz,
+                ipush, 7_iz,
+                imul,
+                halt
+            );
+
+            vm::Debug_table_builder builder;
+            builder.add_function("main");
+            builder.add_row(0, { .line = 1, .column = 1 });
+            builder.add_row(18, { .line = 2, .column = 5 });
+            program.debug_table = builder.build();
+
+            auto const path = std::filesystem::temp_directory_path() / "vmt22a-mapped-test.bin";
+            {
+                auto const bytes = program.serialize_for_mapping();
+                std::ofstream file { path, std::ios::binary };
+                file.write(reinterpret_cast<char const*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+            }
+
+            auto mapped = vm::Mapped_program::map(path);
+            assert_eq(mapped.stack_capacity(), 256_uz);
+            assert_eq(mapped.string_pool().size(), 1_uz);
+            assert_eq(
+                std::string_view { mapped.string_pool().front().pointer, mapped.string_pool().front().length },
+                std::string_view { "hello, world" }
+            );
+
+            // The debug table is read from the mapping in place
+            auto const table = mapped.debug_table().serialized();
+            assert_eq(table.size(), program.debug_table.serialized().size());
+            assert_eq(std::ranges::equal(table, program.debug_table.serialized()), true);
+
+            vm::Virtual_machine machine {
+                .image          = vm::Program_image::make(std::move(mapped)),
+                .stack_capacity = 256,
+            };
+            assert_eq(42, machine.run());
+            assert_eq(machine.locate(17)->position.line, 1_uz);
+            assert_eq(machine.locate(18)->position.column, 5_uz);
+            assert_eq(machine.locate(18)->function, std::string_view { "main" });
+
+            machine.verify();
+            machine.dispatch_engine = vm::Dispatch_engine::jit;
+            assert_eq(42, machine.run());
+
+            machine.image.reset();
+            std::filesystem::remove(path);
+        };
+
+        "superinstructions"_test = [] {
+            vm::Bytecode bytecode;
+            bytecode.write(
+                ipush, 0_iz,
+                ipush, 2_iz,
+                iadd,
+                idup,
+                local_jump_igt_i, vm::Local_offset_type(-22), 10_iz,
+                halt
+            );
+
+            auto const fused = vm::fuse_superinstructions(bytecode);
+
+            // The backward jump must be relocated to the start of ipush_iadd
+            vm::Bytecode expected;
+            expected.write(
+                ipush, 0_iz,
+                ipush_iadd, 2_iz,
+                idup_local_jump_igt_i, vm::Local_offset_type(-20), 10_iz,
+                halt
+            );
+
+            assert_eq(fused.bytes == expected.bytes, true);
+
+            // Fusing a program relocates its stack maps and debug table as well
+            vm::Executable_program program { .bytecode = bytecode };
+            program.stack_maps.add(31, { 24 });
+
+            vm::Debug_table_builder builder;
+            builder.add_function("main");
+            builder.add_row(0,  { .line = 1, .column = 1 });
+            builder.add_row(9,  { .line = 2, .column = 1 });
+            builder.add_row(18, { .line = 2, .column = 3 });
+            builder.add_row(19, { .line = 3, .column = 1 });
+            builder.add_row(31, { .line = 4, .column = 1 });
+            program.debug_table = builder.build();
+
+            auto const fused_program = vm::fuse_superinstructions(program);
+            assert_eq(fused_program.bytecode.bytes == expected.bytes, true);
+            assert_eq(fused_program.stack_maps.find(37_uz) != nullptr, true);
+            assert_eq(fused_program.debug_table.find(9)->position.column, 3_uz);
+            assert_eq(fused_program.debug_table.find(26)->position.line, 3_uz);
+            assert_eq(fused_program.debug_table.find(37)->position.line, 4_uz);
+
+            // Local accesses are fused, and rewritten in their smallest forms
+            bytecode.bytes.clear();
+            bytecode.write(
+                push_address, vm::Local_offset_type(24),
+                bitcopy_to_stack, vm::Local_size_type(8),
+                push_address, vm::Local_offset_type(-16),
+                bitcopy_from_stack, vm::Local_size_type(8),
+                load_local, vm::Local_offset_type(32), vm::Local_size_type(2),
+                store_local, vm::Local_offset_type(300), vm::Local_size_type(16)
+            );
+
+            expected.bytes.clear();
+            expected.write(
+                load_local_8_short, vm::Short_local_offset_type(24),
+                store_local_8, vm::Local_offset_type(-16),
+                load_local, vm::Local_offset_type(32), vm::Local_size_type(2),
+                store_local_16, vm::Local_offset_type(300)
+            );
+
+            assert_eq(vm::fuse_superinstructions(bytecode).bytes == expected.bytes, true);
+        };
+
+        "register_machine"_test = [] {
+            using enum vm::Register_opcode;
+            constexpr vm::Register_index r0 = 0, r1 = 1, r2 = 2;
+
+            vm::Register_machine machine;
+            machine.bytecode.write(
+                imove, r0, 0_iz,
+                imove, r1, 0_iz,
+                imove, r2, 10_iz,
+                iadd_i, r1, r1, 1_iz,
+                iadd, r0, r0, r1,
+                jump_ilt, r1, r2, vm::Local_offset_type(-20),
+                halt, r0
+            );
+
+            assert_eq(55, machine.run());
+
+            // Integer arithmetic wraps around, so the largest integer plus one is the smallest
+            vm::Register_machine wrapping;
+            wrapping.bytecode.write(
+                imove, r0, std::numeric_limits<bu::Isize>::max(),
+                iadd_i, r1, r0, 1_iz,
+                imove, r2, std::numeric_limits<bu::Isize>::min(),
+                ieq, r0, r1, r2,
+                halt, r0
+            );
+            assert_eq(1, wrapping.run());
+        };
+
+        "verifier"_test = [] {
+            assert_eq(
+                9_uz,
+                verification_error_offset(
+                    256,
+                    ipush, 2_iz,
+                    iadd,
+                    halt
+                )
+            );
+
+            assert_eq(
+                10_uz,
+                verification_error_offset(
+                    256,
+                    push_true,
+                    ipush, 2_iz,
+                    iadd,
+                    halt
+                )
+            );
+
+            assert_eq(
+                9_uz,
+                verification_error_offset(
+                    8,
+                    ipush, 2_iz,
+                    ipush, 5_iz,
+                    iadd,
+                    halt
+                )
+            );
+
+            assert_eq(
+                0_uz,
+                verification_error_offset(
+                    256,
+                    jump, vm::Jump_offset_type(3),
+                    ipush, 2_iz,
+                    halt
+                )
+            );
+        };
     }
 
 }